@@ -253,6 +253,9 @@ int main(void)
 	ray_camera.max_depth = 10;
 	ray_camera.simulate_time = true;
 
+	rt::RenderParams ray_params;
+	bool show_sample_counts = false;
+
 	rt::Scene scene = rt::GenerateScene(rt::Scenes::CornellBox);
 
 	/* ========================= */
@@ -443,7 +446,9 @@ int main(void)
 
 				ray_camera.Initialize();
 
-				image = rt::RayTrace(&scene, &ray_camera);
+				/* Render for at most about a frame so the UI stays responsive, continuing the pass on the next frame */
+				image = rt::RayTraceProgressive(&scene, &ray_camera, 1.0 / 60.0, ray_params);
+				if (show_sample_counts) image = rt::SampleCountImage(ray_camera);
 
 				ray_traced_texture->Update(&image[0], viewport_width, viewport_height);
 				ImGui::Image((ImTextureID)ray_traced_texture->GetTexture(), wsize);
@@ -477,6 +482,8 @@ int main(void)
 			ImGui::SliderFloat("Displacement Height", &displacement_height, 0.0f, 1.0f);
 			ImGui::SliderFloat("Tessellation Level", &tessellation_level, 1.0f, 64.0f);
 			ImGui::Checkbox("Show Wireframe", &show_wireframe);
+			ImGui::Checkbox("Adaptive Sampling", &ray_params.adaptive);
+			ImGui::Checkbox("Show Sample Counts", &show_sample_counts);
 		}
 		ImGui::End();
 		
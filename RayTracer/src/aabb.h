@@ -50,10 +50,10 @@ public:
 		for (unsigned int axis = 0; axis < 3; axis++)
 		{
 			const Interval& ax = AxisInterval(axis);
-			const double adinv = 1.0 / ray_direction[axis];
+			const Real adinv = 1.0 / ray_direction[axis];
 
-			double t0 = (ax.min - ray_origin[axis]) * adinv;
-			double t1 = (ax.max - ray_origin[axis]) * adinv;
+			Real t0 = (ax.min - ray_origin[axis]) * adinv;
+			Real t1 = (ax.max - ray_origin[axis]) * adinv;
 
 			if (t0 < t1)
 			{
@@ -72,6 +72,49 @@ public:
 		return true;
 	}
 
+	/* Returns the surface area of the bounding box (zero if the box is empty) */
+	Real SurfaceArea() const
+	{
+		Real dx = x.Size();
+		Real dy = y.Size();
+		Real dz = z.Size();
+		if (dx < 0.0 || dy < 0.0 || dz < 0.0) return 0.0;
+		return 2.0 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	/* Returns true if the box encloses no points */
+	bool IsEmpty() const
+	{
+		return x.Size() < 0.0 || y.Size() < 0.0 || z.Size() < 0.0;
+	}
+
+	/* Returns the overlap of this box with another one (empty if they do not overlap). Unlike
+	the constructors, the result is not padded so that it never extends past either box. */
+	AABB Intersection(const AABB& other) const
+	{
+		AABB result;
+		result.x = Interval(std::max(x.min, other.x.min), std::min(x.max, other.x.max));
+		result.y = Interval(std::max(y.min, other.y.min), std::min(y.max, other.y.max));
+		result.z = Interval(std::max(z.min, other.z.min), std::min(z.max, other.z.max));
+		return result;
+	}
+
+	/* Split the box at the plane where the coordinate along `axis` equals `position`. A half is empty if the plane lies outside the box. */
+	void Split(int axis, Real position, AABB& left, AABB& right) const
+	{
+		left = *this;
+		right = *this;
+		if (axis == 0) { left.x.max = std::min(x.max, position); right.x.min = std::max(x.min, position); }
+		else if (axis == 1) { left.y.max = std::min(y.max, position); right.y.min = std::max(y.min, position); }
+		else { left.z.max = std::min(z.max, position); right.z.min = std::max(z.min, position); }
+	}
+
+	/* Returns the center point of the bounding box */
+	Point3 Centroid() const
+	{
+		return 0.5 * Point3(x.min + x.max, y.min + y.max, z.min + z.max);
+	}
+
 	/* Returns the index of the longest axis of the bounding box */
 	int LongestAxis() const
 	{
@@ -88,7 +131,7 @@ private:
 	/* Adjust the AABB so that no side is narrower than some delta */
 	void PadToMinimums()
 	{
-		double delta = 0.0001;
+		Real delta = 0.0001;
 		if (x.Size() < delta) x = x.Expand(delta);
 		if (y.Size() < delta) y = y.Expand(delta);
 		if (z.Size() < delta) z = z.Expand(delta);
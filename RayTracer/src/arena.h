@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace rt
+{
+
+/* A monotonic (bump) allocator for the objects of a scene. Allocations are carved out of large blocks and
+individual deallocations are ignored: all memory is released at once when the arena is destroyed, so the
+objects allocated from it must not outlive it. The arena is not thread safe. */
+class Arena : public std::pmr::memory_resource
+{
+public:
+	Arena(size_t initial_block_size = 1 << 16) : initial_block_size(initial_block_size) { blocks.emplace(initial_block_size); }
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	/* Number of bytes and allocations requested from the arena so far */
+	size_t BytesAllocated() const { return bytes_allocated; }
+	size_t AllocationCount() const { return allocation_count; }
+
+	/* Rewind the arena to reuse it, e.g., as scratch memory. The first block is kept, so an arena that is reset
+	regularly stops allocating from the heap once its first block has grown to fit a round of allocations.
+	Objects allocated from it must have been destroyed (or must be trivially destructible). */
+	void Reset()
+	{
+		if (bytes_allocated > first_block_size)
+		{
+			/* Outgrew the first block: replace it with one that fits this round (with room for padding) */
+			blocks.reset();
+			first_block_size = std::max(initial_block_size, 2 * bytes_allocated);
+			first_block = std::make_unique_for_overwrite<std::byte[]>(first_block_size);
+			blocks.emplace(first_block.get(), first_block_size);
+		}
+		else
+		{
+			blocks->release();
+		}
+		bytes_allocated = 0;
+		allocation_count = 0;
+	}
+
+	/* Return all memory of the arena to the heap, including the first block kept by Reset */
+	void Release()
+	{
+		blocks.reset();
+		first_block.reset();
+		first_block_size = 0;
+		blocks.emplace(initial_block_size);
+		bytes_allocated = 0;
+		allocation_count = 0;
+	}
+
+	/* The arena that objects created with MakeShared on the calling thread are allocated from (nullptr for the heap) */
+	static Arena* Current() { return current; }
+
+private:
+	std::optional<std::pmr::monotonic_buffer_resource> blocks; /* Rebuilt when the first block changes */
+	std::unique_ptr<std::byte[]> first_block; /* Kept across Reset (see there) */
+	size_t first_block_size = 0;
+	size_t initial_block_size;
+	size_t bytes_allocated = 0;
+	size_t allocation_count = 0;
+
+	static inline thread_local Arena* current = nullptr;
+
+	friend class ArenaScope;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		bytes_allocated += bytes;
+		allocation_count++;
+		return blocks->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {} /* Released with the arena */
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+
+/* Makes an arena (or the heap, for nullptr) the current arena of the calling thread for the lifetime of the scope */
+class ArenaScope
+{
+public:
+	ArenaScope(Arena* arena) : previous(Arena::current) { Arena::current = arena; }
+	~ArenaScope() { Arena::current = previous; }
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+	Arena* previous;
+};
+
+
+/* Like std::make_shared, but the object (and its control block) is allocated from the current arena of the
+calling thread (see ArenaScope) if there is one. Objects of a scene are created with this during scene
+construction. Threads without a current arena, such as BVH build workers, allocate from the heap. */
+template <typename T, typename... Args>
+std::shared_ptr<T> MakeShared(Args&&... args)
+{
+	if (Arena* arena = Arena::Current()) return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(arena), std::forward<Args>(args)...);
+	return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+
+/* Deleter of the objects created with MakeUnique. Objects in an arena are only destroyed, their memory is
+released with the arena; heap objects are deleted. */
+class ArenaDeleter
+{
+public:
+	ArenaDeleter(Arena* arena = nullptr) : arena(arena) {}
+
+	template <typename T>
+	void operator()(T* object) const
+	{
+		if (arena) std::destroy_at(object);
+		else delete object;
+	}
+
+private:
+	Arena* arena;
+};
+
+/* Sole owner of an object created with MakeUnique */
+template <typename T>
+using ArenaPtr = std::unique_ptr<T, ArenaDeleter>;
+
+
+/* Like std::make_unique, but the object is allocated from the current arena of the calling thread (see ArenaScope)
+if there is one */
+template <typename T, typename... Args>
+ArenaPtr<T> MakeUnique(Args&&... args)
+{
+	if (Arena* arena = Arena::Current())
+	{
+		void* memory = arena->allocate(sizeof(T), alignof(T));
+		return ArenaPtr<T>(new (memory) T(std::forward<Args>(args)...), ArenaDeleter(arena));
+	}
+	return ArenaPtr<T>(new T(std::forward<Args>(args)...));
+}
+
+} /* namespace rt */
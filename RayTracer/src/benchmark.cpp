@@ -0,0 +1,608 @@
+#include "benchmark.h"
+#include "bvh.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(RT_COUNT_ALLOCATIONS)
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h> /* _aligned_malloc */
+#endif
+
+/* The global operator new (plain and over-aligned) is replaced to count every heap allocation of the process
+(see rt::AllocationCount). The array and nothrow forms of new and all forms of delete forward to these by default. */
+static std::atomic<size_t> allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size > 0 ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	const std::size_t align = static_cast<std::size_t>(alignment);
+#if defined(_WIN32)
+	if (void* p = _aligned_malloc(size > 0 ? size : 1, align)) return p;
+#else
+	/* aligned_alloc requires the size to be a multiple of the alignment */
+	if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align + (size == 0 ? align : 0))) return p;
+#endif
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+#endif
+
+namespace rt
+{
+
+std::vector<Ray> GenerateBenchmarkRays(const Point3& eye, const Point3& look_at, double fov, size_t count, unsigned int seed)
+{
+	/* Note: a local generator is used so that every benchmark run uses the exact same rays */
+	std::mt19937_64 generator(seed);
+	std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+
+	const Vec3 w = glm::normalize(look_at - eye);
+	const Vec3 u = glm::normalize(glm::cross(w, Vec3(0.0, 0.0, 1.0)));
+	const Vec3 v = glm::cross(u, w);
+	const double half_size = std::tan(0.5 * DegreesToRadians(fov));
+
+	std::vector<Ray> rays(count);
+	for (auto& ray : rays)
+	{
+		double x = distribution(generator) * half_size;
+		double y = distribution(generator) * half_size;
+		ray = Ray(eye, glm::normalize(w + x * u + y * v));
+	}
+
+	return rays;
+}
+
+
+PerspectiveCamera BenchmarkCamera(unsigned int image_size)
+{
+	PerspectiveCamera camera;
+	camera.image_width = image_size;
+	camera.image_height = image_size;
+	camera.origin = Point3(17.5, 0.0, 5.0);
+	camera.look_at = Point3(0.0, 0.0, 5.0);
+	camera.up = Vec3(0.0, 0.0, 1.0);
+	camera.vfov = 60.0;
+	camera.Initialize();
+	return camera;
+}
+
+
+BenchmarkResult BenchmarkHittable(const std::string& name, const Hittable& hittable, const std::vector<Ray>& rays)
+{
+	BenchmarkResult result;
+	result.name = name;
+	result.ray_count = rays.size();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const auto& ray : rays)
+	{
+		HitRecord hrec;
+		if (hittable.Hit(ray, Interval(RayEps, Inf), hrec)) result.hit_count++;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	return result;
+}
+
+
+BenchmarkResult BenchmarkOccluded(const std::string& name, const Hittable& hittable, const std::vector<Ray>& rays, double t_max)
+{
+	BenchmarkResult result;
+	result.name = name;
+	result.ray_count = rays.size();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const auto& ray : rays)
+	{
+		if (hittable.Occluded(ray, t_max)) result.hit_count++;
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	result.seconds = std::chrono::duration<double>(end - start).count();
+	return result;
+}
+
+
+size_t HeapUsage()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters))) return 0;
+	return counters.PrivateUsage;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+
+size_t AllocationCount()
+{
+#if defined(RT_COUNT_ALLOCATIONS)
+	return allocation_count.load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
+
+
+void PrintBenchmarkResult(const BenchmarkResult& result)
+{
+	std::cout << "[rt::Benchmark] " << result.name << ": "
+		<< result.RaysPerSecond() / 1.0e6 << " Mrays/s ("
+		<< result.hit_count << "/" << result.ray_count << " hits, "
+		<< result.seconds * 1000.0 << " ms)" << std::endl;
+}
+
+
+
+/* Returns true if both trees have the same nodes and primitive order */
+static bool SameTree(const BVH_BuildTree& a, const BVH_BuildTree& b)
+{
+	if (a.nodes.size() != b.nodes.size() || a.prim_indices != b.prim_indices) return false;
+	for (size_t i = 0; i < a.nodes.size(); i++)
+	{
+		const BVH_BuildNode& na = a.nodes[i];
+		const BVH_BuildNode& nb = b.nodes[i];
+		if (na.left != nb.left || na.right != nb.right || na.first_prim != nb.first_prim || na.prim_count != nb.prim_count || na.axis != nb.axis) return false;
+	}
+	return true;
+}
+
+
+static const char* SplitMethodName(BVH_SplitMethod method)
+{
+	const char* names[] = { "median", "SAH", "Morton", "SBVH" };
+	return names[method];
+}
+
+
+void BenchmarkBVH_Build(const HittableList& list, BVH_BuildParams params, int max_threads)
+{
+	if (max_threads <= 0) max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	std::vector<BVH_BuildPrimitive> build_prims(list.objects.size());
+	for (size_t i = 0; i < list.objects.size(); i++)
+	{
+		build_prims[i] = BVH_BuildPrimitive(list.objects[i]->BoundingBox(), (unsigned int)i);
+	}
+	double millions = std::max(1.0, (double)build_prims.size()) / 1.0e6;
+
+	std::cout << "[rt::Benchmark] BVH build of " << build_prims.size() << " primitives ("
+		<< SplitMethodName(params.split_method) << (params.deterministic ? ", deterministic" : "") << ")" << std::endl;
+
+	BVH_BuildTree reference;
+	double reference_ms = 0.0;
+	for (int threads = 1; ; threads = std::min(2 * threads, max_threads))
+	{
+		params.thread_count = threads;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		BVH_BuildTree tree = BVH_Builder(params).Build(build_prims);
+		auto end = std::chrono::high_resolution_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+		if (threads == 1)
+		{
+			reference = std::move(tree);
+			reference_ms = ms;
+		}
+
+		std::cout << "[rt::Benchmark]   " << threads << " thread(s): " << ms / millions << " ms per million primitives ("
+			<< reference_ms / ms << "x)";
+		if (params.deterministic && threads > 1) std::cout << (SameTree(reference, tree) ? ", identical tree" : ", TREE DIFFERS");
+		std::cout << std::endl;
+
+		if (threads == max_threads) break;
+	}
+}
+
+
+
+void BenchmarkBVH_Builders(const HittableList& list, const BVH_BuildParams& params)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	auto elapsed_ms = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+	std::cout << "[rt::Benchmark] BVH builders over " << list.objects.size() << " primitives" << std::endl;
+
+	/* The recursive constructor sorts the object list in place, so it gets its own copy */
+	std::vector<std::shared_ptr<Hittable>> objects = list.objects;
+	auto start = Clock::now();
+	BVH_Node node(objects, 0, objects.size(), params);
+	double ms = elapsed_ms(start);
+	std::cout << "[rt::Benchmark]   BVH_Node (recursive): " << ms << " ms, SAH cost " << node.SAH_Cost() << std::endl;
+
+	std::vector<BVH_BuildPrimitive> build_prims(list.objects.size());
+	for (size_t i = 0; i < list.objects.size(); i++)
+	{
+		build_prims[i] = BVH_BuildPrimitive(list.objects[i]->BoundingBox(), (unsigned int)i);
+	}
+
+	const char* names[] = { "median", "SAH", "Morton", "Morton + SAH treelets", "median + treelet restructuring", "Morton + treelet restructuring" };
+	const BVH_SplitMethod methods[] = { SplitMedian, SplitSAH, SplitMorton, SplitMorton, SplitMedian, SplitMorton };
+	for (int i = 0; i < 6; i++)
+	{
+		BVH_BuildParams builder_params = params;
+		builder_params.split_method = methods[i];
+		builder_params.morton_sah_treelet_size = i == 3 ? 64 : 0;
+		builder_params.treelet_leaf_count = i >= 4 ? 7 : 0;
+
+		start = Clock::now();
+		BVH_BuildTree tree = BVH_Builder(builder_params).Build(build_prims);
+		ms = elapsed_ms(start);
+		std::cout << "[rt::Benchmark]   BVH_Builder (" << names[i] << "): " << ms << " ms, SAH cost " << tree.SAH_Cost(builder_params) << std::endl;
+	}
+
+	/* Spatial splits clip the objects themselves, so they are built from the object list */
+	BVH_BuildParams sbvh_params = params;
+	sbvh_params.split_method = SplitSBVH;
+	start = Clock::now();
+	BVH_BuildTree tree = BuildHittableTree(list.objects, sbvh_params);
+	ms = elapsed_ms(start);
+	std::cout << "[rt::Benchmark]   BVH_Builder (SBVH): " << ms << " ms, SAH cost " << tree.SAH_Cost(sbvh_params)
+		<< ", " << tree.prim_indices.size() << " references" << std::endl;
+}
+
+
+bool CheckHitSpans()
+{
+	auto equal = [](const Interval& span, Real min, Real max) { return span.min == min && span.max == max; };
+
+	/* While there is room, the spans are the exact union */
+	HitSpans spans;
+	spans.Add(Interval(4.0, 5.0));
+	spans.Add(Interval(0.0, 1.0));
+	spans.Add(Interval(2.0, 3.0));
+	spans.Add(Interval(0.5, 2.5));
+	spans.Add(Interval(6.0, 6.0));
+	bool passed = spans.count == 2 && equal(spans.spans[0], 0.0, 3.0) && equal(spans.spans[1], 4.0, 5.0);
+
+	/* Once all spans are in use, a disjoint span is merged with the next one (or the last one if there is none) */
+	HitSpans full;
+	for (int i = 0; i < HitSpans::max_spans; i++) full.Add(Interval(2.0 * i, 2.0 * i + 1.0));
+	full.Add(Interval(5.5, 5.75));
+	full.Add(Interval(20.0, 21.0));
+	passed = passed && full.count == HitSpans::max_spans && equal(full.spans[2], 4.0, 5.0) && equal(full.spans[3], 5.5, 7.0)
+		&& equal(full.spans[HitSpans::max_spans - 1], 2.0 * HitSpans::max_spans - 2.0, 21.0);
+
+	/* A span overlapping several stored ones merges them, which frees room */
+	full.Add(Interval(0.5, 2.5));
+	passed = passed && full.count == HitSpans::max_spans - 1 && equal(full.spans[0], 0.0, 3.0) && equal(full.spans[1], 4.0, 5.0);
+
+	/* Random spans, mostly more than fit */
+	std::mt19937_64 generator(1);
+	std::uniform_real_distribution<double> position(0.0, 100.0), length(0.0, 5.0);
+	for (int trial = 0; trial < 1000 && passed; trial++)
+	{
+		HitSpans random;
+		std::vector<Interval> added;
+		for (int i = 0; i < 24; i++)
+		{
+			Real min = position(generator);
+			added.push_back(Interval(min, min + length(generator)));
+			random.Add(added.back());
+		}
+
+		for (int i = 0; i < random.count; i++)
+		{
+			if (!(random.spans[i].min < random.spans[i].max)) passed = false;
+			if (i > 0 && !(random.spans[i - 1].max < random.spans[i].min)) passed = false;
+		}
+
+		for (const Interval& span : added)
+		{
+			bool covered = std::any_of(random.spans, random.spans + random.count, [&](const Interval& s) { return s.min <= span.min && span.max <= s.max; });
+			if (!covered) passed = false;
+		}
+	}
+
+	std::cout << "[rt::Check] HitSpans::Add: " << (passed ? "passed" : "FAILED") << std::endl;
+	return passed;
+}
+
+
+bool CheckHitIntervals(size_t ray_count)
+{
+	/* Overlapping spheres and rotated boxes, some of them instanced */
+	std::mt19937_64 generator(1);
+	std::uniform_real_distribution<double> position(-5.0, 5.0), size(0.2, 1.5), angle(0.0, 360.0);
+
+	HittableList objects;
+	for (int i = 0; i < 100; i++)
+	{
+		Point3 center = Point3(position(generator), position(generator), position(generator));
+		Real radius = size(generator);
+		if (i % 2 == 0)
+		{
+			objects.Add(MakeShared<Sphere>(center, radius, 0));
+			continue;
+		}
+
+		Transform transform;
+		transform.Translate(center);
+		transform.Rotate(angle(generator), glm::normalize(Vec3(position(generator), position(generator), 1.0)));
+		transform.Scale(Vec3(radius, 2.0 * radius, 0.5 * radius));
+		if (i % 3 == 0) objects.Add(MakeShared<Instance>(transform, MakeShared<Sphere>(Point3(0.0, 0.0, 0.0), 1.0, 0)));
+		else objects.Add(Box(transform, 0));
+	}
+
+	BVH_BuildParams linear_params, wide_params;
+	linear_params.layout = LayoutLinear;
+	wide_params.layout = LayoutWide4;
+
+	HittableList first_objects;
+	for (int i = 0; i < 4; i++) first_objects.Add(objects.objects[i]);
+
+	std::vector<std::pair<std::string, std::shared_ptr<Hittable>>> aggregates = {
+		{ "HittableList", MakeShared<HittableList>(first_objects) },
+		{ "BVH_Node", MakeShared<BVH_Node>(objects) },
+		{ "LinearBVH", MakeShared<LinearBVH>(objects, linear_params) },
+		{ "BVH4", MakeShared<BVH4>(objects, wide_params) },
+	};
+
+	/* Rays from outside the objects and from within them */
+	std::vector<Ray> rays = GenerateBenchmarkRays(Point3(12.0, 1.0, 0.5), Point3(0.0, 0.0, 0.0), 60.0, ray_count / 2);
+	std::vector<Ray> inside_rays = GenerateBenchmarkRays(Point3(0.5, -0.5, 0.0), Point3(1.0, 0.0, 0.0), 150.0, ray_count - rays.size(), 2);
+	rays.insert(rays.end(), inside_rays.begin(), inside_rays.end());
+	const Interval ray_t = Interval(RayEps, 20.0);
+
+	/* Spans shorter than the tolerance are ignored: pairing Hits cannot find those of grazing rays, since the exit
+	is searched for from RayEps past the entry */
+	const Real tolerance = 1.0e-3;
+	auto same_spans = [tolerance](const HitSpans& a, const HitSpans& b) {
+		std::vector<Interval> a_spans, b_spans;
+		std::copy_if(a.spans, a.spans + a.count, std::back_inserter(a_spans), [tolerance](const Interval& span) { return span.Size() > tolerance; });
+		std::copy_if(b.spans, b.spans + b.count, std::back_inserter(b_spans), [tolerance](const Interval& span) { return span.Size() > tolerance; });
+		if (a_spans.size() != b_spans.size()) return false;
+
+		for (size_t i = 0; i < a_spans.size(); i++)
+		{
+			if (std::fabs(a_spans[i].min - b_spans[i].min) > tolerance || std::fabs(a_spans[i].max - b_spans[i].max) > tolerance) return false;
+		}
+		return true;
+	};
+
+	/* Each primitive against its own Hit pairing */
+	size_t failures = 0;
+	for (const Ray& ray : rays)
+	{
+		for (const auto& object : objects.objects)
+		{
+			HitSpans spans, expected;
+			object->HitInterval(ray, ray_t, spans);
+			object->Hittable::HitInterval(ray, ray_t, expected);
+			if (!same_spans(spans, expected)) failures++;
+		}
+	}
+
+	bool passed = failures == 0;
+	std::cout << "[rt::Check] HitInterval of Sphere, OrientedBox and Instance: " << (passed ? "passed" : "FAILED") << " ("
+		<< failures << " of " << rays.size() * objects.objects.size() << " queries wrong)" << std::endl;
+
+	/* Each aggregate against the union of the pairings of the objects in it. Rays crossing more separate spans
+	than fit are skipped, since the spans are then merged in the order the objects are visited. */
+	for (const auto& [name, aggregate] : aggregates)
+	{
+		const HittableList& contents = name == "HittableList" ? first_objects : objects;
+
+		failures = 0;
+		for (const Ray& ray : rays)
+		{
+			HitSpans spans, expected;
+			for (const auto& object : contents.objects) object->Hittable::HitInterval(ray, ray_t, expected);
+			if (expected.count == HitSpans::max_spans) continue;
+
+			aggregate->HitInterval(ray, ray_t, spans);
+			if (!same_spans(spans, expected)) failures++;
+		}
+
+		std::cout << "[rt::Check] HitInterval of a " << name << ": " << (failures == 0 ? "passed" : "FAILED") << " ("
+			<< failures << " of " << rays.size() << " rays wrong)" << std::endl;
+		passed = passed && failures == 0;
+	}
+
+	return passed;
+}
+
+
+/* Returns the corners of the box between `a` and `b` and three corner indices per triangle of its faces */
+static void BoxTriangles(const Point3& a, const Point3& b, std::vector<Point3>& corners, std::vector<std::uint32_t>& indices)
+{
+	corners.clear();
+	for (int corner = 0; corner < 8; corner++)
+	{
+		corners.push_back(Point3(corner & 1 ? b.x : a.x, corner & 2 ? b.y : a.y, corner & 4 ? b.z : a.z));
+	}
+
+	/* The corners of each face in order around it, split along a diagonal */
+	const std::uint32_t faces[6][4] = { { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 6, 7, 5 } };
+	indices.clear();
+	for (const auto& face : faces)
+	{
+		indices.insert(indices.end(), { face[0], face[1], face[2], face[0], face[2], face[3] });
+	}
+}
+
+
+bool CheckConstantMedium(size_t ray_count)
+{
+	const Point3 a = Point3(-1.0, -1.0, -1.0), b = Point3(1.0, 1.0, 1.0);
+	auto box = Box(a, b, 0);
+
+	std::vector<Point3> corners;
+	std::vector<std::uint32_t> indices;
+	BoxTriangles(a, b, corners, indices);
+
+	HittableList faces;
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		faces.Add(MakeShared<Triangle>(Transform(), corners[indices[i]], corners[indices[i + 1]], corners[indices[i + 2]], 0));
+	}
+
+	std::vector<Vec3f> positions(corners.begin(), corners.end());
+	auto mesh = MakeShared<Mesh>(Transform(), positions, std::vector<Vec3f>(), std::vector<Vec2f>(), indices, 0);
+
+	BVH_BuildParams linear_params, wide_params;
+	linear_params.layout = LayoutLinear;
+	wide_params.layout = LayoutWide4;
+
+	std::vector<std::pair<std::string, std::shared_ptr<Hittable>>> boundaries = {
+		{ "an OrientedBox", box },
+		{ "a list of Triangles", MakeShared<HittableList>(faces) },
+		{ "a BVH_Node of Triangles", MakeShared<BVH_Node>(faces) },
+		{ "a LinearBVH of Triangles", MakeShared<LinearBVH>(faces, linear_params) },
+		{ "a BVH4 of Triangles", MakeShared<BVH4>(faces, wide_params) },
+		{ "a Mesh", mesh },
+		{ "an Instance of a Mesh", MakeShared<Instance>(Transform(), mesh) },
+	};
+
+	/* Rays from outside the box and from inside it */
+	std::vector<Ray> rays = GenerateBenchmarkRays(Point3(4.0, 0.5, 0.3), Point3(0.0, 0.0, 0.0), 60.0, ray_count / 2);
+	std::vector<Ray> inside_rays = GenerateBenchmarkRays(Point3(0.2, 0.1, -0.3), Point3(1.0, 0.0, 0.0), 150.0, ray_count - rays.size(), 2);
+	rays.insert(rays.end(), inside_rays.begin(), inside_rays.end());
+
+	/* With a mean free path far below the tolerance, the medium scatters where the ray enters the box
+	(or at its origin, if it starts inside) */
+	bool passed = true;
+	for (const auto& [name, boundary] : boundaries)
+	{
+		ConstantMedium medium(boundary, 1.0e6, 0);
+
+		size_t failures = 0;
+		for (const Ray& ray : rays)
+		{
+			Real t_enter, t_exit;
+			bool expected = box->Span(ray, t_enter, t_exit) && t_exit > RayEps;
+
+			HitRecord hrec;
+			bool hit = medium.Hit(ray, Interval(RayEps, Inf), hrec);
+			if (hit != expected || (hit && std::fabs(hrec.t - std::fmax(t_enter, 0.0)) > 1.0e-3)) failures++;
+		}
+
+		std::cout << "[rt::Check] ConstantMedium bounded by " << name << ": " << (failures == 0 ? "passed" : "FAILED") << " ("
+			<< failures << " of " << rays.size() << " rays wrong)" << std::endl;
+		passed = passed && failures == 0;
+	}
+
+	return passed;
+}
+
+
+
+bool CheckNestedInstances(size_t ray_count)
+{
+	std::mt19937_64 generator(1);
+	std::uniform_real_distribution<double> offset(-1.0, 1.0), angle(0.0, 360.0), scale(0.7, 1.3);
+
+	bool passed = true;
+	std::shared_ptr<Hittable> nested = MakeShared<Sphere>(Point3(0.0, 0.0, 0.0), 1.0, 0);
+	Transform composed;
+	for (int depth = 1; depth <= 8; depth++)
+	{
+		Transform transform;
+		transform.Translate(Vec3(offset(generator), offset(generator), offset(generator)));
+		transform.Rotate(angle(generator), glm::normalize(Vec3(offset(generator), offset(generator), 1.0)));
+		transform.Scale(scale(generator));
+
+		nested = MakeShared<Instance>(transform, nested);
+		composed = transform.Compose(composed);
+		Sphere flat = Sphere(composed, 0);
+
+		Point3 center = composed.PointModelToWorld(Point3(0.0, 0.0, 0.0));
+		std::vector<Ray> rays = GenerateBenchmarkRays(center + Vec3(6.0, 1.0, 0.5), center, 30.0, ray_count);
+
+		size_t failures = 0;
+		for (const Ray& ray : rays)
+		{
+			HitRecord nested_hrec, flat_hrec;
+			bool nested_hit = nested->Hit(ray, Interval(RayEps, Inf), nested_hrec);
+			if (nested_hit != flat.Hit(ray, Interval(RayEps, Inf), flat_hrec))
+			{
+				failures++;
+				continue;
+			}
+			if (!nested_hit) continue;
+
+			SurfaceInteraction nested_interaction, flat_interaction;
+			nested_hrec.Interaction(ray, nested_interaction);
+			flat_hrec.Interaction(ray, flat_interaction);
+
+			Point3 nested_point = nested_interaction.transform.PointModelToWorld(nested_interaction.posn);
+			Point3 flat_point = flat_interaction.transform.PointModelToWorld(flat_interaction.posn);
+			Vec3 nested_normal = glm::normalize(nested_interaction.transform.GetWorldNormal(nested_interaction.normal));
+			Vec3 flat_normal = glm::normalize(flat_interaction.transform.GetWorldNormal(flat_interaction.normal));
+			if (glm::length(nested_point - flat_point) > 1.0e-3 || glm::length(nested_normal - flat_normal) > 1.0e-3) failures++;
+		}
+
+		if (failures > 0)
+		{
+			std::cout << "[rt::Check] " << depth << " nested Instances: FAILED (" << failures << " of " << rays.size() << " rays wrong)" << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << "[rt::Check] Nested Instances: " << (passed ? "passed" : "FAILED") << std::endl;
+	return passed;
+}
+
+
+bool RunChecks()
+{
+	bool passed = CheckHitSpans();
+	passed = CheckHitIntervals() && passed;
+	passed = CheckConstantMedium() && passed;
+	passed = CheckNestedInstances() && passed;
+	return passed;
+}
+
+} /* namespace rt */
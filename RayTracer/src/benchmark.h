@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+#include "hittable.h"
+#include "bvh_builder.h"
+#include "cameras.h"
+
+#include <string>
+
+namespace rt
+{
+
+/* Result of tracing a batch of rays against a hittable */
+class BenchmarkResult
+{
+public:
+	std::string name;
+	size_t ray_count = 0;
+	size_t hit_count = 0;
+	double seconds = 0.0;
+
+public:
+	double RaysPerSecond() const { return seconds > 0.0 ? ray_count / seconds : 0.0; }
+};
+
+
+/* Generate a reproducible set of camera-like rays from `eye` towards random points of a square
+image plane centered on `look_at` with the provided field of view (in degrees). Up is +z. */
+std::vector<Ray> GenerateBenchmarkRays(const Point3& eye, const Point3& look_at, double fov, size_t count, unsigned int seed = 1);
+
+/* Returns an initialized image_size x image_size perspective camera with the view the scene benchmarks render from,
+which is the view of their GenerateBenchmarkRays rays */
+PerspectiveCamera BenchmarkCamera(unsigned int image_size);
+
+/* Trace each ray (closest hit) against the hittable on the calling thread and time it */
+BenchmarkResult BenchmarkHittable(const std::string& name, const Hittable& hittable, const std::vector<Ray>& rays);
+
+/* Trace each ray as an occlusion query (any hit, see Hittable::Occluded) against the hittable on the calling thread and time it */
+BenchmarkResult BenchmarkOccluded(const std::string& name, const Hittable& hittable, const std::vector<Ray>& rays, double t_max = Inf);
+
+/* Returns the number of bytes of heap memory currently in use by the process (0 where this cannot be queried).
+Differences between two calls measure the memory used by whatever was allocated in between. */
+size_t HeapUsage();
+
+/* Returns the number of heap allocations (calls of operator new) the process made so far. Allocations are only
+counted in builds with RT_COUNT_ALLOCATIONS defined (e.g., in the project's preprocessor definitions of a benchmark
+configuration), since this replaces the global operator new. Otherwise, 0 is returned. */
+size_t AllocationCount();
+
+/* Print a benchmark result as a single line */
+void PrintBenchmarkResult(const BenchmarkResult& result);
+
+/* Time BVH_Builder over the bounds of the provided objects with 1, 2, 4, ... up to `max_threads` threads
+(0 uses all hardware threads) and print the build time in ms per million primitives. Deterministic
+builds are also checked to produce the same tree as the single threaded build. */
+void BenchmarkBVH_Build(const HittableList& list, BVH_BuildParams params = BVH_BuildParams(), int max_threads = 0);
+
+/* Compare the build times of the recursive BVH_Node constructor and the BVH_Builder split methods
+(median, SAH, Morton, Morton with SAH treelets, and median and Morton followed by treelet restructuring)
+over the provided objects, along with their SAH costs */
+void BenchmarkBVH_Builders(const HittableList& list, const BVH_BuildParams& params = BVH_BuildParams());
+
+
+/* Regression checks of the intersection code. Each prints its result as a single line and returns true if it passed. */
+
+/* Check that a dense ConstantMedium starts scattering where rays enter its boundary, for a box given as an
+OrientedBox, as open Triangles (in a list and in each BVH layout) and as a Mesh (directly and instanced) */
+/* Check that HitSpans::Add keeps its spans sorted and disjoint and covering every added span, including once all of
+them are in use (when a new span is merged with its neighbor) */
+bool CheckHitSpans();
+
+/* Check HitInterval of Sphere, OrientedBox, Instance and aggregates of them (HittableList, BVH_Node, LinearBVH, BVH4)
+against the spans found by pairing entry and exit Hits (see Hittable::HitInterval) */
+bool CheckHitIntervals(size_t ray_count = 10000);
+
+bool CheckConstantMedium(size_t ray_count = 10000);
+
+/* Check that the surface interactions of spheres nested in 1 to 8 Instances (more than HitRecord::max_instance_depth)
+match those of a single sphere with the composed transform */
+bool CheckNestedInstances(size_t ray_count = 1000);
+
+/* Run all of the checks above and return true if all of them passed */
+bool RunChecks();
+
+} /* namespace rt */
@@ -3,8 +3,12 @@
 #include "common.h"
 #include "aabb.h"
 #include "hittable.h"
+#include "bvh_builder.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
 
 #include <algorithm>
+#include <thread>
 
 namespace rt
 {
@@ -12,15 +16,36 @@ namespace rt
 class BVH_Node : public Hittable
 {
 public:
-	BVH_Node(HittableList list) : BVH_Node(list.objects, 0, list.objects.size()) 
+	/* Build the tree over the object bounds with the (parallel) BVH_Builder. Note: leaves hold up to
+	params.max_leaf_size objects (more than two in a HittableList), unlike the one or two objects of the
+	recursive constructor below. Set max_leaf_size to 2 for the same leaf shape. */
+	BVH_Node(const HittableList& list, const BVH_BuildParams& params = BVH_BuildParams())
 	{
-		/* Note: this constructor creates an implicit copy of the BVH_Node that only
-		exists for the lifespan of the constructor. But this is ok since we only need to 
-		store the resulting BVH. */
+		/* Build the index based tree, then create the nodes from it */
+		BVH_BuildTree tree = BuildHittableTree(list.objects, params);
+		if (tree.nodes.empty())
+		{
+			/* Nothing to bound (e.g., a mesh that failed to load) */
+			left = MakeShared<HittableList>();
+			leaf_list = true;
+			UpdateClosed();
+			return;
+		}
+
+		InitFromTree(list.objects, tree, 0, params);
 
+		/* Keep the objects so that Refit can rebuild the tree */
+		primitives = list.objects;
+		built_sah_cost = sah_cost;
+	}
+
+	BVH_Node(const std::vector<std::shared_ptr<Hittable>>& objects, const BVH_BuildTree& tree, unsigned int node_index, const BVH_BuildParams& params)
+	{
+		InitFromTree(objects, tree, node_index, params);
 	}
 
-	BVH_Node(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end)
+	/* Note: this constructor builds the tree recursively on the calling thread */
+	BVH_Node(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end, const BVH_BuildParams& params = BVH_BuildParams())
 	{
 		/* Build a bounding box that spans all the source objects */
 		bounding_box = AABB(/*Interval(+Inf, -Inf), Interval(+Inf, -Inf), Interval(+Inf, -Inf)*/);
@@ -29,35 +54,100 @@ public:
 			bounding_box = AABB(bounding_box, objects[object_index]->BoundingBox());
 		}
 
-		/* Split along the longest axis */
-		int axis = bounding_box.LongestAxis();
-
-		auto comparator = (axis == 0) ? BoxXCompare : ((axis == 1) ? BoxYCompare : BoxZCompare);
-
 		size_t object_span = end - start;
 
+		if (object_span == 0)
+		{
+			/* Nothing to bound (e.g., a mesh that failed to load) */
+			left = MakeShared<HittableList>();
+			leaf_list = true;
+			UpdateClosed();
+			return;
+		}
+
 		if (object_span == 1)
 		{
-			/* If there is only 1 object remaining, assign it to both children*/
-			left = right = objects[start];
+			/* If there is only 1 object remaining, it is the only child */
+			left = objects[start];
+			sah_cost = ChildCost(left, params);
+			UpdateClosed();
+			return;
 		}
-		else if (object_span == 2)
+
+		if (object_span == 2)
 		{
 			/* If there are two objects remaining, assign one to each child */
 			left = objects[start];
 			right = objects[start + 1];
+			sah_cost = params.traversal_cost + (left->BoundingBox().SurfaceArea() * ChildCost(left, params)
+					 + right->BoundingBox().SurfaceArea() * ChildCost(right, params)) / bounding_box.SurfaceArea();
+			UpdateClosed();
+			return;
+		}
+
+		size_t mid = start + object_span / 2;
+
+		if (params.split_method == SplitSAH)
+		{
+			/* Bin the object centroids and pick the cheapest split plane */
+			AABB centroid_bounds;
+			for (size_t object_index = start; object_index < end; object_index++)
+			{
+				Point3 c = objects[object_index]->BoundingBox().Centroid();
+				centroid_bounds = AABB(centroid_bounds, AABB(c, c));
+			}
+
+			auto get_bounds = [](const std::shared_ptr<Hittable>& object) { return object->BoundingBox(); };
+			SAH_Split split = FindSAHSplit(objects.begin() + start, objects.begin() + end, get_bounds, bounding_box, centroid_bounds, params);
+
+			/* Small enough ranges that are cheaper to intersect directly than to split become leaves */
+			double leaf_cost = SAH_LeafCost(object_span, params);
+			if (object_span <= params.max_leaf_size && leaf_cost <= split.cost)
+			{
+				auto leaf = MakeShared<HittableList>();
+				sah_cost = 0.0;
+				for (size_t object_index = start; object_index < end; object_index++)
+				{
+					leaf->Add(objects[object_index]);
+					sah_cost += ChildCost(objects[object_index], params);
+				}
+				left = leaf;
+				leaf_list = true;
+				UpdateClosed();
+				return;
+			}
+
+			if (split.axis >= 0)
+			{
+				auto split_it = std::partition(objects.begin() + start, objects.begin() + end, [&](const std::shared_ptr<Hittable>& object) {
+					return SAH_BinIndex(object->BoundingBox().Centroid(), centroid_bounds, split.axis, params.BinCount()) <= split.bin;
+					});
+				mid = split_it - objects.begin();
+			}
+
+			/* Fall back to a median split if the binning could not separate the objects */
+			if (split.axis < 0 || mid == start || mid == end)
+			{
+				mid = start + object_span / 2;
+				SortAlongLongestAxis(objects, start, end);
+			}
 		}
 		else
 		{
 			/* Sort the objects along the determined longest axis, then 
 			assign the first half to the first child, second half to the other */
-			std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
-			/* Recursively create the remaining nodes */
-			auto mid = start + object_span / 2;
-			left = std::make_shared<BVH_Node>(objects, start, mid);
-			right = std::make_shared<BVH_Node>(objects, mid, end);
+			SortAlongLongestAxis(objects, start, end);
 		}
+
+		/* Recursively create the remaining nodes */
+		auto left_node = MakeShared<BVH_Node>(objects, start, mid, params);
+		auto right_node = MakeShared<BVH_Node>(objects, mid, end, params);
+		is_leaf = false;
+		sah_cost = params.traversal_cost + (left_node->BoundingBox().SurfaceArea() * left_node->SAH_Cost()
+				 + right_node->BoundingBox().SurfaceArea() * right_node->SAH_Cost()) / bounding_box.SurfaceArea();
+		left = left_node;
+		right = right_node;
+		UpdateClosed();
 	}
 
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& interaction) const override
@@ -65,17 +155,190 @@ public:
 		if (!bounding_box.Hit(ray, ray_t)) return false;
 
 		bool hit_left = left->Hit(ray, ray_t, interaction);
+		if (!right) return hit_left;
+
 		bool hit_right = right->Hit(ray, Interval(ray_t.min, hit_left ? interaction.t : ray_t.max), interaction);
 
 		return hit_left || hit_right;
 	}
 
+	bool Occluded(const Ray& ray, Real t_max) const override
+	{
+		if (!bounding_box.Hit(ray, Interval(RayEps, t_max))) return false;
+		if (!right) return left->Occluded(ray, t_max);
+
+		/* Test the child that is nearer along the ray first, it is the more likely one to end the query early */
+		bool right_first = glm::dot(right->BoundingBox().Centroid() - left->BoundingBox().Centroid(), ray.direction) < 0.0;
+		const Hittable& first = right_first ? *right : *left;
+		const Hittable& second = right_first ? *left : *right;
+
+		return first.Occluded(ray, t_max) || second.Occluded(ray, t_max);
+	}
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override
+	{
+		if (!closed) return Hittable::HitInterval(ray, ray_t, spans);
+
+		/* Every child the ray reaches contributes its spans, so ray_t is not shrunk */
+		if (!bounding_box.Hit(ray, ray_t)) return false;
+
+		bool hit_left = left->HitInterval(ray, ray_t, spans);
+		if (!right) return hit_left;
+
+		bool hit_right = right->HitInterval(ray, ray_t, spans);
+		return hit_left || hit_right;
+	}
+
+	/* True if all primitives in this subtree are closed */
+	bool IsClosed() const override { return closed; }
+
+	void SetTransform(const Transform& t_transform) override { WorldSpaceTransform("BVH_Node"); }
+
+	/* Returns the expected cost of a ray query against this subtree as estimated by the surface area heuristic */
+	double SAH_Cost() const { return sah_cost; }
+
+	/* Refit the tree (see BVH_BuildParams::refit_rebuild_threshold). Only trees built from a list can be rebuilt.
+	Note: refit leaves of SBVH builds bound their whole primitives rather than the clipped references. */
+	bool Refit(const BVH_BuildParams& params = BVH_BuildParams())
+	{
+		RefitNode(BVH_RefitThreadDepth(primitives.size(), params), params);
+
+		if (primitives.empty() || params.refit_rebuild_threshold <= 0.0) return false;
+		if (sah_cost <= params.refit_rebuild_threshold * built_sah_cost) return false;
+
+		InitFromTree(primitives, BuildHittableTree(primitives, params), 0, params);
+		built_sah_cost = sah_cost;
+		return true;
+	}
+
 private:
 	std::shared_ptr<Hittable> left;
-	std::shared_ptr<Hittable> right;
+	std::shared_ptr<Hittable> right; /* Null for leaves with a single child */
 	//AABB bounding_box; /* this is now a protected member of Hittable! */
+	double sah_cost = 0.0;
+
+	bool is_leaf = true; /* Interior nodes have two BVH_Node children */
+	bool leaf_list = false; /* Leaves with more than two primitives hold them in a HittableList (left) */
+	bool closed = false; /* See IsClosed */
+
+	/* Only set for roots built from a list */
+	std::vector<std::shared_ptr<Hittable>> primitives;
+	double built_sah_cost = 0.0;
 
 private:
+	/* Create this node (and its subtree) from node `node_index` of a build tree over `objects` */
+	void InitFromTree(const std::vector<std::shared_ptr<Hittable>>& objects, const BVH_BuildTree& tree, unsigned int node_index, const BVH_BuildParams& params)
+	{
+		const BVH_BuildNode& node = tree.nodes[node_index];
+		bounding_box = node.bounds;
+		right.reset();
+		is_leaf = node.IsLeaf();
+		leaf_list = false;
+
+		if (node.IsLeaf())
+		{
+			auto object = [&](unsigned int i) { return objects[tree.prim_indices[node.first_prim + i]]; };
+
+			if (node.prim_count == 1)
+			{
+				left = object(0);
+			}
+			else if (node.prim_count == 2)
+			{
+				left = object(0);
+				right = object(1);
+			}
+			else
+			{
+				auto leaf = MakeShared<HittableList>();
+				for (unsigned int i = 0; i < node.prim_count; i++) leaf->Add(object(i));
+				left = leaf;
+				leaf_list = true;
+			}
+			sah_cost = LeafCost(params);
+			UpdateClosed();
+			return;
+		}
+
+		auto left_node = MakeShared<BVH_Node>(objects, tree, node.left, params);
+		auto right_node = MakeShared<BVH_Node>(objects, tree, node.right, params);
+		sah_cost = params.traversal_cost + (left_node->BoundingBox().SurfaceArea() * left_node->SAH_Cost()
+				 + right_node->BoundingBox().SurfaceArea() * right_node->SAH_Cost()) / bounding_box.SurfaceArea();
+		left = left_node;
+		right = right_node;
+		UpdateClosed();
+	}
+
+	/* Cache whether the children are closed, after they were set */
+	void UpdateClosed()
+	{
+		closed = left->IsClosed() && (!right || right->IsClosed());
+	}
+
+	/* Refit this subtree. The subtrees `thread_depth` levels further down are refit on separate threads */
+	void RefitNode(int thread_depth, const BVH_BuildParams& params)
+	{
+		if (is_leaf)
+		{
+			if (leaf_list) static_cast<HittableList*>(left.get())->UpdateBoundingBox();
+			bounding_box = right ? AABB(left->BoundingBox(), right->BoundingBox()) : left->BoundingBox();
+			sah_cost = LeafCost(params);
+			return;
+		}
+
+		auto left_node = static_cast<BVH_Node*>(left.get());
+		auto right_node = static_cast<BVH_Node*>(right.get());
+		if (thread_depth > 0)
+		{
+			std::thread worker([&]() { left_node->RefitNode(thread_depth - 1, params); });
+			right_node->RefitNode(thread_depth - 1, params);
+			worker.join();
+		}
+		else
+		{
+			left_node->RefitNode(0, params);
+			right_node->RefitNode(0, params);
+		}
+
+		bounding_box = AABB(left_node->bounding_box, right_node->bounding_box);
+		sah_cost = params.traversal_cost + (left_node->bounding_box.SurfaceArea() * left_node->sah_cost
+				 + right_node->bounding_box.SurfaceArea() * right_node->sah_cost) / bounding_box.SurfaceArea();
+	}
+
+	/* Returns the SAH cost of a leaf from the current bounds of its primitives */
+	double LeafCost(const BVH_BuildParams& params) const
+	{
+		if (leaf_list)
+		{
+			double cost = 0.0;
+			for (const auto& object : static_cast<const HittableList*>(left.get())->objects) cost += ChildCost(object, params);
+			return cost;
+		}
+
+		if (!right) return ChildCost(left, params);
+
+		return params.traversal_cost + (left->BoundingBox().SurfaceArea() * ChildCost(left, params)
+			 + right->BoundingBox().SurfaceArea() * ChildCost(right, params)) / bounding_box.SurfaceArea();
+	}
+
+	/* Returns the SAH cost of a child, descending into nested BVHs (e.g., meshes) */
+	static double ChildCost(const std::shared_ptr<Hittable>& child, const BVH_BuildParams& params)
+	{
+		if (auto node = dynamic_cast<const BVH_Node*>(child.get())) return node->SAH_Cost();
+		if (auto linear = dynamic_cast<const LinearBVH*>(child.get())) return linear->SAH_Cost();
+		if (auto wide4 = dynamic_cast<const BVH4*>(child.get())) return wide4->SAH_Cost();
+		if (auto wide8 = dynamic_cast<const BVH8*>(child.get())) return wide8->SAH_Cost();
+		return params.intersection_cost;
+	}
+
+	/* Sort the objects in [start, end) along the longest axis of their combined bounding box */
+	void SortAlongLongestAxis(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) const
+	{
+		int axis = bounding_box.LongestAxis();
+		auto comparator = (axis == 0) ? BoxXCompare : ((axis == 1) ? BoxYCompare : BoxZCompare);
+		std::sort(objects.begin() + start, objects.begin() + end, comparator);
+	}
+
 	static bool BoxCompare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis_index)
 	{
 		Interval a_axis_interval = a->BoundingBox().AxisInterval(axis_index);
@@ -99,4 +362,26 @@ private:
 	}
 };
 
+
+
+/* Build a BVH over the objects of the provided list using the layout selected in params */
+inline std::shared_ptr<Hittable> BuildBVH(const HittableList& list, const BVH_BuildParams& params = BVH_BuildParams())
+{
+	if (params.layout == LayoutLinear) return MakeShared<LinearBVH>(list, params);
+	if (params.layout == LayoutWide4) return MakeShared<BVH4>(list, params);
+	if (params.layout == LayoutWide8) return MakeShared<BVH8>(list, params);
+	return MakeShared<BVH_Node>(list, params);
+}
+
+
+/* Returns the SAH cost of a BVH created by BuildBVH (0 for other hittables) */
+inline double BVH_SAH_Cost(const Hittable& bvh)
+{
+	if (auto node = dynamic_cast<const BVH_Node*>(&bvh)) return node->SAH_Cost();
+	if (auto linear = dynamic_cast<const LinearBVH*>(&bvh)) return linear->SAH_Cost();
+	if (auto wide4 = dynamic_cast<const BVH4*>(&bvh)) return wide4->SAH_Cost();
+	if (auto wide8 = dynamic_cast<const BVH8*>(&bvh)) return wide8->SAH_Cost();
+	return 0.0;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,1506 @@
+#include "bvh_builder.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace rt
+{
+/* ====================== */
+/* ====== SAH Bins ====== */
+/* ====================== */
+
+void SAH_Bins::Merge(const SAH_Bins& other)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int b = 0; b < bin_count; b++)
+		{
+			bounds[axis][b] = AABB(bounds[axis][b], other.bounds[axis][b]);
+			counts[axis][b] += other.counts[axis][b];
+		}
+	}
+}
+
+
+SAH_Split SAH_Bins::FindSplit(const AABB& range_bounds, const AABB& centroid_bounds, const BVH_BuildParams& params) const
+{
+	SAH_Split best;
+
+	double inv_area = 1.0 / range_bounds.SurfaceArea();
+	if (!std::isfinite(inv_area)) return best;
+
+	std::vector<double> right_area(bin_count);
+	std::vector<size_t> right_count(bin_count);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		/* All centroids coincide along this axis so there is nothing to split */
+		if (centroid_bounds.AxisInterval(axis).Size() <= 0.0) continue;
+
+		/* Sweep from the right to accumulate the area and count of everything right of each plane */
+		AABB accum;
+		size_t count = 0;
+		for (int b = bin_count - 1; b > 0; b--)
+		{
+			accum = AABB(accum, bounds[axis][b]);
+			count += counts[axis][b];
+			right_area[b - 1] = accum.SurfaceArea();
+			right_count[b - 1] = count;
+		}
+
+		/* Sweep from the left and evaluate the cost of splitting after each bin */
+		accum = AABB();
+		count = 0;
+		for (int b = 0; b < bin_count - 1; b++)
+		{
+			accum = AABB(accum, bounds[axis][b]);
+			count += counts[axis][b];
+			if (count == 0 || right_count[b] == 0) continue;
+
+			double cost = params.traversal_cost + params.intersection_cost * inv_area
+						* (accum.SurfaceArea() * (double)count + right_area[b] * (double)right_count[b]);
+
+			if (cost < best.cost)
+			{
+				best.axis = axis;
+				best.bin = b;
+				best.cost = cost;
+			}
+		}
+	}
+
+	return best;
+}
+
+
+/* ======================== */
+/* ====== Build Tree ====== */
+/* ======================== */
+
+double BVH_BuildTree::SAH_Cost(const BVH_BuildParams& params) const
+{
+	if (nodes.empty()) return 0.0;
+
+	/* Children are always created after their parents, so a reverse sweep visits children first */
+	std::vector<double> cost(nodes.size());
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		const BVH_BuildNode& node = nodes[i];
+		if (node.IsLeaf())
+		{
+			cost[i] = SAH_LeafCost(node.prim_count, params);
+			continue;
+		}
+
+		double area = node.bounds.SurfaceArea();
+		cost[i] = params.traversal_cost + (nodes[node.left].bounds.SurfaceArea() * cost[node.left]
+				+ nodes[node.right].bounds.SurfaceArea() * cost[node.right]) / area;
+	}
+
+	return cost[0];
+}
+
+
+/* =========================== */
+/* ====== BVH Task Pool ====== */
+/* =========================== */
+
+/* The worker threads of a build. Tasks are run by the workers and by threads that wait for tasks (see Wait), so a
+task can queue further tasks and wait for them without tying up a thread. The number of threads is fixed, however
+many tasks are queued. */
+class BVH_TaskPool
+{
+public:
+	/* Start thread_count - 1 workers (the thread that waits for the tasks is the last one) */
+	explicit BVH_TaskPool(int thread_count)
+	{
+		for (int i = 1; i < thread_count; i++) workers.emplace_back([this]() { WorkerLoop(); });
+	}
+
+	~BVH_TaskPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers) worker.join();
+	}
+
+	BVH_TaskPool(const BVH_TaskPool&) = delete;
+	BVH_TaskPool& operator=(const BVH_TaskPool&) = delete;
+
+	int ThreadCount() const { return (int)workers.size() + 1; }
+
+	/* Queue a task. `pending` is incremented now and decremented once the task is done */
+	void Submit(std::function<void()> fn, std::atomic<int>& pending)
+	{
+		pending++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back({ std::move(fn), &pending });
+		}
+		condition.notify_one();
+	}
+
+	/* Run queued tasks until `pending` is 0 */
+	void Wait(std::atomic<int>& pending)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (pending > 0)
+		{
+			if (tasks.empty())
+			{
+				condition.wait(lock);
+				continue;
+			}
+
+			Task task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			Run(task);
+			lock.lock();
+		}
+	}
+
+private:
+	class Task
+	{
+	public:
+		std::function<void()> fn;
+		std::atomic<int>* pending;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex; /* Guards tasks and stop */
+	std::condition_variable condition; /* Signaled when a task is queued, a waited for count reaches 0 or the workers are stopped */
+	std::deque<Task> tasks;
+	bool stop = false;
+
+private:
+	void WorkerLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			condition.wait(lock, [this]() { return stop || !tasks.empty(); });
+			if (tasks.empty()) return;
+
+			Task task = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			Run(task);
+			lock.lock();
+		}
+	}
+
+	void Run(Task& task)
+	{
+		task.fn();
+		if (--*task.pending > 0) return;
+
+		/* Taking the mutex orders this with a waiter checking the count before it sleeps, so the wake up is not lost */
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+		condition.notify_all();
+	}
+};
+
+
+/* ========================= */
+/* ====== BVH Builder ====== */
+/* ========================= */
+
+BVH_BuildTree BVH_Builder::Build(std::vector<BVH_BuildPrimitive> primitives)
+{
+	prims = std::move(primitives);
+	tree = BVH_BuildTree();
+
+	if (prims.empty()) return tree;
+
+	/* Small builds run on the calling thread only */
+	int thread_count = params.thread_count > 0 ? params.thread_count : (int)std::thread::hardware_concurrency();
+	BVH_TaskPool task_pool(prims.size() >= params.parallel_threshold ? std::max(thread_count, 1) : 1);
+	pool = &task_pool;
+	if (prims.size() >= params.parallel_threshold) scratch.resize(prims.size());
+
+	/* The treelet restructuring pass starts from single primitive leaves and collapses subtrees into leaves where that is cheaper */
+	size_t max_leaf_size = params.max_leaf_size;
+	if (params.treelet_leaf_count > 2) params.max_leaf_size = 1;
+
+	if (params.split_method == SplitMorton)
+	{
+		BuildMorton();
+	}
+	else if (params.split_method == SplitSBVH)
+	{
+		BuildSpatial();
+	}
+	else
+	{
+		/* A binary tree with at least one primitive per leaf has at most 2n - 1 nodes. Deterministic builds
+		give every range a fixed block of that size so node indices do not depend on the task order. */
+		tree.nodes.resize(2 * prims.size() - 1);
+		next_node = 1;
+		BuildRange(0, prims.size(), 0, 0);
+
+		if (params.deterministic) CompactNodes();
+		else tree.nodes.resize(next_node);
+	}
+
+	if (params.treelet_leaf_count > 2)
+	{
+		params.max_leaf_size = max_leaf_size;
+		OptimizeTreelets();
+	}
+
+	/* The leaves reference the primitives in their final (partitioned) order */
+	tree.prim_indices.resize(prims.size());
+	for (size_t i = 0; i < prims.size(); i++) tree.prim_indices[i] = prims[i].index;
+
+	prims.clear();
+	scratch.clear();
+	pool = nullptr;
+	return std::move(tree);
+}
+
+
+void BVH_Builder::BuildRange(size_t start, size_t end, int depth, unsigned int node_index)
+{
+	/* Bounds of the primitives and of their centroids */
+	AABB bounds, centroid_bounds;
+	ComputeBounds(start, end, bounds, centroid_bounds);
+
+	int axis = 0;
+	size_t mid = SplitRange(start, end, depth, bounds, centroid_bounds, axis);
+
+	BVH_BuildNode& node = tree.nodes[node_index];
+	node.bounds = bounds;
+
+	if (mid == start)
+	{
+		node.first_prim = (unsigned int)start;
+		node.prim_count = (unsigned int)(end - start);
+		return;
+	}
+
+	unsigned int left, right;
+	if (params.deterministic)
+	{
+		/* The left subtree uses at most 2 * (mid - start) - 1 nodes directly after this one */
+		left = node_index + 1;
+		right = node_index + 2 * (unsigned int)(mid - start);
+	}
+	else
+	{
+		left = next_node.fetch_add(2);
+		right = left + 1;
+	}
+
+	node.left = left;
+	node.right = right;
+	node.axis = axis;
+
+	/* Queue the left subtree as a task if the range is large, so that an idle thread can build it */
+	if (end - start >= params.parallel_threshold && pool->ThreadCount() > 1)
+	{
+		std::atomic<int> pending = 0;
+		pool->Submit([this, start, mid, depth, left]() { BuildRange(start, mid, depth + 1, left); }, pending);
+		BuildRange(mid, end, depth + 1, right);
+		pool->Wait(pending);
+		return;
+	}
+
+	BuildRange(start, mid, depth + 1, left);
+	BuildRange(mid, end, depth + 1, right);
+}
+
+
+void BVH_Builder::ComputeBounds(size_t start, size_t end, AABB& bounds, AABB& centroid_bounds)
+{
+	auto accumulate = [this](size_t first, size_t last, AABB& b, AABB& cb) {
+		for (size_t i = first; i < last; i++)
+		{
+			b = AABB(b, prims[i].bounds);
+			cb = AABB(cb, AABB(prims[i].centroid, prims[i].centroid));
+		}
+	};
+
+	size_t count = end - start;
+	if (count < params.parallel_threshold)
+	{
+		accumulate(start, end, bounds, centroid_bounds);
+		return;
+	}
+
+	size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+	std::vector<AABB> chunk_bounds(chunk_count), chunk_centroid_bounds(chunk_count);
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t first = start + c * chunk_size;
+		accumulate(first, std::min(first + chunk_size, end), chunk_bounds[c], chunk_centroid_bounds[c]);
+		});
+
+	for (size_t c = 0; c < chunk_count; c++)
+	{
+		bounds = AABB(bounds, chunk_bounds[c]);
+		centroid_bounds = AABB(centroid_bounds, chunk_centroid_bounds[c]);
+	}
+}
+
+
+size_t BVH_Builder::SplitRange(size_t start, size_t end, int depth, const AABB& bounds, const AABB& centroid_bounds, int& axis)
+{
+	size_t count = end - start;
+	if (count <= 1) return start;
+
+	axis = centroid_bounds.LongestAxis();
+
+	if (params.split_method == SplitSAH && depth < max_sah_depth)
+	{
+		SAH_Bins bins(params.BinCount());
+		if (count < params.parallel_threshold)
+		{
+			for (size_t i = start; i < end; i++) bins.Add(prims[i].bounds, prims[i].centroid, centroid_bounds);
+		}
+		else
+		{
+			/* Bin the chunks in parallel and merge them in order */
+			size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+			std::vector<SAH_Bins> chunk_bins(chunk_count, bins);
+			ParallelFor(chunk_count, [&](size_t c) {
+				size_t first = start + c * chunk_size;
+				size_t last = std::min(first + chunk_size, end);
+				for (size_t i = first; i < last; i++) chunk_bins[c].Add(prims[i].bounds, prims[i].centroid, centroid_bounds);
+				});
+			for (const auto& b : chunk_bins) bins.Merge(b);
+		}
+		SAH_Split split = bins.FindSplit(bounds, centroid_bounds, params);
+
+		/* Small ranges that are cheaper to intersect directly than to split become leaves */
+		if (count <= params.max_leaf_size && SAH_LeafCost(count, params) <= split.cost) return start;
+
+		if (split.axis >= 0)
+		{
+			size_t mid = PartitionRange(start, end, [&](const BVH_BuildPrimitive& prim) {
+				return SAH_BinIndex(prim.centroid, centroid_bounds, split.axis, params.BinCount()) <= split.bin;
+				});
+			if (mid != start && mid != end)
+			{
+				axis = split.axis;
+				return mid;
+			}
+		}
+	}
+	else if (count <= params.max_leaf_size)
+	{
+		return start;
+	}
+
+	/* Median split along the longest centroid axis */
+	size_t mid = start + count / 2;
+	std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end, [axis](const BVH_BuildPrimitive& a, const BVH_BuildPrimitive& b) {
+		return a.centroid[axis] < b.centroid[axis];
+		});
+	return mid;
+}
+
+
+template <typename Predicate>
+size_t BVH_Builder::PartitionRange(size_t start, size_t end, Predicate predicate)
+{
+	size_t count = end - start;
+	if (count < params.parallel_threshold)
+	{
+		return std::partition(prims.begin() + start, prims.begin() + end, predicate) - prims.begin();
+	}
+
+	/* Stable partition in three parallel passes: count per chunk, scatter into the scratch buffer, copy back */
+	size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+	std::vector<size_t> left_counts(chunk_count);
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t first = start + c * chunk_size;
+		size_t last = std::min(first + chunk_size, end);
+		left_counts[c] = std::count_if(prims.begin() + first, prims.begin() + last, predicate);
+		});
+
+	/* Exclusive prefix sums give each chunk its output position on both sides */
+	std::vector<size_t> left_offsets(chunk_count);
+	size_t total_left = 0;
+	for (size_t c = 0; c < chunk_count; c++)
+	{
+		left_offsets[c] = total_left;
+		total_left += left_counts[c];
+	}
+
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t first = start + c * chunk_size;
+		size_t last = std::min(first + chunk_size, end);
+		size_t l = start + left_offsets[c];
+		size_t r = start + total_left + (c * chunk_size - left_offsets[c]);
+		for (size_t i = first; i < last; i++)
+		{
+			if (predicate(prims[i])) scratch[l++] = prims[i];
+			else scratch[r++] = prims[i];
+		}
+		});
+
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t first = start + c * chunk_size;
+		size_t last = std::min(first + chunk_size, end);
+		std::copy(scratch.begin() + first, scratch.begin() + last, prims.begin() + first);
+		});
+
+	return start + total_left;
+}
+
+
+template <typename Fn>
+void BVH_Builder::ParallelFor(size_t count, Fn fn)
+{
+	if (count == 0) return;
+
+	std::atomic<size_t> next = 0;
+	auto work = [&]() {
+		for (size_t i = next++; i < count; i = next++) fn(i);
+	};
+
+	/* Helpers that only start once all indices are taken return right away */
+	std::atomic<int> pending = 0;
+	size_t helpers = std::min(count, (size_t)pool->ThreadCount()) - 1;
+	for (size_t t = 0; t < helpers; t++) pool->Submit(work, pending);
+	work();
+	pool->Wait(pending);
+}
+
+
+void BVH_Builder::CompactNodes()
+{
+	/* Depth first (pre-order) renumbering, the same order a serial recursive build creates */
+	std::vector<BVH_BuildNode> compact;
+	compact.reserve(tree.nodes.size());
+
+	std::vector<std::pair<unsigned int, unsigned int>> stack; /* (old node index, parent's new index or UINT_MAX) */
+	stack.push_back({ 0, UINT_MAX });
+	while (!stack.empty())
+	{
+		auto [old_index, parent] = stack.back();
+		stack.pop_back();
+
+		unsigned int new_index = (unsigned int)compact.size();
+		compact.push_back(tree.nodes[old_index]);
+
+		/* The left child always directly follows its parent, so only the right child needs patching */
+		if (parent != UINT_MAX) compact[parent].right = new_index;
+
+		const BVH_BuildNode& node = tree.nodes[old_index];
+		if (node.IsLeaf()) continue;
+
+		stack.push_back({ node.right, new_index });
+		stack.push_back({ node.left, UINT_MAX });
+		compact[new_index].left = new_index + 1;
+	}
+
+	tree.nodes = std::move(compact);
+}
+
+
+/* ============================ */
+/* ====== Morton Builder ====== */
+/* ============================ */
+
+/* Spread the lower 21 bits of v so that there are two zero bits between each of them */
+static std::uint64_t ExpandBits(std::uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8) & 0x100f00f00f00f00f;
+	v = (v | v << 4) & 0x10c30c30c30c30c3;
+	v = (v | v << 2) & 0x1249249249249249;
+	return v;
+}
+
+
+/* Returns the 63 bit Morton code of a point quantized to 21 bits per axis within the provided bounds */
+static std::uint64_t MortonCode(const Point3& p, const AABB& bounds)
+{
+	const double scale = (double)((1 << 21) - 1);
+
+	std::uint64_t code = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& ax = bounds.AxisInterval(axis);
+		double t = std::clamp((double)((p[axis] - ax.min) / ax.Size()), 0.0, 1.0);
+		code |= ExpandBits((std::uint64_t)(t * scale)) << (2 - axis);
+	}
+	return code;
+}
+
+
+/* Binary radix tree over sorted Morton codes. Internal node i splits between the sorted primitives i and i + 1 */
+class MortonTree
+{
+public:
+	std::vector<std::uint32_t> left, right; /* Child references, single primitive leaves are tagged with leaf_flag */
+	std::vector<std::uint32_t> first, last; /* Range of sorted primitives below each internal node */
+	std::vector<int> axis;
+	std::uint32_t root = leaf_flag;
+
+	static const std::uint32_t leaf_flag = 0x80000000u;
+
+public:
+	MortonTree(const std::vector<std::uint64_t>& codes)
+	{
+		size_t n = codes.size();
+		if (n < 2) return;
+
+		/* Length of the common prefix of adjacent (code, index) keys. Duplicate codes are told apart by their index */
+		auto delta = [&](size_t i) {
+			std::uint64_t x = codes[i] ^ codes[i + 1];
+			if (x) return std::countl_zero(x);
+			return 64 + std::countl_zero((std::uint32_t)(i ^ (i + 1)));
+		};
+
+		size_t internal_count = n - 1;
+		std::vector<int> prefix(internal_count);
+		left.resize(internal_count);
+		right.resize(internal_count);
+		first.resize(internal_count);
+		last.resize(internal_count);
+		axis.resize(internal_count);
+
+		for (size_t i = 0; i < internal_count; i++)
+		{
+			prefix[i] = delta(i);
+
+			/* The highest differing bit determines the split axis (x, y, z are interleaved from the top) */
+			axis[i] = prefix[i] < 64 ? 2 - (63 - prefix[i]) % 3 : 0;
+		}
+
+		/* The radix tree is the Cartesian tree of the prefix lengths: each internal node's parent is the
+		nearest neighbour with a shorter common prefix. A single stack pass builds it in O(n). */
+		std::vector<std::uint32_t> stack;
+		for (std::uint32_t i = 0; i < (std::uint32_t)internal_count; i++)
+		{
+			left[i] = i | leaf_flag;
+			right[i] = (i + 1) | leaf_flag;
+
+			std::uint32_t popped = UINT32_MAX;
+			while (!stack.empty() && prefix[stack.back()] > prefix[i])
+			{
+				popped = stack.back();
+				last[popped] = i;
+				stack.pop_back();
+			}
+
+			if (popped != UINT32_MAX) left[i] = popped;
+			if (!stack.empty()) right[stack.back()] = i;
+			first[i] = stack.empty() ? 0 : stack.back() + 1;
+			stack.push_back(i);
+		}
+
+		for (std::uint32_t i : stack) last[i] = (std::uint32_t)(n - 1);
+		root = stack.front();
+	}
+
+	bool IsLeaf(std::uint32_t ref) const { return (ref & leaf_flag) != 0; }
+	std::uint32_t First(std::uint32_t ref) const { return IsLeaf(ref) ? (ref & ~leaf_flag) : first[ref]; }
+	std::uint32_t Last(std::uint32_t ref) const { return IsLeaf(ref) ? (ref & ~leaf_flag) : last[ref]; }
+};
+
+
+/* Emits (parts of) a Morton tree into a build tree in depth first order */
+class MortonEmitter
+{
+public:
+	MortonEmitter(const MortonTree& morton, const std::vector<BVH_BuildPrimitive>& sorted, BVH_BuildTree& tree, size_t max_leaf_size)
+		: morton(morton), sorted(sorted), tree(tree), max_leaf_size(std::max(max_leaf_size, (size_t)1))
+	{
+		output.reserve(sorted.size());
+	}
+
+	/* Emit the Morton subtree `ref` and return its node index */
+	unsigned int EmitMorton(std::uint32_t ref, int depth)
+	{
+		std::uint32_t first = morton.First(ref);
+		std::uint32_t last = morton.Last(ref);
+		size_t count = last - first + 1;
+
+		/* Near the depth limit, split the range evenly instead of following the (possibly deep) Morton tree,
+		so that no leaf is forced to hold more than max_leaf_size primitives */
+		if (count > max_leaf_size && depth + BalancedDepth(count) + 1 >= BVH_Builder::max_depth - 1)
+		{
+			return EmitBalanced(first, last, depth);
+		}
+
+		unsigned int node_index = (unsigned int)tree.nodes.size();
+		tree.nodes.emplace_back();
+
+		if (morton.IsLeaf(ref) || count <= max_leaf_size)
+		{
+			EmitLeaf(node_index, first, last);
+			return node_index;
+		}
+
+		/* Note: recursing may reallocate the node array, so only write to our node afterwards */
+		unsigned int left = EmitMorton(morton.left[ref], depth + 1);
+		unsigned int right = EmitMorton(morton.right[ref], depth + 1);
+
+		BVH_BuildNode& node = tree.nodes[node_index];
+		node.bounds = AABB(tree.nodes[left].bounds, tree.nodes[right].bounds);
+		node.left = left;
+		node.right = right;
+		node.axis = morton.axis[ref];
+		return node_index;
+	}
+
+	/* Emit node `top_index` of a tree built over Morton treelets, whose leaves hold one treelet each */
+	unsigned int EmitTop(const BVH_BuildTree& top, const std::vector<std::uint32_t>& treelets, unsigned int top_index, int depth)
+	{
+		const BVH_BuildNode& top_node = top.nodes[top_index];
+		if (top_node.IsLeaf()) return EmitMorton(treelets[top.prim_indices[top_node.first_prim]], depth);
+
+		unsigned int node_index = (unsigned int)tree.nodes.size();
+		tree.nodes.emplace_back();
+
+		unsigned int left = EmitTop(top, treelets, top_node.left, depth + 1);
+		unsigned int right = EmitTop(top, treelets, top_node.right, depth + 1);
+
+		BVH_BuildNode& node = tree.nodes[node_index];
+		node.bounds = AABB(tree.nodes[left].bounds, tree.nodes[right].bounds);
+		node.left = left;
+		node.right = right;
+		node.axis = top_node.axis;
+		return node_index;
+	}
+
+	/* Emit the sorted primitives [first, last] as a subtree of halved ranges and return its node index */
+	unsigned int EmitBalanced(std::uint32_t first, std::uint32_t last, int depth)
+	{
+		unsigned int node_index = (unsigned int)tree.nodes.size();
+		tree.nodes.emplace_back();
+
+		/* Note: leaves only exceed max_leaf_size if the tree above already reached the depth limit */
+		if (last - first + 1 <= max_leaf_size || depth >= BVH_Builder::max_depth - 1)
+		{
+			EmitLeaf(node_index, first, last);
+			return node_index;
+		}
+
+		std::uint32_t mid = first + (last - first + 1) / 2;
+		unsigned int left = EmitBalanced(first, mid - 1, depth + 1);
+		unsigned int right = EmitBalanced(mid, last, depth + 1);
+
+		BVH_BuildNode& node = tree.nodes[node_index];
+		node.bounds = AABB(tree.nodes[left].bounds, tree.nodes[right].bounds);
+		node.left = left;
+		node.right = right;
+		node.axis = node.bounds.LongestAxis();
+		return node_index;
+	}
+
+public:
+	std::vector<BVH_BuildPrimitive> output; /* Primitives in the order the leaves reference them */
+
+private:
+	/* Make node `node_index` a leaf over the sorted primitives [first, last] */
+	void EmitLeaf(unsigned int node_index, std::uint32_t first, std::uint32_t last)
+	{
+		BVH_BuildNode& leaf = tree.nodes[node_index];
+		leaf.first_prim = (unsigned int)output.size();
+		leaf.prim_count = last - first + 1;
+		for (std::uint32_t i = first; i <= last; i++)
+		{
+			leaf.bounds = AABB(leaf.bounds, sorted[i].bounds);
+			output.push_back(sorted[i]);
+		}
+	}
+
+	/* Number of levels of halving until a range of `count` primitives fits in leaves */
+	int BalancedDepth(size_t count) const
+	{
+		int levels = 0;
+		for (; count > max_leaf_size; count = (count + 1) / 2) levels++;
+		return levels;
+	}
+
+private:
+	const MortonTree& morton;
+	const std::vector<BVH_BuildPrimitive>& sorted;
+	BVH_BuildTree& tree;
+	size_t max_leaf_size;
+};
+
+
+void BVH_Builder::BuildMorton()
+{
+	size_t n = prims.size();
+	size_t chunk_count = (n + chunk_size - 1) / chunk_size;
+
+	AABB bounds, centroid_bounds;
+	ComputeBounds(0, n, bounds, centroid_bounds);
+
+	/* Morton codes of the centroids, sorted together with the primitive positions */
+	std::vector<std::uint64_t> codes(n);
+	std::vector<unsigned int> order(n);
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t last = std::min((c + 1) * chunk_size, n);
+		for (size_t i = c * chunk_size; i < last; i++)
+		{
+			codes[i] = MortonCode(prims[i].centroid, centroid_bounds);
+			order[i] = (unsigned int)i;
+		}
+		});
+	RadixSort(codes, order);
+
+	scratch.resize(n);
+	ParallelFor(chunk_count, [&](size_t c) {
+		size_t last = std::min((c + 1) * chunk_size, n);
+		for (size_t i = c * chunk_size; i < last; i++) scratch[i] = prims[order[i]];
+		});
+
+	MortonTree morton(codes);
+	tree.nodes.reserve(2 * n);
+	MortonEmitter emitter(morton, scratch, tree, params.max_leaf_size);
+
+	size_t treelet_size = params.morton_sah_treelet_size;
+	if (treelet_size == 0 || n <= treelet_size)
+	{
+		emitter.EmitMorton(morton.root, 0);
+	}
+	else
+	{
+		/* Cut the Morton tree into treelets with at most `treelet_size` primitives... */
+		std::vector<std::uint32_t> treelets;
+		std::vector<std::uint32_t> stack = { morton.root };
+		while (!stack.empty())
+		{
+			std::uint32_t ref = stack.back();
+			stack.pop_back();
+
+			if (morton.IsLeaf(ref) || morton.Last(ref) - morton.First(ref) + 1 <= treelet_size)
+			{
+				treelets.push_back(ref);
+				continue;
+			}
+			stack.push_back(morton.right[ref]);
+			stack.push_back(morton.left[ref]);
+		}
+
+		/* ...and rebuild the hierarchy above them with the binned SAH, one treelet per leaf */
+		std::vector<BVH_BuildPrimitive> treelet_prims(treelets.size());
+		for (size_t t = 0; t < treelets.size(); t++)
+		{
+			AABB treelet_bounds;
+			for (std::uint32_t i = morton.First(treelets[t]); i <= morton.Last(treelets[t]); i++)
+			{
+				treelet_bounds = AABB(treelet_bounds, scratch[i].bounds);
+			}
+			treelet_prims[t] = BVH_BuildPrimitive(treelet_bounds, (unsigned int)t);
+		}
+
+		BVH_BuildParams top_params = params;
+		top_params.split_method = SplitSAH;
+		top_params.max_leaf_size = 1;
+		top_params.treelet_leaf_count = 0;
+		BVH_BuildTree top = BVH_Builder(top_params).Build(std::move(treelet_prims));
+
+		emitter.EmitTop(top, treelets, 0, 0);
+	}
+
+	prims = std::move(emitter.output);
+}
+
+
+void BVH_Builder::RadixSort(std::vector<std::uint64_t>& keys, std::vector<unsigned int>& values)
+{
+	/* Least significant digit first with 8 bit digits. Every pass is stable and uses fixed chunks,
+	so the result does not depend on the thread count */
+	size_t n = keys.size();
+	size_t chunk_count = (n + chunk_size - 1) / chunk_size;
+
+	std::vector<std::uint64_t> keys_out(n);
+	std::vector<unsigned int> values_out(n);
+	std::vector<size_t> offsets(chunk_count * 256);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		ParallelFor(chunk_count, [&](size_t c) {
+			size_t last = std::min((c + 1) * chunk_size, n);
+			for (size_t i = c * chunk_size; i < last; i++) offsets[c * 256 + ((keys[i] >> shift) & 255)]++;
+			});
+
+		/* Skip the pass if all keys share this digit */
+		size_t digit = (keys[0] >> shift) & 255;
+		size_t same = 0;
+		for (size_t c = 0; c < chunk_count; c++) same += offsets[c * 256 + digit];
+		if (same == n) continue;
+
+		/* Exclusive prefix sum in digit major, chunk minor order gives each chunk its output position per digit */
+		size_t sum = 0;
+		for (size_t d = 0; d < 256; d++)
+		{
+			for (size_t c = 0; c < chunk_count; c++)
+			{
+				size_t count = offsets[c * 256 + d];
+				offsets[c * 256 + d] = sum;
+				sum += count;
+			}
+		}
+
+		ParallelFor(chunk_count, [&](size_t c) {
+			size_t* chunk_offsets = &offsets[c * 256];
+			size_t last = std::min((c + 1) * chunk_size, n);
+			for (size_t i = c * chunk_size; i < last; i++)
+			{
+				size_t dst = chunk_offsets[(keys[i] >> shift) & 255]++;
+				keys_out[dst] = keys[i];
+				values_out[dst] = values[i];
+			}
+			});
+
+		keys.swap(keys_out);
+		values.swap(values_out);
+	}
+}
+
+
+/* ========================== */
+/* ====== SBVH Builder ====== */
+/* ========================== */
+
+void BVH_Builder::BuildSpatial()
+{
+	AABB bounds;
+	for (const auto& prim : prims) bounds = AABB(bounds, prim.bounds);
+	root_area = bounds.SurfaceArea();
+	size_t duplication_budget = (size_t)(params.sbvh_duplication_budget * (double)prims.size());
+
+	/* The number of references is not known up front, so nodes are appended in depth first order */
+	std::vector<BVH_BuildPrimitive> leaf_refs;
+	leaf_refs.reserve(prims.size() + duplication_budget);
+	tree.nodes.reserve(2 * (prims.size() + duplication_budget));
+	BuildSpatialNode(prims, 0, duplication_budget, leaf_refs);
+
+	prims = std::move(leaf_refs);
+}
+
+
+unsigned int BVH_Builder::BuildSpatialNode(std::vector<BVH_BuildPrimitive>& refs, int depth, size_t budget, std::vector<BVH_BuildPrimitive>& leaf_refs)
+{
+	unsigned int node_index = (unsigned int)tree.nodes.size();
+	tree.nodes.emplace_back();
+
+	AABB bounds, centroid_bounds;
+	for (const auto& ref : refs)
+	{
+		bounds = AABB(bounds, ref.bounds);
+		centroid_bounds = AABB(centroid_bounds, AABB(ref.centroid, ref.centroid));
+	}
+
+	size_t count = refs.size();
+	bool leaf = count <= 1;
+	int axis = centroid_bounds.LongestAxis();
+	std::vector<BVH_BuildPrimitive> left_refs, right_refs;
+
+	if (!leaf && depth < max_sah_depth)
+	{
+		/* Best object split (binned SAH over the reference centroids) */
+		SAH_Bins bins(params.BinCount());
+		for (const auto& ref : refs) bins.Add(ref.bounds, ref.centroid, centroid_bounds);
+		SAH_Split object_split = bins.FindSplit(bounds, centroid_bounds, params);
+
+		AABB left_bounds, right_bounds;
+		if (object_split.axis >= 0)
+		{
+			for (const auto& ref : refs)
+			{
+				if (SAH_BinIndex(ref.centroid, centroid_bounds, object_split.axis, params.BinCount()) <= object_split.bin)
+				{
+					left_refs.push_back(ref);
+					left_bounds = AABB(left_bounds, ref.bounds);
+				}
+				else
+				{
+					right_refs.push_back(ref);
+					right_bounds = AABB(right_bounds, ref.bounds);
+				}
+			}
+			axis = object_split.axis;
+		}
+
+		/* Spatial splits only pay off where the children of the object split overlap noticeably */
+		SAH_Split spatial_split;
+		size_t spatial_left = 0, spatial_right = 0;
+		double overlap = left_bounds.Intersection(right_bounds).SurfaceArea();
+		if (budget > 0 && (object_split.axis < 0 || overlap > params.sbvh_overlap_threshold * root_area))
+		{
+			spatial_split = FindSpatialSplit(refs, bounds, spatial_left, spatial_right);
+
+			/* Every split must make progress and stay within the duplication budget */
+			if (spatial_split.axis >= 0 && (spatial_left >= count || spatial_right >= count || spatial_left + spatial_right - count > budget))
+			{
+				spatial_split = SAH_Split();
+			}
+		}
+
+		double best_cost = std::min(object_split.cost, spatial_split.cost);
+		if (count <= params.max_leaf_size && SAH_LeafCost(count, params) <= best_cost)
+		{
+			leaf = true;
+		}
+		else if (spatial_split.axis >= 0 && spatial_split.cost < object_split.cost)
+		{
+			const Interval& ax = bounds.AxisInterval(spatial_split.axis);
+			double plane = ax.min + (double)(spatial_split.bin + 1) * (ax.Size() / params.BinCount());
+
+			std::vector<BVH_BuildPrimitive> spatial_left_refs, spatial_right_refs;
+			for (const auto& ref : refs)
+			{
+				const Interval& extent = ref.bounds.AxisInterval(spatial_split.axis);
+				if (extent.max <= plane)
+				{
+					spatial_left_refs.push_back(ref);
+				}
+				else if (extent.min >= plane)
+				{
+					spatial_right_refs.push_back(ref);
+				}
+				else
+				{
+					/* The reference straddles the plane: clip it to both sides */
+					AABB left_part, right_part;
+					SplitReference(ref, spatial_split.axis, plane, left_part, right_part);
+					if (!left_part.IsEmpty()) spatial_left_refs.push_back(BVH_BuildPrimitive(left_part, ref.index));
+					if (!right_part.IsEmpty()) spatial_right_refs.push_back(BVH_BuildPrimitive(right_part, ref.index));
+				}
+			}
+
+			/* The binned estimate may differ slightly from the actual partition, so check progress again */
+			if (spatial_left_refs.size() < count && spatial_right_refs.size() < count && !spatial_left_refs.empty() && !spatial_right_refs.empty())
+			{
+				size_t duplicated = spatial_left_refs.size() + spatial_right_refs.size() - std::min(count, spatial_left_refs.size() + spatial_right_refs.size());
+				budget -= std::min(duplicated, budget);
+				left_refs = std::move(spatial_left_refs);
+				right_refs = std::move(spatial_right_refs);
+				axis = spatial_split.axis;
+			}
+		}
+	}
+
+	/* Fall back to a median split if neither kind of split applies (or the SAH depth limit was reached) */
+	if (!leaf && (left_refs.empty() || right_refs.empty()))
+	{
+		if (count <= params.max_leaf_size)
+		{
+			leaf = true;
+		}
+		else
+		{
+			axis = centroid_bounds.LongestAxis();
+			size_t mid = count / 2;
+			std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), [axis](const BVH_BuildPrimitive& a, const BVH_BuildPrimitive& b) {
+				return a.centroid[axis] < b.centroid[axis];
+				});
+			left_refs.assign(refs.begin(), refs.begin() + mid);
+			right_refs.assign(refs.begin() + mid, refs.end());
+		}
+	}
+
+	tree.nodes[node_index].bounds = bounds;
+
+	if (leaf)
+	{
+		tree.nodes[node_index].first_prim = (unsigned int)leaf_refs.size();
+		tree.nodes[node_index].prim_count = (unsigned int)count;
+		leaf_refs.insert(leaf_refs.end(), refs.begin(), refs.end());
+		return node_index;
+	}
+
+	/* Release this level's references before descending */
+	std::vector<BVH_BuildPrimitive>().swap(refs);
+
+	/* The children share what is left of the duplication budget in proportion to their size */
+	size_t left_budget = (size_t)((double)budget * (double)left_refs.size() / (double)(left_refs.size() + right_refs.size()));
+	unsigned int left = BuildSpatialNode(left_refs, depth + 1, left_budget, leaf_refs);
+	unsigned int right = BuildSpatialNode(right_refs, depth + 1, budget - left_budget, leaf_refs);
+
+	/* Note: recursing may reallocate the node array so the node is indexed again here */
+	BVH_BuildNode& node = tree.nodes[node_index];
+	node.left = left;
+	node.right = right;
+	node.axis = axis;
+	return node_index;
+}
+
+
+SAH_Split BVH_Builder::FindSpatialSplit(const std::vector<BVH_BuildPrimitive>& refs, const AABB& bounds, size_t& left_count, size_t& right_count)
+{
+	SAH_Split best;
+
+	double inv_area = 1.0 / bounds.SurfaceArea();
+	if (!std::isfinite(inv_area)) return best;
+
+	int bin_count = params.BinCount();
+	std::vector<AABB> bin_bounds(bin_count);
+	std::vector<size_t> entries(bin_count), exits(bin_count);
+	std::vector<double> right_area(bin_count);
+	std::vector<size_t> right_refs(bin_count);
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& ax = bounds.AxisInterval(axis);
+		double width = ax.Size() / bin_count;
+		if (width <= 0.0) continue;
+
+		std::fill(bin_bounds.begin(), bin_bounds.end(), AABB());
+		std::fill(entries.begin(), entries.end(), 0);
+		std::fill(exits.begin(), exits.end(), 0);
+
+		auto bin_index = [&](double x) {
+			return std::clamp((int)((x - ax.min) / width), 0, bin_count - 1);
+		};
+
+		/* Chop each reference into the bins it overlaps. It enters the tree in its first bin and leaves it in the last */
+		for (const auto& ref : refs)
+		{
+			const Interval& extent = ref.bounds.AxisInterval(axis);
+			int first = bin_index(extent.min);
+			int last = bin_index(extent.max);
+
+			if (first == last)
+			{
+				bin_bounds[first] = AABB(bin_bounds[first], ref.bounds);
+			}
+			else
+			{
+				/* Split off one bin at a time, continuing with what is right of the bin boundary */
+				BVH_BuildPrimitive remainder = ref;
+				for (int b = first; b < last; b++)
+				{
+					AABB part;
+					SplitReference(remainder, axis, ax.min + (double)(b + 1) * width, part, remainder.bounds);
+					bin_bounds[b] = AABB(bin_bounds[b], part);
+				}
+				bin_bounds[last] = AABB(bin_bounds[last], remainder.bounds);
+			}
+
+			entries[first]++;
+			exits[last]++;
+		}
+
+		/* Sweep from the right: references that leave the tree right of a plane belong to the right child */
+		AABB accum;
+		size_t count = 0;
+		for (int b = bin_count - 1; b > 0; b--)
+		{
+			accum = AABB(accum, bin_bounds[b]);
+			count += exits[b];
+			right_area[b - 1] = accum.SurfaceArea();
+			right_refs[b - 1] = count;
+		}
+
+		/* Sweep from the left: references that enter the tree left of a plane belong to the left child */
+		accum = AABB();
+		count = 0;
+		for (int b = 0; b < bin_count - 1; b++)
+		{
+			accum = AABB(accum, bin_bounds[b]);
+			count += entries[b];
+			if (count == 0 || right_refs[b] == 0) continue;
+
+			double cost = params.traversal_cost + params.intersection_cost * inv_area
+						* (accum.SurfaceArea() * (double)count + right_area[b] * (double)right_refs[b]);
+
+			if (cost < best.cost)
+			{
+				best.axis = axis;
+				best.bin = b;
+				best.cost = cost;
+				left_count = count;
+				right_count = right_refs[b];
+			}
+		}
+	}
+
+	return best;
+}
+
+
+void BVH_Builder::SplitReference(const BVH_BuildPrimitive& ref, int axis, double position, AABB& left, AABB& right) const
+{
+	if (split) split(ref.index, ref.bounds, axis, position, left, right);
+	else ref.bounds.Split(axis, position, left, right);
+}
+
+
+/* =================================== */
+/* ====== Treelet Restructuring ====== */
+/* =================================== */
+
+/* Rearranges the treelets of a build tree with one primitive per leaf into the topology with the lowest SAH cost and
+marks the subtrees that are cheaper as a single leaf, following Karras and Aila, "Fast Parallel Construction of
+High-Quality Bounding Volume Hierarchies" (2013). Costs are tracked as surface area times SAH cost, so that the
+cost of an interior node is simply Ct * area + the costs of its children. */
+class TreeletOptimizer
+{
+public:
+	TreeletOptimizer(BVH_BuildTree& tree, const BVH_BuildParams& params)
+		: collapsed(tree.nodes.size(), 0), tree(tree), params(params), parents(tree.nodes.size(), UINT_MAX),
+		area_costs(tree.nodes.size()), prim_counts(tree.nodes.size()), visits(tree.nodes.size())
+	{
+		leaf_count = std::clamp(params.treelet_leaf_count, 3, BVH_Builder::max_treelet_leaf_count);
+
+		for (unsigned int i = 0; i < (unsigned int)tree.nodes.size(); i++)
+		{
+			const BVH_BuildNode& node = tree.nodes[i];
+			if (node.IsLeaf())
+			{
+				leaves.push_back(i);
+				area_costs[i] = node.bounds.SurfaceArea() * SAH_LeafCost(node.prim_count, params);
+				prim_counts[i] = node.prim_count;
+				collapsed[i] = 1;
+				continue;
+			}
+			parents[node.left] = i;
+			parents[node.right] = i;
+		}
+	}
+
+	/* Prepare a new bottom-up pass that only rearranges treelets below nodes with at least `min_prims` primitives */
+	void Reset(unsigned int min_prims)
+	{
+		for (auto& visit : visits) visit.store(0, std::memory_order_relaxed);
+		min_treelet_prims = min_prims;
+		changed = 0;
+	}
+
+	/* Walk from a leaf towards the root. The second thread to arrive at a node restructures it, so
+	both of its subtrees are final by then and treelets processed concurrently never overlap. */
+	void Climb(unsigned int leaf)
+	{
+		unsigned int index = parents[leaf];
+		while (index != UINT_MAX)
+		{
+			if (visits[index].fetch_add(1, std::memory_order_acq_rel) == 0) return;
+
+			Restructure(index);
+			index = parents[index];
+		}
+	}
+
+public:
+	std::vector<unsigned int> leaves;
+	std::vector<char> collapsed; /* Subtrees that become a single leaf */
+	std::atomic<size_t> changed = 0; /* Number of treelets rearranged in the current pass */
+
+private:
+	/* Replace the treelet rooted at node `root` with its cheapest topology (if that is cheaper) */
+	void Restructure(unsigned int root)
+	{
+		const int max_leaves = BVH_Builder::max_treelet_leaf_count;
+
+		/* Grow the treelet by opening the treelet leaf with the largest surface area until it has enough leaves */
+		unsigned int treelet_leaves[max_leaves];
+		unsigned int internals[max_leaves - 1];
+		int treelet_leaf_count = 0;
+		int internal_count = 0;
+
+		internals[internal_count++] = root;
+		treelet_leaves[treelet_leaf_count++] = tree.nodes[root].left;
+		treelet_leaves[treelet_leaf_count++] = tree.nodes[root].right;
+
+		while (treelet_leaf_count < leaf_count)
+		{
+			int best = -1;
+			double best_area = -1.0;
+			for (int i = 0; i < treelet_leaf_count; i++)
+			{
+				const BVH_BuildNode& candidate = tree.nodes[treelet_leaves[i]];
+				if (candidate.IsLeaf()) continue;
+
+				double area = candidate.bounds.SurfaceArea();
+				if (area > best_area)
+				{
+					best = i;
+					best_area = area;
+				}
+			}
+
+			if (best < 0) break;
+
+			unsigned int opened = treelet_leaves[best];
+			internals[internal_count++] = opened;
+			treelet_leaves[best] = tree.nodes[opened].left;
+			treelet_leaves[treelet_leaf_count++] = tree.nodes[opened].right;
+		}
+
+		const BVH_BuildNode& node = tree.nodes[root];
+		double area = node.bounds.SurfaceArea();
+		double interior_cost = params.traversal_cost * area + area_costs[node.left] + area_costs[node.right];
+		unsigned int prim_count = prim_counts[node.left] + prim_counts[node.right];
+
+		if (treelet_leaf_count >= 3 && prim_count >= min_treelet_prims)
+		{
+			/* Dynamic programming over all subsets of the treelet leaves: the cheapest subtree over a subset is either a
+			leaf or the cheapest partition into two smaller subsets. Subsets are visited in increasing order, so every
+			proper subset has already been solved. */
+			const unsigned int full = (1u << treelet_leaf_count) - 1;
+			for (unsigned int subset = 1; subset <= full; subset++)
+			{
+				unsigned int lowest = subset & (0u - subset);
+				if (subset == lowest)
+				{
+					unsigned int leaf = treelet_leaves[std::countr_zero(subset)];
+					subset_bounds[subset] = tree.nodes[leaf].bounds;
+					subset_costs[subset] = area_costs[leaf];
+					subset_counts[subset] = prim_counts[leaf];
+					continue;
+				}
+
+				subset_bounds[subset] = AABB(subset_bounds[subset ^ lowest], subset_bounds[lowest]);
+				subset_counts[subset] = subset_counts[subset ^ lowest] + subset_counts[lowest];
+
+				/* Only partitions whose left side holds the lowest leaf are visited (the others are mirror images),
+				by enumerating the subsets of the remaining leaves that stay on the right side */
+				const unsigned int rest = subset ^ lowest;
+				double best_cost = Inf;
+				unsigned int best_partition = lowest;
+				for (unsigned int right = rest; right != 0; right = (right - 1) & rest)
+				{
+					double cost = subset_costs[subset ^ right] + subset_costs[right];
+					if (cost < best_cost)
+					{
+						best_cost = cost;
+						best_partition = subset ^ right;
+					}
+				}
+
+				double subset_area = subset_bounds[subset].SurfaceArea();
+				subset_costs[subset] = params.traversal_cost * subset_area + best_cost;
+				subset_leaves[subset] = 0;
+				partitions[subset] = best_partition;
+
+				if (subset == full) break;
+
+				double leaf_cost = subset_area * SAH_LeafCost(subset_counts[subset], params);
+				if (subset_counts[subset] <= params.max_leaf_size && leaf_cost < subset_costs[subset])
+				{
+					subset_costs[subset] = leaf_cost;
+					subset_leaves[subset] = 1;
+				}
+			}
+
+			/* Keep the current topology unless the new one is cheaper by more than rounding */
+			if (subset_costs[full] < interior_cost * (1.0 - 1.0e-9))
+			{
+				/* Rebuild the treelet from the optimal partitions, reusing its interior nodes (the root stays the root) */
+				int next_internal = 0;
+				EmitSubset(full, treelet_leaves, internals, next_internal);
+				interior_cost = subset_costs[full];
+				changed++;
+			}
+		}
+
+		/* The whole treelet may also be cheaper as a single leaf */
+		double leaf_cost = area * SAH_LeafCost(prim_count, params);
+		bool collapse = prim_count <= params.max_leaf_size && leaf_cost < interior_cost;
+		area_costs[root] = collapse ? leaf_cost : interior_cost;
+		prim_counts[root] = prim_count;
+		collapsed[root] = collapse;
+	}
+
+	/* Link the optimal subtree over a subset of the treelet leaves and return its node index */
+	unsigned int EmitSubset(unsigned int subset, const unsigned int* treelet_leaves, const unsigned int* internals, int& next_internal)
+	{
+		if ((subset & (subset - 1)) == 0) return treelet_leaves[std::countr_zero(subset)];
+
+		unsigned int index = internals[next_internal++];
+		unsigned int left = EmitSubset(partitions[subset], treelet_leaves, internals, next_internal);
+		unsigned int right = EmitSubset(subset ^ partitions[subset], treelet_leaves, internals, next_internal);
+
+		/* Split along the axis that separates the children the most, so traversal visits the nearer one first.
+		Traversal assumes the left child is the lower one on that axis. */
+		Vec3 offset = tree.nodes[right].bounds.Centroid() - tree.nodes[left].bounds.Centroid();
+		Vec3 separation = glm::abs(offset);
+		int axis = separation.x > separation.y ? (separation.x > separation.z ? 0 : 2) : (separation.y > separation.z ? 1 : 2);
+		if (offset[axis] < 0.0) std::swap(left, right);
+
+		BVH_BuildNode& node = tree.nodes[index];
+		node.bounds = subset_bounds[subset];
+		node.left = left;
+		node.right = right;
+		node.axis = axis;
+
+		parents[left] = index;
+		parents[right] = index;
+		area_costs[index] = subset_costs[subset];
+		prim_counts[index] = subset_counts[subset];
+		collapsed[index] = subset_leaves[subset];
+		return index;
+	}
+
+private:
+	BVH_BuildTree& tree;
+	const BVH_BuildParams& params;
+	int leaf_count;
+	unsigned int min_treelet_prims = 0;
+
+	std::vector<unsigned int> parents; /* UINT_MAX for the root */
+	std::vector<double> area_costs; /* Surface area times SAH cost of every processed node */
+	std::vector<unsigned int> prim_counts; /* Number of primitives below every processed node */
+	std::vector<std::atomic<int>> visits; /* Number of children that finished the current pass */
+
+	/* Scratch space of Restructure. Each thread needs its own */
+	static const int max_subsets = 1 << BVH_Builder::max_treelet_leaf_count;
+	static thread_local AABB subset_bounds[max_subsets];
+	static thread_local double subset_costs[max_subsets];
+	static thread_local unsigned int subset_counts[max_subsets];
+	static thread_local char subset_leaves[max_subsets];
+	static thread_local unsigned int partitions[max_subsets];
+};
+
+thread_local AABB TreeletOptimizer::subset_bounds[TreeletOptimizer::max_subsets];
+thread_local double TreeletOptimizer::subset_costs[TreeletOptimizer::max_subsets];
+thread_local unsigned int TreeletOptimizer::subset_counts[TreeletOptimizer::max_subsets];
+thread_local char TreeletOptimizer::subset_leaves[TreeletOptimizer::max_subsets];
+thread_local unsigned int TreeletOptimizer::partitions[TreeletOptimizer::max_subsets];
+
+
+void BVH_Builder::OptimizeTreelets()
+{
+	if (tree.nodes.size() < 3) return;
+
+	/* Restructuring may deepen the tree, so keep the original in case the traversal stacks would overflow */
+	std::vector<BVH_BuildNode> original = tree.nodes;
+
+	TreeletOptimizer optimizer(tree, params);
+
+	/* Large trees are climbed from chunks of leaves in parallel. The result does not depend on the thread count */
+	const size_t leaf_chunk_size = 1024;
+	size_t leaf_count = optimizer.leaves.size();
+	size_t chunk_count = leaf_count >= params.parallel_threshold ? (leaf_count + leaf_chunk_size - 1) / leaf_chunk_size : 1;
+	size_t per_chunk = (leaf_count + chunk_count - 1) / chunk_count;
+
+	/* Small subtrees gain little from further passes, so (as in the paper) every pass doubles the minimum size of the subtrees it restructures */
+	unsigned int min_prims = (unsigned int)params.treelet_leaf_count;
+	for (int pass = 0; pass < params.treelet_passes; pass++, min_prims *= 2)
+	{
+		optimizer.Reset(min_prims);
+		ParallelFor(chunk_count, [&](size_t c) {
+			size_t last = std::min((c + 1) * per_chunk, leaf_count);
+			for (size_t i = c * per_chunk; i < last; i++) optimizer.Climb(optimizer.leaves[i]);
+			});
+
+		if (optimizer.changed == 0) break;
+	}
+
+	/* Emit the final tree in depth first order. Collapsed subtrees become leaves, which requires their
+	primitives to be contiguous, so the primitives are reordered to follow the leaves. */
+	BVH_BuildTree output;
+	output.nodes.reserve(tree.nodes.size());
+	std::vector<BVH_BuildPrimitive> output_prims;
+	output_prims.reserve(prims.size());
+	int depth = 0;
+
+	class StackEntry
+	{
+	public:
+		unsigned int index; /* Node index in the restructured tree */
+		unsigned int parent; /* Parent's index in the output if this is its right child, UINT_MAX otherwise */
+		int depth;
+	};
+	std::vector<StackEntry> stack = { { 0, UINT_MAX, 1 } };
+	std::vector<unsigned int> subtree;
+	while (!stack.empty())
+	{
+		StackEntry entry = stack.back();
+		stack.pop_back();
+		depth = std::max(depth, entry.depth);
+
+		unsigned int new_index = (unsigned int)output.nodes.size();
+		output.nodes.push_back(tree.nodes[entry.index]);
+		if (entry.parent != UINT_MAX) output.nodes[entry.parent].right = new_index;
+
+		BVH_BuildNode& node = output.nodes.back();
+		if (!optimizer.collapsed[entry.index])
+		{
+			stack.push_back({ node.right, new_index, entry.depth + 1 });
+			stack.push_back({ node.left, UINT_MAX, entry.depth + 1 });
+			node.left = new_index + 1;
+			continue;
+		}
+
+		/* Gather the primitives of all leaves below a collapsed node */
+		unsigned int first_prim = (unsigned int)output_prims.size();
+		subtree.assign(1, entry.index);
+		while (!subtree.empty())
+		{
+			const BVH_BuildNode& below = tree.nodes[subtree.back()];
+			subtree.pop_back();
+			if (below.IsLeaf())
+			{
+				output_prims.insert(output_prims.end(), prims.begin() + below.first_prim, prims.begin() + below.first_prim + below.prim_count);
+				continue;
+			}
+			subtree.push_back(below.right);
+			subtree.push_back(below.left);
+		}
+
+		node.first_prim = first_prim;
+		node.prim_count = (unsigned int)output_prims.size() - first_prim;
+	}
+
+	/* In the rare case that it got too deep, the original is kept (although its leaves hold a single primitive) */
+	if (depth > max_depth)
+	{
+		tree.nodes = std::move(original);
+		CompactNodes();
+		return;
+	}
+
+	tree.nodes = std::move(output.nodes);
+	prims = std::move(output_prims);
+}
+
+
+/* ===================== */
+/* ====== Helpers ====== */
+/* ===================== */
+
+int BVH_RefitThreadDepth(size_t primitive_count, const BVH_BuildParams& params)
+{
+	if (primitive_count < params.parallel_threshold) return 0;
+
+	/* Level d has 2^d subtrees, so stop once there are enough of them for every thread */
+	int thread_count = params.thread_count > 0 ? params.thread_count : (int)std::thread::hardware_concurrency();
+	int depth = 0;
+	while ((2 << depth) <= thread_count && depth < 16) depth++;
+	return depth;
+}
+
+
+BVH_BuildTree BuildHittableTree(const std::vector<std::shared_ptr<Hittable>>& objects, const BVH_BuildParams& params)
+{
+	std::vector<BVH_BuildPrimitive> build_prims(objects.size());
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		build_prims[i] = BVH_BuildPrimitive(objects[i]->BoundingBox(), (unsigned int)i);
+	}
+
+	BVH_SplitFunction split = [&objects](unsigned int index, const AABB& box, int axis, double position, AABB& left, AABB& right) {
+		objects[index]->SplitBoundingBox(box, axis, position, left, right);
+	};
+
+	return BVH_Builder(params, split).Build(std::move(build_prims));
+}
+
+} /* namespace rt */
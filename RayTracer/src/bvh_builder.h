@@ -0,0 +1,329 @@
+#pragma once
+
+#include "common.h"
+#include "aabb.h"
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace rt
+{
+
+/* Strategy used to partition primitives when building a BVH */
+enum BVH_SplitMethod
+{
+	SplitMedian, /* Sort along the longest axis and split at the median */
+	SplitSAH, /* Binned surface area heuristic */
+	SplitMorton, /* Linear BVH over radix sorted Morton codes of the centroids (fast, lower quality) */
+	SplitSBVH, /* Binned SAH that also considers spatial splits, duplicating references that straddle the split plane (built serially) */
+};
+
+
+/* Memory layout of the BVHs created by BuildBVH */
+enum BVH_Layout
+{
+	LayoutBinaryTree, /* Heap allocated BVH_Node tree traversed recursively */
+	LayoutLinear, /* Flattened LinearBVH node array traversed with an explicit stack */
+	LayoutWide4, /* 4-wide BVH4 with SIMD box tests */
+	LayoutWide8, /* 8-wide BVH8 with SIMD box tests */
+};
+
+
+/* Parameters that control how a BVH is constructed */
+class BVH_BuildParams
+{
+public:
+	BVH_SplitMethod split_method = SplitMedian;
+	BVH_Layout layout = LayoutBinaryTree;
+
+	/* Number of centroid bins evaluated along each axis by the SAH builder (read through BinCount) */
+	int bin_count = 16;
+
+	/* Nodes with at most this many primitives become leaves (for SAH builds, only if a leaf is cheaper than the best split) */
+	size_t max_leaf_size = 4;
+
+	/* Relative costs of traversing an interior node and of intersecting a single primitive */
+	double traversal_cost = 1.0;
+	double intersection_cost = 1.0;
+
+	/* Number of threads used by BVH_Builder (0 uses all hardware threads) */
+	int thread_count = 0;
+
+	/* Ranges with at least this many primitives are built as separate tasks and binned/partitioned in parallel */
+	size_t parallel_threshold = 16384;
+
+	/* Produce identical trees (including node order) regardless of the thread count */
+	bool deterministic = true;
+
+	/* Morton builds: if > 0, the hierarchy above the Morton treelets with at most this many
+	primitives is rebuilt with the binned SAH (0 keeps the pure Morton hierarchy) */
+	size_t morton_sah_treelet_size = 0;
+
+	/* SBVH builds: spatial splits are only evaluated where the children of the best object split overlap
+	by more than this fraction of the root's surface area (0 always evaluates them) */
+	double sbvh_overlap_threshold = 1.0e-5;
+
+	/* SBVH builds: maximum number of duplicated references, as a fraction of the primitive count */
+	double sbvh_duplication_budget = 0.3;
+
+	/* If > 2, a post-pass rearranges treelets with up to this many leaves (at most BVH_Builder::max_treelet_leaf_count)
+	into the topology with the lowest SAH cost, bottom-up and in parallel. The split methods then build single primitive
+	leaves, which the pass merges into leaves of up to max_leaf_size primitives where that is cheaper. This brings fast
+	median or Morton builds close to the quality of SAH builds (0 disables the pass) */
+	int treelet_leaf_count = 0;
+
+	/* Number of bottom-up passes of the treelet restructuring (it stops early once a pass changes nothing) */
+	int treelet_passes = 3;
+
+	/* Refit (of BVH_Node, LinearBVH and WideBVH) recomputes the node bounds bottom-up from the current bounding boxes of
+	the primitives after they were moved (e.g., with Hittable::SetTransform or Triangle::SetVertices), without changing
+	the tree structure. Trees of at least parallel_threshold primitives are refit in parallel. Refit takes the params
+	the BVH was built with and rebuilds the BVH once its SAH cost grew beyond this factor of the cost after the last
+	build, returning true if it did (0 never rebuilds) */
+	double refit_rebuild_threshold = 1.5;
+
+public:
+	/* Number of bins the SAH sweeps actually use (at least 2, so that a split is always possible) */
+	int BinCount() const
+	{
+		return bin_count > 1 ? bin_count : 2;
+	}
+};
+
+
+/* The best split found by a binned SAH sweep */
+class SAH_Split
+{
+public:
+	int axis = -1; /* -1 if no valid split was found */
+	int bin = 0; /* Primitives in bins [0, bin] go to the left child, the rest to the right */
+	double cost = Inf; /* Estimated SAH cost of the split (including the traversal step) */
+};
+
+
+/* Returns the bin a centroid falls into along the provided axis of the centroid bounds */
+inline int SAH_BinIndex(const Point3& centroid, const AABB& centroid_bounds, int axis, int bin_count)
+{
+	const Interval& ax = centroid_bounds.AxisInterval(axis);
+	int bin = (int)(bin_count * ((centroid[axis] - ax.min) / ax.Size()));
+	if (bin < 0) bin = 0;
+	if (bin >= bin_count) bin = bin_count - 1;
+	return bin;
+}
+
+
+/* Returns the SAH cost of a leaf holding `count` primitives */
+inline double SAH_LeafCost(size_t count, const BVH_BuildParams& params)
+{
+	return (double)count * params.intersection_cost;
+}
+
+
+/* Centroid bins of a binned SAH sweep along all three axes. Bins of disjoint primitive
+ranges can be merged, which allows large ranges to be binned in parallel. */
+class SAH_Bins
+{
+public:
+	SAH_Bins(int bin_count) : bin_count(bin_count)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bounds[axis].resize(bin_count);
+			counts[axis].resize(bin_count, 0);
+		}
+	}
+
+	/* Add a primitive's bounds to the bin its centroid falls into along each axis */
+	inline void Add(const AABB& box, const Point3& centroid, const AABB& centroid_bounds)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int b = SAH_BinIndex(centroid, centroid_bounds, axis, bin_count);
+			bounds[axis][b] = AABB(bounds[axis][b], box);
+			counts[axis][b]++;
+		}
+	}
+
+	/* Accumulate the bins of another (disjoint) set of primitives */
+	void Merge(const SAH_Bins& other);
+
+	/* Sweep the bins and return the cheapest split of a range with the provided bounds */
+	SAH_Split FindSplit(const AABB& range_bounds, const AABB& centroid_bounds, const BVH_BuildParams& params) const;
+
+private:
+	int bin_count;
+	std::vector<AABB> bounds[3];
+	std::vector<size_t> counts[3];
+};
+
+
+/* Sweep `bin_count` centroid bins along all three axes and return the cheapest split.
+`get_bounds` maps an element of [first, last) to its world space AABB. */
+template <typename Iter, typename BoundsFn>
+SAH_Split FindSAHSplit(Iter first, Iter last, BoundsFn get_bounds, const AABB& bounds, const AABB& centroid_bounds, const BVH_BuildParams& params)
+{
+	SAH_Bins bins(params.BinCount());
+	for (Iter it = first; it != last; ++it)
+	{
+		AABB box = get_bounds(*it);
+		bins.Add(box, box.Centroid(), centroid_bounds);
+	}
+
+	return bins.FindSplit(bounds, centroid_bounds, params);
+}
+
+
+/* ===================================== */
+/* === Index based (flat) BVH builds === */
+/* ===================================== */
+
+/* A primitive as seen by the index based builders: only its bounds and its index in the source list */
+class BVH_BuildPrimitive
+{
+public:
+	AABB bounds;
+	Point3 centroid;
+	unsigned int index;
+
+public:
+	BVH_BuildPrimitive() : index(0) {}
+	BVH_BuildPrimitive(const AABB& bounds, unsigned int index) : bounds(bounds), centroid(bounds.Centroid()), index(index) {}
+};
+
+
+/* Split the part of primitive `index` inside `box` at an axis aligned plane and return the bounds of both halves (for spatial splits) */
+using BVH_SplitFunction = std::function<void(unsigned int index, const AABB& box, int axis, double position, AABB& left, AABB& right)>;
+
+
+/* Node of the intermediate binary tree produced by BVH_Builder. Children are referenced by index into the node array */
+class BVH_BuildNode
+{
+public:
+	AABB bounds;
+	unsigned int left = 0; /* Child node indices (interior nodes only) */
+	unsigned int right = 0;
+	unsigned int first_prim = 0; /* Range into BVH_BuildTree::prim_indices (leaves only) */
+	unsigned int prim_count = 0; /* 0 for interior nodes */
+	int axis = 0; /* Axis the node was split along */
+
+public:
+	bool IsLeaf() const { return prim_count > 0; }
+};
+
+
+/* The result of a BVH build. The root is node 0 (if there are any nodes at all) */
+class BVH_BuildTree
+{
+public:
+	std::vector<BVH_BuildNode> nodes;
+	/* Primitive indices referenced by the leaves. SBVH builds may reference a primitive from several leaves, which
+	closest hit traversal handles naturally: once ray_t.max has shrunk to a hit, the same hit is rejected again. */
+	std::vector<unsigned int> prim_indices;
+
+public:
+	/* Returns the SAH cost of the tree using the cost constants of the provided params */
+	double SAH_Cost(const BVH_BuildParams& params) const;
+};
+
+
+class BVH_TaskPool;
+
+/* Builds a binary BVH over a set of primitive bounds. Large ranges are split into subtree tasks
+and binned/partitioned in parallel on a pool of BVH_BuildParams::thread_count threads, which is
+started once per build (see BVH_TaskPool). */
+class BVH_Builder
+{
+public:
+	BVH_Builder(const BVH_BuildParams& params) : params(params) {}
+
+	/* `split` is used by SBVH builds to tighten the bounds of split references. Without it,
+	spatial splits clip the primitives' bounding boxes instead of their geometry. */
+	BVH_Builder(const BVH_BuildParams& params, BVH_SplitFunction split) : params(params), split(std::move(split)) {}
+
+	BVH_BuildTree Build(std::vector<BVH_BuildPrimitive> primitives);
+
+public:
+	/* SAH builds fall back to median splits below this depth so that traversal stacks stay bounded */
+	static const int max_sah_depth = 64;
+
+	/* Maximum depth of any tree produced by the builders (sized for traversal stacks) */
+	static const int max_depth = 128;
+
+	/* Large ranges are processed in chunks of this many primitives. The chunks do not
+	depend on the thread count, so the results of parallel passes do not either. */
+	static const size_t chunk_size = 4096;
+
+	/* Largest treelets rearranged by the treelet restructuring pass (their cost grows with 3^leaves) */
+	static const int max_treelet_leaf_count = 8;
+
+private:
+	BVH_BuildParams params;
+	BVH_SplitFunction split;
+	std::vector<BVH_BuildPrimitive> prims;
+	std::vector<BVH_BuildPrimitive> scratch; /* Temporary storage for parallel partitions */
+	BVH_BuildTree tree;
+
+	std::atomic<unsigned int> next_node = 0; /* Node allocator of non-deterministic builds */
+	BVH_TaskPool* pool = nullptr; /* Threads of the current build */
+
+	double root_area = 0.0; /* Surface area of the root of SBVH builds */
+
+private:
+	/* Recursively build the subtree over prims[start, end) into the node at `node_index` */
+	void BuildRange(size_t start, size_t end, int depth, unsigned int node_index);
+
+	/* Compute the bounds of prims[start, end) and of their centroids */
+	void ComputeBounds(size_t start, size_t end, AABB& bounds, AABB& centroid_bounds);
+
+	/* Determine where to split prims[start, end). Returns `start` if the range should become a leaf */
+	size_t SplitRange(size_t start, size_t end, int depth, const AABB& bounds, const AABB& centroid_bounds, int& axis);
+
+	/* Partition prims[start, end) so that the primitives matching `predicate` come first. Returns the split position */
+	template <typename Predicate>
+	size_t PartitionRange(size_t start, size_t end, Predicate predicate);
+
+	/* Call fn(i) for i in [0, count) on the calling thread and any threads of the pool that are idle */
+	template <typename Fn>
+	void ParallelFor(size_t count, Fn fn);
+
+	/* Renumber the nodes in depth first order and drop unused node slots */
+	void CompactNodes();
+
+	/* Build the tree from the Morton order of the primitive centroids (SplitMorton) */
+	void BuildMorton();
+
+	/* Stable parallel radix sort of the keys, applying the same permutation to the values */
+	void RadixSort(std::vector<std::uint64_t>& keys, std::vector<unsigned int>& values);
+
+	/* Build the tree with object and spatial splits (SplitSBVH). The final references replace `prims` */
+	void BuildSpatial();
+
+	/* Recursively build the subtree over a set of references, duplicating at most `budget` of them.
+	The leaves' references are appended to `leaf_refs`. Returns the node index */
+	unsigned int BuildSpatialNode(std::vector<BVH_BuildPrimitive>& refs, int depth, size_t budget, std::vector<BVH_BuildPrimitive>& leaf_refs);
+
+	/* Find the cheapest spatial split of references with the provided bounds. Also returns the resulting child reference counts */
+	SAH_Split FindSpatialSplit(const std::vector<BVH_BuildPrimitive>& refs, const AABB& bounds, size_t& left_count, size_t& right_count);
+
+	/* Split a reference at an axis aligned plane and return the bounds of both halves */
+	void SplitReference(const BVH_BuildPrimitive& ref, int axis, double position, AABB& left, AABB& right) const;
+
+	/* Rearrange the treelets of the built tree to lower its SAH cost (see BVH_BuildParams::treelet_leaf_count) */
+	void OptimizeTreelets();
+};
+
+
+/* Returns how many levels below the root of a binary BVH over `primitive_count` primitives
+refit their subtrees on separate threads (0 for trees below BVH_BuildParams::parallel_threshold) */
+int BVH_RefitThreadDepth(size_t primitive_count, const BVH_BuildParams& params);
+
+
+class Hittable;
+
+/* Build a tree over a list of objects (spatial splits clip the objects with Hittable::SplitBoundingBox) */
+BVH_BuildTree BuildHittableTree(const std::vector<std::shared_ptr<Hittable>>& objects, const BVH_BuildParams& params);
+
+} /* namespace rt */
@@ -11,7 +11,20 @@ Point2 Camera::GetSubPixelOffset()
 	/* Return the starting offset to that sub pixel */
 	int i = sub_pixel % stratified_side_length;
 	int j = sub_pixel / stratified_side_length;
-	return Point2((double)i / stratified_side_length, (double)j / stratified_side_length);
+	return Point2((Real)i / stratified_side_length, (Real)j / stratified_side_length);
+}
+
+void Camera::ResetAccumulation()
+{
+	/* Resize and reset the image_accumulator */
+	image_accumulator = std::vector<double>(image_width * image_height * 3);
+	rendered_image = std::vector<unsigned char>(image_width * image_height * 3);
+	luminance_m2 = std::vector<double>(image_width * image_height);
+	pixel_samples = std::vector<unsigned int>(image_width * image_height);
+	completed_passes = 0;
+	next_tile = 0;
+	active_pixels = image_width * image_height;
+	pass_active_pixels = 0;
 }
 
 /* ========================== */
@@ -19,7 +32,7 @@ Point2 Camera::GetSubPixelOffset()
 /* ========================== */
 Ray PerspectiveCamera::GenerateRay(unsigned int i, unsigned int j)
 {
-	Point2 offset_to_pixel((double)i, (double)j);
+	Point2 offset_to_pixel((Real)i, (Real)j);
 	Point2 offset_to_sub_pixel = GetSubPixelOffset();
 	Point2 offset_within_subpixel = (SampleSquare() + 0.5) / stratified_side_length;
 
@@ -40,7 +53,8 @@ void PerspectiveCamera::Initialize()
 		|| !Equal(old_origin, origin) 
 		|| !Equal(old_look_at, look_at) 
 		|| !Equal(old_up, up) 
-		|| old_vfov != vfov)
+		|| old_vfov != vfov
+		|| pixel_samples.size() != image_width * image_height)
 	{
 		/* Update the stored "prior" camera view params */
 		old_image_width = image_width;
@@ -50,20 +64,18 @@ void PerspectiveCamera::Initialize()
 		old_up = up;
 		old_vfov = vfov;
 
-		/* Resize and reset the image_accumulator */
-		image_accumulator = std::vector<double>(image_width * image_height * 3);
-		current_samples = 0;
+		ResetAccumulation();
 	}
 
 	/* Determine aspect ratio of the image given its dimensions */
-	aspect_ratio = double(image_width) / double(image_height);
+	aspect_ratio = Real(image_width) / Real(image_height);
 
 	/* Determine viewport dimensions */
-	double focal_length = glm::length(origin - look_at);
-	double theta = DegreesToRadians(vfov);
-	double h = std::tan(theta / 2.0);
-	double viewport_height = 2.0 * h * focal_length;
-	double viewport_width = viewport_height * aspect_ratio;
+	Real focal_length = glm::length(origin - look_at);
+	Real theta = DegreesToRadians(vfov);
+	Real h = std::tan(theta / 2.0);
+	Real viewport_height = 2.0 * h * focal_length;
+	Real viewport_width = viewport_height * aspect_ratio;
 
 	/* Calculate the orthonormal basis vectors for the camera coordinate frame */
 	/* Note: using right hand coordinates! */
@@ -76,8 +88,8 @@ void PerspectiveCamera::Initialize()
 	Vec3 viewport_v = viewport_height * -v;
 
 	/* Calculate the horizontal and vertical delta vectors from pixel to pixel. */
-	pixel_delta_u = viewport_u / double(image_width);
-	pixel_delta_v = viewport_v / double(image_height);
+	pixel_delta_u = viewport_u / Real(image_width);
+	pixel_delta_v = viewport_v / Real(image_height);
 
 	/* Calculate the location of the upper left pixel. */
 	Vec3 viewport_upper_left = origin - (focal_length * w) - viewport_u / 2.0 - viewport_v / 2.0;
@@ -92,7 +104,7 @@ Ray ThinLensCamera::GenerateRay(unsigned int i, unsigned int j)
 {
 	/* Generate a ray from the defocus disk directed at a randomly sampled point around pixel location i, j */
 	Point2 offset = SampleSquare();
-	Vec3 pixel_sample = pixel00_loc + (((double)i + offset.x) * pixel_delta_u) + (((double)j + offset.y) * pixel_delta_v);
+	Vec3 pixel_sample = pixel00_loc + (((Real)i + offset.x) * pixel_delta_u) + (((Real)j + offset.y) * pixel_delta_v);
 
 	Vec3 ray_origin = (defocus_angle <= 0.0) ? origin : DefocusDiskSample();
 	Vec3 direction = pixel_sample - ray_origin;
@@ -114,7 +126,8 @@ void ThinLensCamera::Initialize()
 		|| !Equal(old_origin, origin)
 		|| !Equal(old_look_at, look_at)
 		|| !Equal(old_up, up)
-		|| old_vfov != vfov)
+		|| old_vfov != vfov
+		|| pixel_samples.size() != image_width * image_height)
 	{
 		/* Update the stored "prior" camera view params */
 		old_image_width = image_width;
@@ -124,19 +137,17 @@ void ThinLensCamera::Initialize()
 		old_up = up;
 		old_vfov = vfov;
 
-		/* Resize and reset the image_accumulator */
-		image_accumulator = std::vector<double>(image_width * image_height * 3);
-		current_samples = 0;
+		ResetAccumulation();
 	}
 
 	/* Determine aspect ratio of the image given its dimensions */
-	aspect_ratio = double(image_width) / double(image_height);
+	aspect_ratio = Real(image_width) / Real(image_height);
 
 	/* Determine viewport dimensions */
-	double theta = DegreesToRadians(vfov);
-	double h = std::tan(theta / 2.0);
-	double viewport_height = 2.0 * h * focus_distance;
-	double viewport_width = viewport_height * aspect_ratio;
+	Real theta = DegreesToRadians(vfov);
+	Real h = std::tan(theta / 2.0);
+	Real viewport_height = 2.0 * h * focus_distance;
+	Real viewport_width = viewport_height * aspect_ratio;
 
 	/* Calculate the orthonormal basis vectors for the camera coordinate frame */
 	/* Note: using right hand coordinates! */
@@ -149,15 +160,15 @@ void ThinLensCamera::Initialize()
 	Vec3 viewport_v = viewport_height * -v;
 
 	/* Calculate the horizontal and vertical delta vectors from pixel to pixel. */
-	pixel_delta_u = viewport_u / double(image_width);
-	pixel_delta_v = viewport_v / double(image_height);
+	pixel_delta_u = viewport_u / Real(image_width);
+	pixel_delta_v = viewport_v / Real(image_height);
 
 	/* Calculate the location of the upper left pixel. */
 	Vec3 viewport_upper_left = origin - (focus_distance * w) - viewport_u / 2.0 - viewport_v / 2.0;
 	pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
 
 	/* Calculate the camera defocus disk basis vectors */
-	double defocus_radius = focus_distance * std::tan(DegreesToRadians(defocus_angle / 2.0));
+	Real defocus_radius = focus_distance * std::tan(DegreesToRadians(defocus_angle / 2.0));
 	defocus_disk_u = u * defocus_radius;
 	defocus_disk_v = v * defocus_radius;
 }
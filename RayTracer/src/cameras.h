@@ -18,8 +18,15 @@ public:
 	/* Initialize camera parameters */
 	virtual void Initialize() {}
 
-	/* Return current sample count of rendered image */
-	inline unsigned int GetSampleCount() const { return current_samples; }
+	/* Return the number of completed passes over the rendered image. Without adaptive sampling, this is the number of
+	samples every pixel has. */
+	inline unsigned int GetSampleCount() const { return completed_passes; }
+
+	/* Return true if no pixel needed more samples after the last completed pass (see RenderParams::adaptive) */
+	inline bool Converged() const { return active_pixels == 0; }
+
+	/* Clear the accumulated image and sample counts (also called by Initialize when the view changes) */
+	void ResetAccumulation();
 
 public:
 	/* Image dimensions */
@@ -28,8 +35,19 @@ public:
 
 	/* Ray Tracing params */
 	int max_depth = 10; /* Maximum number of bounces per ray */
-	unsigned int current_samples = 0; /* Used to determine previous sample contributions to the accumulated image */
+	int russian_roulette_depth = -1; /* Number of bounces after which Russian roulette may end a path early, based on how
+										much light it can still carry (a negative value disables it, see TraceRay). Note:
+										the surviving paths are brighter, so more samples are clamped in PixelColor. */
+	std::vector<unsigned int> pixel_samples; /* Number of samples accumulated by each pixel. These differ while a
+												progressive render is part way through a pass (see RenderProgressive). */
 	std::vector<double> image_accumulator; /* Stores results from all previous samples used for accumulation */
+	std::vector<double> luminance_m2; /* Sum of squared differences from the mean luminance of each pixel's samples
+										 (see Welford's method). Used to estimate the noise of a pixel for adaptive sampling. */
+	std::vector<unsigned char> rendered_image; /* The accumulated image as returned by the renderer */
+	unsigned int completed_passes = 0; /* Number of passes in which every pixel was sampled once */
+	size_t next_tile = 0; /* Tile a progressive render continues the current pass from */
+	size_t active_pixels = 0; /* Number of pixels that still needed samples after the last completed pass */
+	size_t pass_active_pixels = 0; /* Number of pixels that still need samples, of those visited in the current pass */
 	bool simulate_time = false; /* Determines if camera has a "shutter speed" to simulate effects like motion blur.
 								   Note: Timescale for the cameras is always defined within 0-1; it is up to the user
 								   to decide how much/where objects move within that time frame. */
@@ -43,7 +61,7 @@ public:
 	bool gamma_correct = false; /* OpenGL gamma corrects for us so this is optional */
 
 protected:
-	double aspect_ratio = 1.0; /* Ratio of image width over image height */
+	Real aspect_ratio = 1.0; /* Ratio of image width over image height */
 
 	/* Store previous sample's view params */
 	unsigned int old_image_width = 100;
@@ -88,10 +106,10 @@ public:
 	void Initialize() override;
 
 public:
-	double vfov = 90.0; /* Vertical field of view */
+	Real vfov = 90.0; /* Vertical field of view */
 
 private:
-	double old_vfov; /* Store the previous sample's vfov */
+	Real old_vfov; /* Store the previous sample's vfov */
 
 };
 
@@ -103,9 +121,9 @@ public:
 	void Initialize();
 
 public:
-	double defocus_angle = 0.0; /* Variation angle of rays through each pixel */
-	double focus_distance = 10.0; /* Distance from the camera origin to plane of perfect focus */
-	double vfov = 90.0; /* Vertical field of view */
+	Real defocus_angle = 0.0; /* Variation angle of rays through each pixel */
+	Real focus_distance = 10.0; /* Distance from the camera origin to plane of perfect focus */
+	Real vfov = 90.0; /* Vertical field of view */
 
 private:
 	/* Returns a random point in the camera defocus disk */
@@ -116,7 +134,7 @@ private:
 	Vec3 defocus_disk_u; /* Defocus disk horizontal radius */
 	Vec3 defocus_disk_v; /* Defocus disk vertical radius */
 
-	double old_vfov; /* Store the previous sample's vfov */
+	Real old_vfov; /* Store the previous sample's vfov */
 };
 
 
@@ -1,14 +1,30 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <random>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <type_traits>
 
 
 namespace rt 
 {
+/* ====================== */
+/* === Real Precision === */
+/* ====================== */
+
+/* Scalar type of the math core (vectors, rays, intervals, bounding boxes and transforms) and of everything
+built on it. Define RT_USE_FLOAT (e.g., in the project's preprocessor definitions) to build the ray tracer
+in single precision. Intersection tolerances and the accumulation of samples stay in double either way. */
+#if defined(RT_USE_FLOAT)
+using Real = float;
+#else
+using Real = double;
+#endif
+
+
 /* ================= */
 /* === Constants === */
 /* ================= */
@@ -18,6 +34,10 @@ const double Pi = 3.1415926535897932385;
 const double InvPi = 1.0 / Pi;
 const double Eps = 1e-8;
 
+/* Minimum distance of ray hits (and offset of rays leaving a surface) that keeps rays from hitting the surface they
+start on. Single precision hit points are only accurate to about 1e-7 of the scene scale, so float builds need more */
+const double RayEps = std::is_same_v<Real, float> ? 1e-4 : Eps;
+
 
 /* ========================= */
 /* === Utility Functions === */
@@ -29,28 +49,55 @@ inline double DegreesToRadians(double degrees)
 	return degrees * Pi / 180.0;
 }
 
+/* The random number generators of the calling thread. Every thread has its own, which are default seeded
+unless the thread reseeds them with SeedThreadRandom (e.g., the render workers, see TileScheduler) */
+class ThreadRandom
+{
+public:
+	std::mt19937_64 real; /* Used by RandomDouble() */
+	std::mt19937_64 real_range; /* Used by RandomDouble(min, max) */
+	std::mt19937 integer; /* Used by RandomInt */
+
+public:
+	static ThreadRandom& Get()
+	{
+		thread_local static ThreadRandom generators;
+		return generators;
+	}
+};
+
+/* Reseed the random number generators of the calling thread, so that threads given different seeds draw independent sequences */
+inline void SeedThreadRandom(std::uint64_t seed)
+{
+	/* Each generator is seeded differently so that they are not correlated with each other */
+	ThreadRandom& generators = ThreadRandom::Get();
+	std::seed_seq real_sequence = { (std::uint32_t)seed, (std::uint32_t)(seed >> 32), 0u };
+	std::seed_seq real_range_sequence = { (std::uint32_t)seed, (std::uint32_t)(seed >> 32), 1u };
+	std::seed_seq integer_sequence = { (std::uint32_t)seed, (std::uint32_t)(seed >> 32), 2u };
+	generators.real.seed(real_sequence);
+	generators.real_range.seed(real_range_sequence);
+	generators.integer.seed(integer_sequence);
+}
+
 /* Returns a random real (double) in [0, 1) */
 inline double RandomDouble()
 {
 	static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-	thread_local static std::mt19937_64 generator;
-	return distribution(generator);
+	return distribution(ThreadRandom::Get().real);
 }
 
 /* Returns a random real (double) in [min, max) */
 inline double RandomDouble(double min, double max)
 {
 	static std::uniform_real_distribution<double> distribution(min, max);
-	thread_local static std::mt19937_64 generator;
-	return distribution(generator);
+	return distribution(ThreadRandom::Get().real_range);
 }
 
 /* Returns a random integer in [min, max] */
 inline int RandomInt(int min, int max)
 {
 	static std::uniform_int_distribution<int> distribution(min, max);
-	thread_local static std::mt19937 generator;
-	return distribution(generator);
+	return distribution(ThreadRandom::Get().integer);
 }
 
 /* Returns the next power of two that is greater than or equal to x */
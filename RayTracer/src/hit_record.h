@@ -2,24 +2,129 @@
 
 #include "ray.h"
 #include "transform.h"
+#include "material.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <memory>
 
 namespace rt 
 {
 
-class Material;
+class Hittable;
+class SurfaceInteraction;
 
+/* The result of a Hit query. Intersection only records what is needed to find the closest hit: its distance,
+the primitive that was hit and that primitive's own hit coordinates. The full surface interaction is computed
+from it once, for the closest hit only (see Interaction), so rejected candidates cost no more than this. */
 class HitRecord
 {
+public:
+	/* Number of Instances recorded by pointer. Deeper nesting is supported, but slower (see outer_transform) */
+	static const int max_instance_depth = 4;
+
+	Real t; /* position of hit along the ray */
+	Real u; /* Primitive specific hit coordinates (e.g., barycentric coordinates for triangles) */
+	Real v;
+	std::uint32_t prim_id; /* Index of the hit element within the object (e.g., a triangle of a mesh) */
+	const Hittable* object = nullptr; /* The primitive that was hit */
+
+	/* The Instances the ray entered to reach the object, innermost first */
+	const Hittable* instances[max_instance_depth];
+	int instance_count = 0;
+
+	/* Once `instances` is full, the transforms of the Instances further out are composed into this one */
+	Transform outer_transform;
+	bool has_outer_transform = false;
+
+public:
+	HitRecord() {}
+
+	/* Record a hit on `hit_object`. Called by primitives (instances add themselves afterwards) */
+	void Set(const Hittable* hit_object, Real hit_t, Real hit_u, Real hit_v, std::uint32_t hit_prim_id = 0)
+	{
+		object = hit_object;
+		t = hit_t;
+		u = hit_u;
+		v = hit_v;
+		prim_id = hit_prim_id;
+		instance_count = 0;
+		has_outer_transform = false;
+	}
+
+	/* Add an Instance around the hit object, after the ones inside it. Called by Instances */
+	void AddInstance(const Hittable* instance, const Transform& instance_transform)
+	{
+		if (instance_count < max_instance_depth)
+		{
+			instances[instance_count++] = instance;
+			return;
+		}
+
+		outer_transform = has_outer_transform ? instance_transform.Compose(outer_transform) : instance_transform;
+		has_outer_transform = true;
+	}
+
+	/* Compute the surface interaction of this hit, where `ray` is the ray the Hit query was made with */
+	void Interaction(const Ray& ray, SurfaceInteraction& interaction) const;
+};
+
+
+/* The result of a HitInterval query: the sorted, disjoint parts of a ray's interval that lie inside a closed
+object (e.g., the boundary of a volume). The capacity is fixed so that queries never allocate; spans beyond it
+are merged with their neighbors, which is conservative (gaps between them are treated as inside). */
+class HitSpans
+{
+public:
+	static const int max_spans = 8;
+
+	Interval spans[max_spans];
+	int count = 0;
+
+public:
+	HitSpans() {}
+
+	/* Add a span, merging it with any spans it overlaps or touches. Empty spans are ignored. */
+	void Add(Interval span)
+	{
+		if (!(span.min < span.max)) return;
+
+		/* Find the first span that does not end before the new one, then absorb every span it overlaps */
+		int first = 0;
+		while (first < count && spans[first].max < span.min) first++;
+
+		int last = first;
+		while (last < count && spans[last].min <= span.max) span = Interval(span, spans[last++]);
+
+		if (first == last && count == max_spans)
+		{
+			/* Full, so merge the new span with the next one (or the last one if there is none) */
+			if (first == count) first--;
+			spans[first] = Interval(spans[first], span);
+			return;
+		}
+
+		/* Replace spans [first, last) with the new one */
+		if (first == last) std::copy_backward(spans + first, spans + count, spans + count + 1);
+		else if (last - first > 1) std::copy(spans + last, spans + count, spans + first + 1);
+
+		count += 1 - (last - first);
+		spans[first] = span;
+	}
+};
+
+
+/* The surface interaction at the closest hit, used for shading */
+class SurfaceInteraction
+{
 public:
 	Point3 posn; /* Model space position */
 	Vec3 normal; /* Model space normal */
-	std::shared_ptr<Material> material;
-	double t; /* position of hit along the ray */
-	double u; /* uv coordinates of hit (for textures) */
-	double v;
+	MaterialHandle material;
+	Real t; /* position of hit along the ray */
+	Real u; /* uv coordinates of hit (for textures) */
+	Real v;
 	bool front_face;
 
 	/* Used to convert between model space and world space.
@@ -27,7 +132,7 @@ public:
 	Transform transform; 
 
 public:
-	HitRecord() {} /* No constructor is actually used for this class */
+	SurfaceInteraction() {} /* Filled in by Hittable::Interaction */
 
 	void SetFaceNormal(const Vec3& ray_direction, const Vec3& outward_normal)
 	{
@@ -1,28 +1,61 @@
 #include "hittable.h"
+#include "mesh.h"
 
 #include "OBJ-Loader.h"
 
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
 namespace rt
 {
+/* ======================== */
+/* ====== Hit Record ====== */
+/* ======================== */
+
+void HitRecord::Interaction(const Ray& ray, SurfaceInteraction& interaction) const
+{
+	/* The object computes its interaction from the ray in its own parent space, which is
+	inside the innermost instance. The instance transforms are then applied on top of it. */
+	Ray object_ray = has_outer_transform ? outer_transform.WorldToModel(ray) : ray;
+	for (int i = instance_count; i-- > 0;) object_ray = instances[i]->transform.WorldToModel(object_ray);
+
+	object->Interaction(object_ray, *this, interaction);
+
+	for (int i = 0; i < instance_count; i++) interaction.transform = instances[i]->transform.Compose(interaction.transform);
+	if (has_outer_transform) interaction.transform = outer_transform.Compose(interaction.transform);
+}
+
+
+/* ====================== */
+/* ====== Hittable ====== */
+/* ====================== */
+
+void Hittable::WorldSpaceTransform(const char* name) const
+{
+	std::cout << "[rt::" << name << "] WARNING: The objects are stored in world space and cannot be moved as a whole. Move an Instance of them instead!" << std::endl;
+}
+
+
 /* ===================== */
 /* ====== Spheres ====== */
 /* ===================== */
 
-Sphere::Sphere(const Transform& t_transform, std::shared_ptr<Material> material)
+Sphere::Sphere(const Transform& t_transform, MaterialHandle material)
 	: material(material), motion_vector(Vec3(0.0)) 
 {
 	transform = t_transform;
 	SetBoundingBox();
 }
 
-Sphere::Sphere(const Transform& t_transform, const Vec3& motion_vector, std::shared_ptr<Material> material)
+Sphere::Sphere(const Transform& t_transform, const Vec3& motion_vector, MaterialHandle material)
 	: material(material), motion_vector(motion_vector)
 {
 	transform = t_transform;
 	SetBoundingBox();
 }
 
-Sphere::Sphere(const Vec3& center, double radius, std::shared_ptr<Material> material)
+Sphere::Sphere(const Vec3& center, Real radius, MaterialHandle material)
 	: material(material), motion_vector(Vec3(0.0))
 {
 	transform.Translate(center);
@@ -31,7 +64,7 @@ Sphere::Sphere(const Vec3& center, double radius, std::shared_ptr<Material> mate
 	SetBoundingBox();
 }
 
-Sphere::Sphere(const Point3& start, const Point3& stop, double radius, std::shared_ptr<Material> material)
+Sphere::Sphere(const Point3& start, const Point3& stop, Real radius, MaterialHandle material)
 	: material(material), motion_vector(stop - start)
 {
 	transform.Translate(start);
@@ -40,56 +73,98 @@ Sphere::Sphere(const Point3& start, const Point3& stop, double radius, std::shar
 	SetBoundingBox();
 }
 
-bool Sphere::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+bool Sphere::Intersect(const Ray& model_ray, const Point3& center, Interval ray_t, Real& t)
 {
-	Ray model_ray = transform.WorldToModel(ray);
-
-	Point3 current_center = SphereCenter(ray.time); /* In model coords */
-	Vec3 oc = current_center - model_ray.origin;
-	double a = glm::length2(model_ray.direction);
-	double h = glm::dot(model_ray.direction, oc);
-	double c = glm::length2(oc) - 1.0;
+	Vec3 oc = center - model_ray.origin;
+	Real a = glm::length2(model_ray.direction);
+	Real h = glm::dot(model_ray.direction, oc);
+	Real c = glm::length2(oc) - 1.0;
 
-	double discriminant = h * h - a * c;
+	Real discriminant = h * h - a * c;
 	if (discriminant < 0.0) return false;
 
-	double sqrtd = std::sqrt(discriminant);
+	Real sqrtd = std::sqrt(discriminant);
 
 	/* Find the nearest root that lies in the acceptable range */
-	double root = (h - sqrtd) / a;
-	if (!ray_t.Surrounds(root)) 
+	t = (h - sqrtd) / a;
+	if (!ray_t.Surrounds(t)) 
 	{
-		root = (h + sqrtd) / a;
-		if (!ray_t.Surrounds(root)) return false;
+		t = (h + sqrtd) / a;
+		if (!ray_t.Surrounds(t)) return false;
 	}
 
-	hrec.t = root;
-	hrec.posn = model_ray.At(hrec.t); /* store model space posn */
+	return true;
+}
 
+bool Sphere::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
 
-	Vec3 outward_normal = model_ray.At(hrec.t) - current_center; /* model space normal vector */
-	GetSphereUV(outward_normal, hrec.u, hrec.v); /* Set UV coords in model space */
+	Point3 current_center = SphereCenter(ray.time); /* In model coords */
+	Real root;
+	if (!Intersect(model_ray, current_center, ray_t, root)) return false;
+
+	hrec.Set(this, root, 0.0, 0.0);
+	return true;
+}
 
-	hrec.SetFaceNormal(model_ray.direction, outward_normal); /* set model space normal */
 
-	hrec.material = material;
-	hrec.transform = transform;
+void Sphere::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t); /* store model space posn */
+
+	Vec3 outward_normal = interaction.posn - SphereCenter(ray.time); /* model space normal vector */
+	GetSphereUV(outward_normal, interaction.u, interaction.v); /* Set UV coords in model space */
+
+	interaction.SetFaceNormal(model_ray.direction, outward_normal); /* set model space normal */
+
+	interaction.material = material;
+	interaction.transform = transform;
+}
 
+
+bool Sphere::Occluded(const Ray& ray, Real t_max) const
+{
+	Real t;
+	return Intersect(transform.WorldToModel(ray), SphereCenter(ray.time), Interval(RayEps, t_max), t);
+}
+
+
+bool Sphere::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+
+	Vec3 oc = SphereCenter(ray.time) - model_ray.origin;
+	Real a = glm::length2(model_ray.direction);
+	Real h = glm::dot(model_ray.direction, oc);
+	Real c = glm::length2(oc) - 1.0;
+
+	Real discriminant = h * h - a * c;
+	if (discriminant < 0.0) return false;
+
+	/* The ray is inside the sphere between the two roots */
+	Real sqrtd = std::sqrt(discriminant);
+	Interval span = Interval(std::fmax((h - sqrtd) / a, ray_t.min), std::fmin((h + sqrtd) / a, ray_t.max));
+	if (!(span.min < span.max)) return false;
+
+	spans.Add(span);
 	return true;
 }
 
 
-double Sphere::PDF_Value(const Point3& origin, const Vec3& direction) const
+Real Sphere::PDF_Value(const Point3& origin, const Vec3& direction) const
 {
 	/* Note: this method only works for stationary spheres! */
 
-	HitRecord hrec;
-	auto world_space_ray = Ray(origin, direction);
-	if (!this->Hit(world_space_ray, Interval(Eps, Inf), hrec)) return 0.0;
+	auto model_space_ray = transform.WorldToModel(Ray(origin, direction));
+	Real t;
+	if (!Intersect(model_space_ray, SphereCenter(0.0), Interval(RayEps, Inf), t)) return 0.0;
 
-	auto model_space_ray = transform.WorldToModel(world_space_ray);
-	double cos_theta_max = std::sqrt(1.0 + 1.0 / glm::length2(model_space_ray.origin));
-	double solid_angle = 2.0 * Pi * (1.0 - cos_theta_max);
+	Real cos_theta_max = std::sqrt(1.0 + 1.0 / glm::length2(model_space_ray.origin));
+	Real solid_angle = 2.0 * Pi * (1.0 - cos_theta_max);
 
 	return 1.0 / solid_angle;
 }
@@ -99,7 +174,7 @@ Vec3 Sphere::Random(const Point3& origin) const
 {
 	Point3 sphere_center = transform.PointModelToWorld(Point3(0.0));
 	Vec3 direction = sphere_center - origin;
-	double distance_squared = glm::length2(direction);
+	Real distance_squared = glm::length2(direction);
 	OrthonormalBasis onb(direction);
 
 	/* Determine the maximum radius of the transformed sphere along all directions */
@@ -107,61 +182,67 @@ Vec3 Sphere::Random(const Point3& origin) const
 	Vec3 model_y = Vec3(0.0, 1.0, 0.0);
 	Vec3 model_z = Vec3(0.0, 0.0, 1.0);
 	/* Determine world-space lengths squared */
-	double wlx = glm::length2(transform.VectorModelToWorld(model_x));
-	double wly = glm::length2(transform.VectorModelToWorld(model_y));
-	double wlz = glm::length2(transform.VectorModelToWorld(model_z));
+	Real wlx = glm::length2(transform.VectorModelToWorld(model_x));
+	Real wly = glm::length2(transform.VectorModelToWorld(model_y));
+	Real wlz = glm::length2(transform.VectorModelToWorld(model_z));
 	/* Pick the longest radius axis */
-	double max_radius = (wlx > wly) ? (wlx > wlz ? wlx : wlz) : (wly > wlz ? wly : wlz);
+	Real max_radius = (wlx > wly) ? (wlx > wlz ? wlx : wlz) : (wly > wlz ? wly : wlz);
 
 	return onb.Local(RandomToSphere(max_radius, distance_squared));
 }
 
 
-Vec3 Sphere::RandomToSphere(double radius_squared, double distance_squared)
+Vec3 Sphere::RandomToSphere(Real radius_squared, Real distance_squared)
 {
-	double r1 = RandomDouble();
-	double r2 = RandomDouble();
+	Real r1 = RandomDouble();
+	Real r2 = RandomDouble();
 	auto z = 1.0 + r2 * (std::sqrt(1.0 - radius_squared / distance_squared));
 
-	double phi = 2.0 * Pi * r1;
-	double x = std::cos(phi) * std::sqrt(1.0 - z * z);
-	double y = std::sin(phi) * std::sqrt(1.0 - z * z);
+	Real phi = 2.0 * Pi * r1;
+	Real x = std::cos(phi) * std::sqrt(1.0 - z * z);
+	Real y = std::sin(phi) * std::sqrt(1.0 - z * z);
 
 	return Vec3(x, y, z);
 }
 
 
-Point3 Sphere::SphereCenter(double time) const
+Point3 Sphere::SphereCenter(Real time) const
 {
 	/* Linearly interpolate between the sphere center and the end of the motion_vector */
 	return time * motion_vector;
 }
 
-void Sphere::GetSphereUV(const Point3& p, double& u, double& v)
+void Sphere::GetSphereUV(const Point3& p, Real& u, Real& v)
 {
 	/* p: hit point on a sphere of radius 1, centered at the origin */
 	/* u: returned value [0, 1] of angle around the z-axis from x = -1 */
 	/* v: returned value [0, 1] of angle from z = -1 to z = +1 */
 
-	double theta = std::acos(p.z);
-	double phi = std::atan2(p.y, p.x) + Pi;
+	Real theta = std::acos(p.z);
+	Real phi = std::atan2(p.y, p.x) + Pi;
 
 	u = phi / (2.0 * Pi);
 	v = theta / Pi;
 }
 
+void Sphere::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	SetBoundingBox();
+}
+
 void Sphere::SetBoundingBox()
 {
 	/* Find the transformed bounds of all corners of the box with corners [-1,-1,-1] to [1,1,1]*/
-	Vec3 rvec1 = transform.model_to_world * Vec4(-1.0, -1.0, -1.0, 1.0);
-	Vec3 rvec2 = transform.model_to_world * Vec4(1.0, -1.0, -1.0, 1.0);
-	Vec3 rvec3 = transform.model_to_world * Vec4(1.0, 1.0, -1.0, 1.0);
-	Vec3 rvec4 = transform.model_to_world * Vec4(-1.0, 1.0, -1.0, 1.0);
+	Vec3 rvec1 = transform.PointModelToWorld(Point3(-1.0, -1.0, -1.0));
+	Vec3 rvec2 = transform.PointModelToWorld(Point3(1.0, -1.0, -1.0));
+	Vec3 rvec3 = transform.PointModelToWorld(Point3(1.0, 1.0, -1.0));
+	Vec3 rvec4 = transform.PointModelToWorld(Point3(-1.0, 1.0, -1.0));
 
-	Vec3 rvec5 = transform.model_to_world * Vec4(-1.0, -1.0, 1.0, 1.0);
-	Vec3 rvec6 = transform.model_to_world * Vec4(1.0, -1.0, 1.0, 1.0);
-	Vec3 rvec7 = transform.model_to_world * Vec4(1.0, 1.0, 1.0, 1.0);
-	Vec3 rvec8 = transform.model_to_world * Vec4(-1.0, 1.0, 1.0, 1.0);
+	Vec3 rvec5 = transform.PointModelToWorld(Point3(-1.0, -1.0, 1.0));
+	Vec3 rvec6 = transform.PointModelToWorld(Point3(1.0, -1.0, 1.0));
+	Vec3 rvec7 = transform.PointModelToWorld(Point3(1.0, 1.0, 1.0));
+	Vec3 rvec8 = transform.PointModelToWorld(Point3(-1.0, 1.0, 1.0));
 
 	/* Create a bounding box that encompasses all transformed bounds */
 	AABB bounding_box_1 = AABB(AABB(AABB(rvec1, rvec2), AABB(rvec3, rvec4)), 
@@ -171,16 +252,15 @@ void Sphere::SetBoundingBox()
 	AABB bounding_box_2;
 	if (glm::length(motion_vector) > 0.0)
 	{
-		Vec4 mv = Vec4(motion_vector, 0.0);
-		rvec1 = transform.model_to_world * (mv + Vec4(-1.0, -1.0, -1.0, 1.0));
-		rvec2 = transform.model_to_world * (mv + Vec4(1.0, -1.0, -1.0, 1.0));
-		rvec3 = transform.model_to_world * (mv + Vec4(1.0, 1.0, -1.0, 1.0));
-		rvec4 = transform.model_to_world * (mv + Vec4(-1.0, 1.0, -1.0, 1.0));
+		rvec1 = transform.PointModelToWorld(motion_vector + Point3(-1.0, -1.0, -1.0));
+		rvec2 = transform.PointModelToWorld(motion_vector + Point3(1.0, -1.0, -1.0));
+		rvec3 = transform.PointModelToWorld(motion_vector + Point3(1.0, 1.0, -1.0));
+		rvec4 = transform.PointModelToWorld(motion_vector + Point3(-1.0, 1.0, -1.0));
 
-		rvec5 = transform.model_to_world * (mv + Vec4(-1.0, -1.0, 1.0, 1.0));
-		rvec6 = transform.model_to_world * (mv + Vec4(1.0, -1.0, 1.0, 1.0));
-		rvec7 = transform.model_to_world * (mv + Vec4(1.0, 1.0, 1.0, 1.0));
-		rvec8 = transform.model_to_world * (mv + Vec4(-1.0, 1.0, 1.0, 1.0));
+		rvec5 = transform.PointModelToWorld(motion_vector + Point3(-1.0, -1.0, 1.0));
+		rvec6 = transform.PointModelToWorld(motion_vector + Point3(1.0, -1.0, 1.0));
+		rvec7 = transform.PointModelToWorld(motion_vector + Point3(1.0, 1.0, 1.0));
+		rvec8 = transform.PointModelToWorld(motion_vector + Point3(-1.0, 1.0, 1.0));
 
 		/* Create a bounding box that encompasses all transformed bounds */
 		bounding_box_2 = AABB(AABB(AABB(rvec1, rvec2), AABB(rvec3, rvec4)),
@@ -195,96 +275,151 @@ void Sphere::SetBoundingBox()
 /* ====== Parallelograms ====== */
 /* ============================ */
 
-Parallelogram::Parallelogram(const Point3& Q, const Vec3& u, const Vec3& v, std::shared_ptr<Material> material)
-	: Q(Q), u(u), v(v), material(material)
+void SplitPolygonBounds(const Point3* vertices, int count, const AABB& box, int axis, Real position, AABB& left, AABB& right)
 {
-	Vec3 n = glm::cross(u, v);
-	area = glm::length(n);
-	normal = glm::normalize(n);
+	Interval left_extent[3], right_extent[3];
+	auto add = [](Interval* extent, const Point3& p) {
+		for (int i = 0; i < 3; i++) extent[i] = Interval(extent[i], Interval(p[i], p[i]));
+	};
 
-	/* In the equation for a plane (Ax + By + Cz = D), (A,B,C) is the normal vector. We can then solve for D 
-	by picking a point (x,y,z) on the plane. We know Q is on the plane so D = n dot Q */
-	D = glm::dot(normal, Q);
+	for (int i = 0; i < count; i++)
+	{
+		const Point3& a = vertices[i];
+		const Point3& b = vertices[(i + 1) % count];
 
-	w = n / glm::dot(n, n);
+		if (a[axis] <= position) add(left_extent, a);
+		if (a[axis] >= position) add(right_extent, a);
 
-	SetBoundingBox();
+		/* Edges crossing the plane contribute their intersection point to both halves */
+		if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+		{
+			Point3 p = a + ((position - a[axis]) / (b[axis] - a[axis])) * (b - a);
+			p[axis] = position;
+			add(left_extent, p);
+			add(right_extent, p);
+		}
+	}
+
+	/* Pad flat halves the same way as the full bounding box, but never leave the box or cross the plane */
+	AABB left_box, right_box;
+	box.Split(axis, position, left_box, right_box);
+
+	left = left_extent[0].Size() < 0.0 ? AABB() : AABB(left_extent[0], left_extent[1], left_extent[2]).Intersection(left_box);
+	right = right_extent[0].Size() < 0.0 ? AABB() : AABB(right_extent[0], right_extent[1], right_extent[2]).Intersection(right_box);
 }
 
 
-Parallelogram::Parallelogram(const Transform& t_transform, std::shared_ptr<Material> material)
-	: Q(Point3(-0.5, -0.5, 0.0)), u(Vec3(1.0, 0.0, 0.0)), v(Vec3(0.0, 1.0, 0.0)), 
-	w(Vec3(0.0, 0.0, 1.0)), normal(Vec3(0.0, 0.0, 1.0)), material(material)
+Parallelogram::Parallelogram(const Point3& Q, const Vec3& u, const Vec3& v, MaterialHandle material)
+	: Q(Q), u(u), v(v), material(material)
 {
-	transform = t_transform;
-	D = glm::dot(normal, Q);
+	Bake();
+}
 
-	auto world_u = transform.VectorModelToWorld(u);
-	auto world_v = transform.VectorModelToWorld(v);
-	auto world_n = glm::cross(world_u, world_v);
-	area = glm::length(world_n);
 
-	SetBoundingBox();
+Parallelogram::Parallelogram(const Transform& t_transform, MaterialHandle material)
+	: Q(Point3(-0.5, -0.5, 0.0)), u(Vec3(1.0, 0.0, 0.0)), v(Vec3(0.0, 1.0, 0.0)), material(material)
+{
+	transform = t_transform;
+	Bake();
 }
 
-void Parallelogram::SetBoundingBox()
+void Parallelogram::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	Bake();
+}
+
+void Parallelogram::Bake()
 {
 	/* Transform the parallelogram origin and direction vectors to world space */
-	Vec3 Q_w = transform.model_to_world * Vec4(Q, 1.0);
-	Vec3 u_w = transform.model_to_world * Vec4(u, 0.0);
-	Vec3 v_w = transform.model_to_world * Vec4(v, 0.0);
+	world_Q = transform.PointModelToWorld(Q);
+	world_u = transform.VectorModelToWorld(u);
+	world_v = transform.VectorModelToWorld(v);
+
+	Vec3 n = glm::cross(world_u, world_v);
+	area = glm::length(n);
+	world_normal = glm::normalize(n);
+	normal = glm::normalize(glm::cross(u, v));
 
-	AABB bbox_diagonal1 = AABB(Q_w, Q_w+ u_w + v_w);
-	AABB bbox_diagonal2 = AABB(Q_w+ u_w, Q_w+ v_w);
+	/* In the equation for a plane (Ax + By + Cz = D), (A,B,C) is the normal vector. We can then solve for D 
+	by picking a point (x,y,z) on the plane. We know Q is on the plane so D = n dot Q */
+	world_D = glm::dot(world_normal, world_Q);
+
+	world_w = n / glm::dot(n, n);
+
+	AABB bbox_diagonal1 = AABB(world_Q, world_Q + world_u + world_v);
+	AABB bbox_diagonal2 = AABB(world_Q + world_u, world_Q + world_v);
 	bounding_box = AABB(bbox_diagonal1, bbox_diagonal2);
 }
 
-bool Parallelogram::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+bool Parallelogram::Intersect(const Ray& ray, Interval ray_t, Real& t, Real& alpha, Real& beta) const
 {
 	/* If our ray is defined as R = P + td, the intersection with the plane becomes
 	n dot (P + td) = D. Solving for t, we get t = (D - n dot P) / (n dot d) */
-	
-	Ray model_ray = transform.WorldToModel(ray);
 
-	double denominator = glm::dot(normal, model_ray.direction);
+	Real denominator = glm::dot(world_normal, ray.direction);
 
 	/* No hit if the ray is parallel to the plane */
 	if (std::fabs(denominator) < Eps) return false;
 
-	/* Return false if the hit point parameter t is outside the ray interval */
-	double t = (D - glm::dot(normal, model_ray.origin)) / denominator;
-	if (!ray_t.Contains(t)) return false;
+	/* Return false if the hit point parameter t is outside the (open) ray interval. The interval is open so that
+	a parallelogram referenced by several BVH leaves is not hit again once ray_t.max has shrunk to its hit. */
+	t = (world_D - glm::dot(world_normal, ray.origin)) / denominator;
+	if (!ray_t.Surrounds(t)) return false;
+
+	/* Determine if the hit point lies within the bounds of the parallelogram using the planar coordinates.
+	These are invariant under affine transforms, so they match the model space ones. */
+	Vec3 planar_hitpoint_vector = ray.At(t) - world_Q;
+	alpha = glm::dot(world_w, glm::cross(planar_hitpoint_vector, world_v));
+	beta = glm::dot(world_w, glm::cross(world_u, planar_hitpoint_vector));
+	return IsInterior(alpha, beta);
+}
 
-	/* Determine if the hit point lies within the bounds of the parallelogram using the planar coordinates */
-	Point3 intersection = model_ray.At(t);
-	Vec3 planar_hitpoint_vector = intersection - Q;
-	double alpha = glm::dot(w, glm::cross(planar_hitpoint_vector, v));
-	double beta = glm::dot(w, glm::cross(u, planar_hitpoint_vector));
-	if (!IsInterior(alpha, beta, hrec)) return false;
+bool Parallelogram::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	Real t, alpha, beta;
+	if (!Intersect(ray, ray_t, t, alpha, beta)) return false;
 
 	/* Ray hits within the plane bounds... update hrec */
-	hrec.t = t;
-	hrec.posn = intersection;
-	hrec.material = material;
-	hrec.SetFaceNormal(model_ray.direction, normal);
-	hrec.transform = transform;
-
+	hrec.Set(this, t, alpha, beta);
 	return true;
 }
 
 
-double Parallelogram::PDF_Value(const Point3& origin, const Vec3& direction) const
+void Parallelogram::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	/* Only the closest hit transforms the ray, since interactions (and solid textures) stay in model space */
+	Ray model_ray = transform.WorldToModel(ray);
+
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+	interaction.u = hrec.u;
+	interaction.v = hrec.v;
+	interaction.material = material;
+	interaction.SetFaceNormal(model_ray.direction, normal);
+	interaction.transform = transform;
+}
+
+
+bool Parallelogram::Occluded(const Ray& ray, Real t_max) const
+{
+	Real t, alpha, beta;
+	return Intersect(ray, Interval(RayEps, t_max), t, alpha, beta);
+}
+
+
+Real Parallelogram::PDF_Value(const Point3& origin, const Vec3& direction) const
 {
 	/* Assume input origin and direction are in world space! */
 
-	HitRecord hrec;
-	if (!this->Hit(Ray(origin, direction), Interval(Eps, Inf), hrec))
+	Real t, alpha, beta;
+	if (!Intersect(Ray(origin, direction), Interval(RayEps, Inf), t, alpha, beta))
 	{
 		return 0.0;
 	}
 
-	double distance_squared = hrec.t * hrec.t * glm::length2(direction);
-	double cosine = std::fabs(glm::dot(direction, hrec.normal)) / glm::length(direction);
+	Real distance_squared = t * t * glm::length2(direction);
+	Real cosine = std::fabs(glm::dot(direction, world_normal)) / glm::length(direction);
 
 	return distance_squared / (cosine * area);
 }
@@ -292,29 +427,27 @@ double Parallelogram::PDF_Value(const Point3& origin, const Vec3& direction) con
 
 rt::Vec3 Parallelogram::Random(const Point3& origin) const
 {
-	/* Note: assume origin is provided in world space. 
-	Q, u, v are in model space and need to be converted to world space! */
-	Point3 world_space_Q = transform.model_to_world * Vec4(Q, 1.0);
-	Vec3 world_space_u = transform.model_to_world * Vec4(u, 0.0);
-	Vec3 world_space_v = transform.model_to_world * Vec4(v, 0.0);
+	/* Note: assume origin is provided in world space */
 
 	/* Pick a random point on this parallelogram */
-	Vec3 p = world_space_Q + (RandomDouble() * world_space_u) + (RandomDouble() * world_space_v);
+	Vec3 p = world_Q + (RandomDouble() * world_u) + (RandomDouble() * world_v);
 
 	/* Return a vector to a random point on this parallelogram in world space */
 	return p - origin;
 }
 
+void Parallelogram::SplitBoundingBox(const AABB& box, int axis, Real position, AABB& left, AABB& right) const
+{
+	Point3 vertices[4] = { world_Q, world_Q + world_u, world_Q + world_u + world_v, world_Q + world_v };
+	SplitPolygonBounds(vertices, 4, box, axis, position, left, right);
+}
+
 
-bool Parallelogram::IsInterior(double a, double b, HitRecord& hrec) const
+bool Parallelogram::IsInterior(Real a, Real b) const
 {
 	Interval unit_interval = Interval(0.0, 1.0);
 
-	if (!unit_interval.Contains(a) || !unit_interval.Contains(b)) return false;
-
-	hrec.u = a;
-	hrec.v = b;
-	return true;
+	return unit_interval.Contains(a) && unit_interval.Contains(b);
 }
 
 
@@ -322,26 +455,22 @@ bool Parallelogram::IsInterior(double a, double b, HitRecord& hrec) const
 /* ====== Triangles ====== */
 /* ======================= */
 
-Triangle::Triangle(const Transform& t_transform, const Point3& v0p, const Point3& v1p, const Point3& v2p, std::shared_ptr<Material> material)
+Triangle::Triangle(const Transform& t_transform, const Point3& v0p, const Point3& v1p, const Point3& v2p, MaterialHandle material)
 	: v0p(v0p), v1p(v1p), v2p(v2p), material(material)
 {
 	transform = t_transform;
 
-	/* Edge vectors and normal in model space */
-	e01 = v1p - v0p;
-	e02 = v2p - v0p;
-
-	Vec3 normal = glm::normalize(glm::cross(e01, e02));
+	/* Normal in model space */
+	Vec3 normal = glm::normalize(glm::cross(v1p - v0p, v2p - v0p));
 	v0n = normal;
 	v1n = normal;
 	v2n = normal;
 
-	ComputeArea();
-	SetBoundingBox();
+	Bake();
 }
 
 
-Triangle::Triangle(const Transform& t_transform, const objl::Vertex& v0, const objl::Vertex& v1, const objl::Vertex& v2, std::shared_ptr<Material> material)
+Triangle::Triangle(const Transform& t_transform, const objl::Vertex& v0, const objl::Vertex& v1, const objl::Vertex& v2, MaterialHandle material)
 	: material(material)
 {
 	transform = t_transform;
@@ -350,9 +479,6 @@ Triangle::Triangle(const Transform& t_transform, const objl::Vertex& v0, const o
 	v1p = Point3(v1.Position.X, v1.Position.Y, v1.Position.Z);
 	v2p = Point3(v2.Position.X, v2.Position.Y, v2.Position.Z);
 
-	e01 = v1p - v0p;
-	e02 = v2p - v0p;
-
 	v0n = Vec3(v0.Normal.X, v0.Normal.Y, v0.Normal.Z);
 	v1n = Vec3(v1.Normal.X, v1.Normal.Y, v1.Normal.Z);
 	v2n = Vec3(v2.Normal.X, v2.Normal.Y, v2.Normal.Z);
@@ -360,68 +486,67 @@ Triangle::Triangle(const Transform& t_transform, const objl::Vertex& v0, const o
 	/* if normals are not provided, compute them manually */
 	if (NearZero(v0n) || NearZero(v1n) || NearZero(v2n))
 	{
-		Vec3 normal = glm::normalize(glm::cross(e01, e02));
+		Vec3 normal = glm::normalize(glm::cross(v1p - v0p, v2p - v0p));
 		v0n = normal;
 		v1n = normal;
 		v2n = normal;
 	}
 
-	ComputeArea();
-	SetBoundingBox();
+	Bake();
 }
 
 
-bool Triangle::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+bool Triangle::Intersect(const Ray& ray, Interval ray_t, Real& t, Real& u, Real& v) const
 {
-	/* Moller-Trumbore intersection algorithm */
-	/* https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm */
+	/* Barycentric coordinates are invariant under affine transforms, so they match the model space ones */
+	return IntersectTriangle(ray, world_v0p, world_e01, world_e02, ray_t, t, u, v);
+}
 
-	Ray model_ray = transform.WorldToModel(ray);
 
-	Vec3 ray_cross_e02 = glm::cross(model_ray.direction, e02);
-	double det = glm::dot(e01, ray_cross_e02);
+bool Triangle::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	Real t, u, v;
+	if (!Intersect(ray, ray_t, t, u, v)) return false;
+	
+	hrec.Set(this, t, u, v);
+	return true;
+}
 
-	/* No hit if the ray is parallel to the triangle */
-	if (std::fabs(det) < Eps) return false;
 
-	/* Is the ray within the bounds of the triangle? */
-	double inv_det = 1.0 / det;
-	Vec3 s = model_ray.origin - v0p;
-	double u = inv_det * glm::dot(s, ray_cross_e02);
-	if (u < 0.0 || u > 1.0) return false;
+void Triangle::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	/* Only the closest hit transforms the ray, since interactions (and solid textures) stay in model space */
+	Ray model_ray = transform.WorldToModel(ray);
 
-	Vec3 s_cross_e01 = glm::cross(s, e01);
-	double v = inv_det * glm::dot(model_ray.direction, s_cross_e01);
-	if (v < 0.0 || u + v > 1.0) return false;
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+	interaction.material = material;
+	Vec3 normal = ComputeInterpolatedNormal(hrec.u, hrec.v);
+	interaction.SetFaceNormal(model_ray.direction, normal);
+	interaction.transform = transform;
 
-	/* The ray is within the triangle, test the intersection point */
-	double t = inv_det * glm::dot(e02, s_cross_e01);
-	if (t < Eps) return false;
-	
-	hrec.t = t;
-	hrec.posn = model_ray.At(t);
-	hrec.material = material;
-	Vec3 normal = ComputeInterpolatedNormal(u, v);
-	hrec.SetFaceNormal(model_ray.direction, normal);
-	hrec.transform = transform;
+	interaction.u = hrec.u;
+	interaction.v = hrec.v;
+}
 
-	hrec.u = u;
-	hrec.v = v;
 
-	return true;
+bool Triangle::Occluded(const Ray& ray, Real t_max) const
+{
+	Real t, u, v;
+	return Intersect(ray, Interval(RayEps, t_max), t, u, v);
 }
 
 
-double Triangle::PDF_Value(const Point3& origin, const Vec3& direction) const
+Real Triangle::PDF_Value(const Point3& origin, const Vec3& direction) const
 {
-	HitRecord hrec;
-	if (!this->Hit(Ray(origin, direction), Interval(Eps, Inf), hrec))
+	Real t, u, v;
+	if (!Intersect(Ray(origin, direction), Interval(RayEps, Inf), t, u, v))
 	{
 		return 0.0;
 	}
 
-	double distance_squared = hrec.t * hrec.t * glm::length2(direction);
-	double cosine = std::fabs(glm::dot(direction, hrec.normal)) / glm::length(direction);
+	Real distance_squared = t * t * glm::length2(direction);
+	Real cosine = std::fabs(glm::dot(direction, world_normal)) / glm::length(direction);
 
 	return distance_squared / (cosine * area);
 }
@@ -429,102 +554,403 @@ double Triangle::PDF_Value(const Point3& origin, const Vec3& direction) const
 
 Vec3 Triangle::Random(const Point3& origin) const
 {
-	Point3 world_space_v0p = transform.PointModelToWorld(v0p);
-	Vec3 world_space_e01 = transform.VectorModelToWorld(e01);
-	Vec3 world_space_e02 = transform.VectorModelToWorld(e02);
-
-	double r1 = RandomDouble();
-	double r2 = RandomDouble();
+	Real r1 = RandomDouble();
+	Real r2 = RandomDouble();
 
-	Vec3 p = world_space_v0p + (r1 * world_space_e01) + (r2 * world_space_e02);
+	Vec3 p = world_v0p + (r1 * world_e01) + (r2 * world_e02);
 
 	if (r1 + r2 > 1.0)
 	{
-		p = world_space_v0p + ((1.0 - r1) * world_space_e01) + ((1.0 - r2) * world_space_e02);
+		p = world_v0p + ((1.0 - r1) * world_e01) + ((1.0 - r2) * world_e02);
 	}
 
 	return p - origin;
 }
 
-void Triangle::SetBoundingBox()
+void Triangle::SplitBoundingBox(const AABB& box, int axis, Real position, AABB& left, AABB& right) const
+{
+	Point3 vertices[3] = { world_v0p, world_v0p + world_e01, world_v0p + world_e02 };
+	SplitPolygonBounds(vertices, 3, box, axis, position, left, right);
+}
+
+void Triangle::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	Bake();
+}
+
+void Triangle::SetVertices(const Point3& new_v0p, const Point3& new_v1p, const Point3& new_v2p)
+{
+	Vec3 normal = glm::normalize(glm::cross(new_v1p - new_v0p, new_v2p - new_v0p));
+	SetVertices(new_v0p, new_v1p, new_v2p, normal, normal, normal);
+}
+
+void Triangle::SetVertices(const Point3& new_v0p, const Point3& new_v1p, const Point3& new_v2p, const Vec3& new_v0n, const Vec3& new_v1n, const Vec3& new_v2n)
+{
+	v0p = new_v0p;
+	v1p = new_v1p;
+	v2p = new_v2p;
+
+	v0n = new_v0n;
+	v1n = new_v1n;
+	v2n = new_v2n;
+
+	Bake();
+}
+
+void Triangle::Bake()
 {
 	/* Transform triangle vertices to world space */
-	Point3 w_v0p = transform.model_to_world * Vec4(v0p, 1.0);
-	Point3 w_v1p = transform.model_to_world * Vec4(v1p, 1.0);
-	Point3 w_v2p = transform.model_to_world * Vec4(v2p, 1.0);
+	world_v0p = transform.PointModelToWorld(v0p);
+	Point3 world_v1p = transform.PointModelToWorld(v1p);
+	Point3 world_v2p = transform.PointModelToWorld(v2p);
+	world_e01 = world_v1p - world_v0p;
+	world_e02 = world_v2p - world_v0p;
+
+	Vec3 n = glm::cross(world_e01, world_e02);
+	area = 0.5 * glm::length(n);
+	world_normal = glm::normalize(n);
 
 	/* Create a bounding box enclosing world space bounds of the triangle's vertices */
-	bounding_box = AABB(AABB(w_v0p, w_v1p), AABB(w_v0p, w_v2p));
+	bounding_box = AABB(AABB(world_v0p, world_v1p), AABB(world_v0p, world_v2p));
 }
 
-void Triangle::ComputeArea()
+Vec3 Triangle::ComputeInterpolatedNormal(Real u, Real v) const
 {
-	Vec3 world_e01 = transform.VectorModelToWorld(e01);
-	Vec3 world_e02 = transform.VectorModelToWorld(e02);
-	area = 0.5 * glm::length(glm::cross(world_e01, world_e02));
+	return v0n + u * (v1n - v0n) + v * (v2n - v0n);
 }
 
-Vec3 Triangle::ComputeInterpolatedNormal(double u, double v) const
+/* ============================ */
+/* ====== Oriented Boxes ====== */
+/* ============================ */
+
+OrientedBox::OrientedBox(const Transform& t_transform, MaterialHandle material)
+	: material(material)
 {
-	return v0n + u * (v1n - v0n) + v * (v2n - v0n);
+	transform = t_transform;
+	Bake();
+}
+
+OrientedBox::OrientedBox(const Point3& a, const Point3& b, MaterialHandle material)
+	: material(material)
+{
+	transform.Translate(0.5 * (a + b));
+	transform.Scale(glm::abs(b - a));
+	Bake();
+}
+
+void OrientedBox::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	Bake();
+}
+
+void OrientedBox::Bake()
+{
+	/* World space edges of the unit cube along each model axis */
+	Vec3 edges[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		Vec3 edge = Vec3(0.0);
+		edge[axis] = 1.0;
+		edges[axis] = transform.VectorModelToWorld(edge);
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		face_area[axis] = glm::length(glm::cross(edges[(axis + 1) % 3], edges[(axis + 2) % 3]));
+	}
+
+	/* Enclose the eight world space corners */
+	bounding_box = AABB();
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Point3 p = transform.PointModelToWorld(Point3(corner & 1 ? 0.5 : -0.5, corner & 2 ? 0.5 : -0.5, corner & 4 ? 0.5 : -0.5));
+		bounding_box = AABB(bounding_box, AABB(p, p));
+	}
+}
+
+bool OrientedBox::IntersectUnitCube(const Ray& model_ray, Real& t_enter, Real& t_exit, int& enter_face, int& exit_face)
+{
+	t_enter = -Inf;
+	t_exit = Inf;
+	enter_face = 0;
+	exit_face = 1;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		/* Distances to the two planes of this slab. A ray parallel to the slab gets infinite distances,
+		of the same sign if it is outside of the slab (a miss) and of opposite signs if it is inside. */
+		Real inv_d = 1.0 / model_ray.direction[axis];
+		Real t0 = (-0.5 - model_ray.origin[axis]) * inv_d;
+		Real t1 = (0.5 - model_ray.origin[axis]) * inv_d;
+		int face0 = 2 * axis;
+		int face1 = 2 * axis + 1;
+
+		if (inv_d < 0.0)
+		{
+			std::swap(t0, t1);
+			std::swap(face0, face1);
+		}
+
+		if (t0 > t_enter)
+		{
+			t_enter = t0;
+			enter_face = face0;
+		}
+
+		if (t1 < t_exit)
+		{
+			t_exit = t1;
+			exit_face = face1;
+		}
+	}
+
+	/* A ray with a degenerate (zero or NaN) direction crosses no slab, leaving an infinite span, and misses */
+	return t_enter <= t_exit && std::isfinite(t_enter) && std::isfinite(t_exit);
+}
+
+Vec3 OrientedBox::FaceNormal(int face)
+{
+	Vec3 normal = Vec3(0.0);
+	normal[face / 2] = face % 2 == 1 ? 1.0 : -1.0;
+	return normal;
+}
+
+bool OrientedBox::Span(const Ray& ray, Real& t_enter, Real& t_exit, int* enter_face, int* exit_face) const
+{
+	int faces[2];
+	if (!IntersectUnitCube(transform.WorldToModel(ray), t_enter, t_exit, faces[0], faces[1])) return false;
+
+	if (enter_face) *enter_face = faces[0];
+	if (exit_face) *exit_face = faces[1];
+	return true;
+}
+
+bool OrientedBox::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	Real t_enter, t_exit;
+	int enter_face, exit_face;
+	if (!IntersectUnitCube(transform.WorldToModel(ray), t_enter, t_exit, enter_face, exit_face)) return false;
+
+	/* The hit is the entry if it is in the (open, as for Parallelogram) ray interval, otherwise the exit */
+	if (ray_t.Surrounds(t_enter)) hrec.Set(this, t_enter, 0.0, 0.0, enter_face);
+	else if (ray_t.Surrounds(t_exit)) hrec.Set(this, t_exit, 0.0, 0.0, exit_face);
+	else return false;
+
+	return true;
+}
+
+
+void OrientedBox::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+	int face = (int)hrec.prim_id;
+	int axis = face / 2;
+
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+
+	/* Texture coordinates span [0, 1] over each face, given by the other two model axes */
+	interaction.u = interaction.posn[(axis + 1) % 3] + 0.5;
+	interaction.v = interaction.posn[(axis + 2) % 3] + 0.5;
+
+	interaction.material = material;
+	interaction.SetFaceNormal(model_ray.direction, FaceNormal(face));
+	interaction.transform = transform;
+}
+
+
+bool OrientedBox::Occluded(const Ray& ray, Real t_max) const
+{
+	Real t_enter, t_exit;
+	int enter_face, exit_face;
+	if (!IntersectUnitCube(transform.WorldToModel(ray), t_enter, t_exit, enter_face, exit_face)) return false;
+
+	Interval ray_t = Interval(RayEps, t_max);
+	return ray_t.Surrounds(t_enter) || ray_t.Surrounds(t_exit);
+}
+
+
+bool OrientedBox::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	Real t_enter, t_exit;
+	if (!Span(ray, t_enter, t_exit)) return false;
+
+	Interval span = Interval(std::fmax(t_enter, ray_t.min), std::fmin(t_exit, ray_t.max));
+	if (!(span.min < span.max)) return false;
+
+	spans.Add(span);
+	return true;
+}
+
+
+Real OrientedBox::PDF_Value(const Point3& origin, const Vec3& direction) const
+{
+	/* Assume input origin and direction are in world space! */
+
+	Real t[2];
+	int faces[2];
+	if (!Span(Ray(origin, direction), t[0], t[1], &faces[0], &faces[1])) return 0.0;
+
+	/* Both faces crossed by the ray could have been sampled */
+	Real value = 0.0;
+	for (int i = 0; i < 2; i++)
+	{
+		if (t[i] <= RayEps) continue;
+
+		Vec3 world_normal = glm::normalize(transform.GetWorldNormal(FaceNormal(faces[i])));
+		Real distance_squared = t[i] * t[i] * glm::length2(direction);
+		Real cosine = std::fabs(glm::dot(direction, world_normal)) / glm::length(direction);
+		value += distance_squared / (cosine * face_area[faces[i] / 2]);
+	}
+
+	return value / 6.0;
+}
+
+
+Vec3 OrientedBox::Random(const Point3& origin) const
+{
+	/* Pick a random face, and then a random point on it */
+	int face = std::min((int)(RandomDouble() * 6.0), 5);
+	int axis = face / 2;
+
+	Point3 p;
+	p[axis] = face % 2 == 1 ? 0.5 : -0.5;
+	p[(axis + 1) % 3] = RandomDouble() - 0.5;
+	p[(axis + 2) % 3] = RandomDouble() - 0.5;
+
+	return transform.PointModelToWorld(p) - origin;
 }
 
 /* ============================== */
 /* ====== Constant Mediums ====== */
 /* ============================== */
 
-ConstantMedium::ConstantMedium(std::shared_ptr<Hittable> boundary, double density, std::shared_ptr<Texture> texture)
-	: boundary(boundary), neg_inv_density(-1.0 / density), phase_function(std::make_shared<Isotropic>(texture))
+ConstantMedium::ConstantMedium(std::shared_ptr<Hittable> boundary, Real density, MaterialHandle phase_function)
+	: boundary(boundary), neg_inv_density(-1.0 / density), phase_function(phase_function)
 {
 	SetBoundingBox();
 }
 
-ConstantMedium::ConstantMedium(std::shared_ptr<Hittable> boundary, double density, const Color& albedo)
-	: boundary(boundary), neg_inv_density(-1.0 / density), phase_function(std::make_shared<Isotropic>(albedo))
+bool ConstantMedium::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
 {
-	SetBoundingBox();
+	/* Find the parts of the ray inside the boundary, all in a single query */
+	HitSpans spans;
+	if (!boundary->HitInterval(ray, Interval(std::fmax(ray_t.min, 0.0), ray_t.max), spans)) return false;
+
+	/* Determine at what point inside the bounds the ray will scatter (or if it will pass through). The free
+	flight distance is walked along the spans in order, which is exact for any number of them since the
+	exponential distribution is memoryless. Note: distances are measured in world space, so the density
+	does not depend on the boundary's transform. */
+	Real ray_length = glm::length(ray.direction);
+	Real hit_distance = neg_inv_density * std::log(RandomDouble());
+
+	for (int i = 0; i < spans.count; i++)
+	{
+		Real distance_inside_boundary = spans.spans[i].Size() * ray_length;
+		if (hit_distance <= distance_inside_boundary)
+		{
+			hrec.Set(this, spans.spans[i].min + hit_distance / ray_length, 0.0, 0.0);
+			return true;
+		}
+
+		hit_distance -= distance_inside_boundary;
+	}
+
+	return false;
 }
 
-bool ConstantMedium::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+void ConstantMedium::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
 {
-	/* We need to determine the entry and exit points of the ray along the boundary */
-	HitRecord hrec1, hrec2;
+	Ray model_ray = boundary->transform.WorldToModel(ray);
 
-	/* If the ray does not intersect with the boundary at all, return */
-	if (!boundary->Hit(ray, Interval(-Inf, Inf), hrec1)) return false;
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+	interaction.u = 0.0;
+	interaction.v = 0.0;
+	interaction.material = phase_function;
+	interaction.transform = boundary->transform;
 
-	/* If the ray does not *exit*  the boundary, return */
-	if (!boundary->Hit(ray, Interval(hrec1.t + Eps, Inf), hrec2)) return false;
+	/* arbitrary... */
+	interaction.normal = Vec3(0.0, 0.0, 1.0);
+	interaction.front_face = true;
+}
 
-	/* Bounds check the entry and exit points */
-	if (hrec1.t < ray_t.min) hrec1.t = ray_t.min;
-	if (hrec2.t > ray_t.max) hrec2.t = ray_t.max;
-	if (hrec1.t >= hrec2.t) return false;
-	if (hrec1.t < 0.0) hrec1.t = 0.0;
+void ConstantMedium::SetTransform(const Transform& t_transform)
+{
+	boundary->SetTransform(t_transform);
+	transform = t_transform;
+	SetBoundingBox();
+}
 
-	/* Determine at what point inside the bounds the ray will scatter (or if it will pass through) */
-	Ray model_ray = boundary->transform.WorldToModel(ray);
-	double ray_length = glm::length(model_ray.direction);
-	double distance_inside_boundary = (hrec2.t - hrec1.t) * ray_length;
-	double hit_distance = neg_inv_density * std::log(RandomDouble());
+void ConstantMedium::SetBoundingBox()
+{
+	bounding_box = boundary->BoundingBox();
+}
 
-	if (hit_distance > distance_inside_boundary) return false;
+/* ======================= */
+/* ====== Instances ====== */
+/* ======================= */
 
-	hrec.t = hrec1.t + hit_distance / ray_length;
-	hrec.posn = model_ray.At(hrec.t);
-	hrec.material = phase_function;
-	hrec.transform = boundary->transform;
+Instance::Instance(const Transform& t_transform, std::shared_ptr<Hittable> object)
+	: object(object)
+{
+	transform = t_transform;
+	SetBoundingBox();
+}
 
-	/* arbitrary... */
-	hrec.normal = Vec3(0.0, 0.0, 1.0);
-	hrec.front_face = true;
+bool Instance::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	/* The transform is affine, so hit distances along the transformed ray are the same as along the world ray */
+	if (!object->Hit(transform.WorldToModel(ray), ray_t, hrec)) return false;
+
+	/* The hit is relative to the instance, so the instance transform is applied on top of the object's (see HitRecord::Interaction) */
+	hrec.AddInstance(this, transform);
 
 	return true;
 }
 
-void ConstantMedium::SetBoundingBox()
+bool Instance::Occluded(const Ray& ray, Real t_max) const
 {
-	bounding_box = boundary->BoundingBox();
+	return object->Occluded(transform.WorldToModel(ray), t_max);
+}
+
+bool Instance::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	return object->HitInterval(transform.WorldToModel(ray), ray_t, spans);
+}
+
+Real Instance::PDF_Value(const Point3& origin, const Vec3& direction) const
+{
+	return object->PDF_Value(transform.PointWorldToModel(origin), transform.VectorWorldToModel(direction));
+}
+
+Vec3 Instance::Random(const Point3& origin) const
+{
+	return transform.VectorModelToWorld(object->Random(transform.PointWorldToModel(origin)));
+}
+
+void Instance::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	SetBoundingBox();
+}
+
+void Instance::SetBoundingBox()
+{
+	bounding_box = AABB();
+
+	AABB box = object->BoundingBox();
+	if (box.IsEmpty()) return; /* Empty object */
+
+	/* Enclose all eight transformed corners of the object's bounding box */
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Point3 p = Point3(corner & 1 ? box.x.max : box.x.min, corner & 2 ? box.y.max : box.y.min, corner & 4 ? box.z.max : box.z.min);
+		Point3 w = transform.PointModelToWorld(p);
+		bounding_box = AABB(bounding_box, AABB(w, w));
+	}
 }
 
 /* =========================== */
@@ -547,19 +973,24 @@ void HittableList::Add(std::shared_ptr<Hittable> hittable)
 	bounding_box = AABB(bounding_box, hittable->BoundingBox());
 }
 
+void HittableList::UpdateBoundingBox()
+{
+	bounding_box = AABB();
+	for (const auto& object : objects) bounding_box = AABB(bounding_box, object->BoundingBox());
+}
+
 bool HittableList::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
 {
-	HitRecord temp_hrec;
 	bool hit_anything = false;
-	double closest_so_far = ray_t.max;
+	Real closest_so_far = ray_t.max;
 
+	/* Objects only write the hit record when they find a closer hit, so no temporary record is needed */
 	for (const auto& hittable : objects)
 	{
-		if (hittable->Hit(ray, Interval(ray_t.min, closest_so_far), temp_hrec))
+		if (hittable->Hit(ray, Interval(ray_t.min, closest_so_far), hrec))
 		{
 			hit_anything = true;
-			closest_so_far = temp_hrec.t;
-			hrec = temp_hrec;
+			closest_so_far = hrec.t;
 		}
 	}
 
@@ -567,10 +998,42 @@ bool HittableList::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
 }
 
 
-double HittableList::PDF_Value(const Point3& origin, const Vec3& direction) const
+bool HittableList::Occluded(const Ray& ray, Real t_max) const
 {
-	double inv_length = 1.0 / (double)objects.size();
-	double value = 0.0;
+	for (const auto& hittable : objects)
+	{
+		if (hittable->Occluded(ray, t_max)) return true;
+	}
+
+	return false;
+}
+
+
+bool HittableList::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	if (!IsClosed()) return Hittable::HitInterval(ray, ray_t, spans);
+
+	/* The spans of all objects are merged into their union */
+	bool hit_anything = false;
+	for (const auto& hittable : objects)
+	{
+		if (hittable->HitInterval(ray, ray_t, spans)) hit_anything = true;
+	}
+
+	return hit_anything;
+}
+
+
+bool HittableList::IsClosed() const
+{
+	return std::all_of(objects.begin(), objects.end(), [](const std::shared_ptr<Hittable>& object) { return object->IsClosed(); });
+}
+
+
+Real HittableList::PDF_Value(const Point3& origin, const Vec3& direction) const
+{
+	Real inv_length = 1.0 / (Real)objects.size();
+	Real value = 0.0;
 
 	for (const auto& object : objects)
 	{
@@ -593,39 +1056,14 @@ Vec3 HittableList::Random(const Point3& origin) const
 /* ============================= */
 
 /* === Boxes (cubes) === */
-std::shared_ptr<rt::HittableList> Box(const Point3& a, const Point3& b, std::shared_ptr<Material> material)
+std::shared_ptr<OrientedBox> Box(const Point3& a, const Point3& b, MaterialHandle material)
 {
-	auto sides = std::make_shared<HittableList>();
-
-	auto min = Point3(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z));
-	auto max = Point3(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z));
-
-	auto dx = Vec3(max.x - min.x, 0.0, 0.0);
-	auto dy = Vec3(0.0, max.y - min.y, 0.0);
-	auto dz = Vec3(0.0, 0.0, max.z - min.z);
-
-	sides->Add(std::make_shared<Parallelogram>(Point3(min.x, min.y, max.z),  dx,  dy, material));
-	sides->Add(std::make_shared<Parallelogram>(Point3(max.x, min.y, max.z), -dz,  dy, material));
-	sides->Add(std::make_shared<Parallelogram>(Point3(max.x, min.y, min.z), -dx,  dy, material));
-	sides->Add(std::make_shared<Parallelogram>(Point3(min.x, min.y, min.z),  dz,  dy, material));
-	sides->Add(std::make_shared<Parallelogram>(Point3(min.x, max.y, max.z),  dx, -dz, material));
-	sides->Add(std::make_shared<Parallelogram>(Point3(min.x, min.y, min.z),  dx,  dz, material));
-
-	return sides;
+	return MakeShared<OrientedBox>(a, b, material);
 }
 
-std::shared_ptr<rt::HittableList> Box(const Transform& t_transform, std::shared_ptr<Material> material)
+std::shared_ptr<OrientedBox> Box(const Transform& t_transform, MaterialHandle material)
 {
-	auto sides = std::make_shared<HittableList>();
-
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(0.0, 0.0, 0.5))), material)); /* top */
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(0.0, 0.0, -0.5)) * glm::rotate(Pi, Vec3(1.0, 0.0, 0.0))), material)); /* bottom */
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(0.0, -0.5, 0.0)) * glm::rotate(Pi / 2.0, Vec3(1.0, 0.0, 0.0))), material)); /* left */
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(0.0, 0.5, 0.0)) * glm::rotate(-Pi / 2.0, Vec3(1.0, 0.0, 0.0))), material)); /* right */
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(-0.5, 0.0, 0.0)) * glm::rotate(-Pi / 2.0, Vec3(0.0, 1.0, 0.0))), material)); /* back */
-	sides->Add(std::make_shared<Parallelogram>(Transform(t_transform.model_to_world * glm::translate(Vec3(0.5, 0.0, 0.0)) * glm::rotate(Pi / 2.0, Vec3(0.0, 1.0, 0.0))), material)); /* front */
-
-	return sides;
+	return MakeShared<OrientedBox>(t_transform, material);
 }
 
 /* === Triangle Meshes === */
@@ -636,7 +1074,7 @@ std::string AbsPath(std::string rel_path)
 	return absPath;
 }
 
-HittableList LoadMesh(const Transform& t_transform, const std::string& filepath, std::shared_ptr<Material> material)
+HittableList LoadMesh(const Transform& t_transform, const std::string& filepath, MaterialHandle material)
 {
 	/* Store mesh as a hittable list */
 	HittableList hittable_mesh;
@@ -663,10 +1101,87 @@ HittableList LoadMesh(const Transform& t_transform, const std::string& filepath,
 		auto v0 = mesh.Vertices[mesh.Indices[i + 0]];
 		auto v1 = mesh.Vertices[mesh.Indices[i + 1]];
 		auto v2 = mesh.Vertices[mesh.Indices[i + 2]];
-		hittable_mesh.Add(std::make_shared<Triangle>(t_transform, v0, v1, v2, material));
+		hittable_mesh.Add(MakeShared<Triangle>(t_transform, v0, v1, v2, material));
 	}
 
 	return hittable_mesh;
 }
 
+/* Hashes the position, normal and texture coordinates of an objl vertex */
+class VertexKeyHash
+{
+public:
+	size_t operator()(const std::array<float, 8>& key) const
+	{
+		size_t hash = 0;
+		for (float f : key) hash = hash * 31 + std::hash<float>()(f);
+		return hash;
+	}
+};
+
+std::shared_ptr<Mesh> LoadIndexedMesh(const Transform& t_transform, const std::string& filepath, MaterialHandle material, const BVH_BuildParams& params)
+{
+	std::vector<Vec3f> positions;
+	std::vector<Vec3f> normals;
+	std::vector<Vec2f> uvs;
+	std::vector<std::uint32_t> indices;
+
+	objl::Loader loader;
+	bool loadout = loader.LoadFile(AbsPath("../RayTracer/res/meshes/" + filepath));
+	if (!loadout)
+	{
+		std::cout << "[rt::LoadIndexedMesh] ERROR! Failed to load mesh file '" << filepath << "'" << std::endl;
+		return MakeShared<Mesh>(t_transform, positions, normals, uvs, indices, material, params);
+	}
+
+	if (loader.LoadedMeshes.size() > 1)
+	{
+		std::cout << "[rt::LoadIndexedMesh] WARNING: More than 1 mesh found in file '" << filepath << "'. Loading only the first mesh!" << std::endl;
+	}
+
+	const objl::Mesh& mesh = loader.LoadedMeshes[0];
+
+	/* objl generates a normal per face for files without vertex normals, which would keep the corners of
+	neighboring faces apart. Flat shaded meshes (equal normals at all corners of each face) use the face normal instead */
+	bool flat_normals = true;
+	for (size_t i = 0; i + 2 < mesh.Indices.size() && flat_normals; i += 3)
+	{
+		const objl::Vector3& normal = mesh.Vertices[mesh.Indices[i]].Normal;
+		flat_normals = mesh.Vertices[mesh.Indices[i + 1]].Normal == normal && mesh.Vertices[mesh.Indices[i + 2]].Normal == normal;
+	}
+
+	/* objl emits a separate vertex for every face corner, so identical vertices are merged into shared ones */
+	std::unordered_map<std::array<float, 8>, std::uint32_t, VertexKeyHash> vertex_indices;
+	bool has_normals = false;
+	bool has_uvs = false;
+	indices.reserve(mesh.Indices.size());
+
+	for (unsigned int index : mesh.Indices)
+	{
+		const objl::Vertex& vertex = mesh.Vertices[index];
+		std::array<float, 8> key = {
+			vertex.Position.X, vertex.Position.Y, vertex.Position.Z,
+			flat_normals ? 0.0f : vertex.Normal.X, flat_normals ? 0.0f : vertex.Normal.Y, flat_normals ? 0.0f : vertex.Normal.Z,
+			vertex.TextureCoordinate.X, vertex.TextureCoordinate.Y
+		};
+
+		auto [it, inserted] = vertex_indices.try_emplace(key, (std::uint32_t)positions.size());
+		if (inserted)
+		{
+			positions.push_back(Vec3f(key[0], key[1], key[2]));
+			normals.push_back(Vec3f(key[3], key[4], key[5]));
+			uvs.push_back(Vec2f(key[6], key[7]));
+			has_normals |= normals.back() != Vec3f(0.0f);
+			has_uvs |= uvs.back() != Vec2f(0.0f);
+		}
+		indices.push_back(it->second);
+	}
+
+	/* Files without normals or texture coordinates do not need to store them */
+	if (!has_normals) normals = std::vector<Vec3f>();
+	if (!has_uvs) uvs = std::vector<Vec2f>();
+
+	return MakeShared<Mesh>(t_transform, std::move(positions), std::move(normals), std::move(uvs), std::move(indices), material, params);
+}
+
 } /* namespace rt */
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <filesystem>
 
+#include "arena.h"
 #include "hit_record.h"
 #include "aabb.h"
 #include "texture.h"
@@ -16,17 +17,81 @@ class Hittable
 public:
 	virtual ~Hittable() = default;
 
-	/* Handle ray-object interaction */
+	/* Handle ray-object intersection. Primitives only record the hit here (see HitRecord::Set),
+	the surface interaction of the closest hit is computed afterwards with Interaction */
 	virtual bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const = 0;
 
+	/* Compute the surface interaction for a hit recorded by this object, where `ray` is the ray (in the space of
+	this object's parent) it was hit with. Aggregates never record themselves as the hit object so they keep the default */
+	virtual void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const {}
+
+	/* Returns true if the ray hits anything at a distance in (RayEps, t_max), e.g., for shadow rays. Unlike Hit, this
+	may stop at the first intersection found and skips all surface interaction work. By default it falls back to Hit. */
+	virtual bool Occluded(const Ray& ray, Real t_max) const
+	{
+		HitRecord hrec;
+		return Hit(ray, Interval(RayEps, t_max), hrec);
+	}
+
+	/* Add the parts of ray_t in which the ray is inside this object to `spans`, for objects that are closed
+	(e.g., the boundary of a volume). Returns false if there are none. By default the spans are found by pairing
+	alternating entry and exit Hits along the whole ray; closed primitives and aggregates of them override it to
+	find all of their spans in a single query. */
+	virtual bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+	{
+		/* Start behind the ray origin, in case it starts inside */
+		bool hit = false;
+		Real t = -Inf;
+		for (int i = 0; i < HitSpans::max_spans; i++)
+		{
+			HitRecord entry, exit;
+			if (!Hit(ray, Interval(t, Inf), entry)) break;
+			if (!Hit(ray, Interval(entry.t + RayEps, Inf), exit)) break;
+
+			Interval span = Interval(std::fmax(entry.t, ray_t.min), std::fmin(exit.t, ray_t.max));
+			if (span.min < span.max)
+			{
+				spans.Add(span);
+				hit = true;
+			}
+
+			if (exit.t >= ray_t.max) break;
+			t = exit.t + RayEps;
+		}
+
+		return hit;
+	}
+
+	/* Returns true if this object encloses a volume by itself, so that its HitInterval spans are exact on their own.
+	Aggregates only merge the spans of their children if all of them are closed. Open surfaces (e.g., the faces of a
+	mesh) only bound a volume together, so the aggregate pairs entry and exit Hits over all of them instead. */
+	virtual bool IsClosed() const
+	{
+		return false;
+	}
+
 	/* Return this object's axis aligned bounding box in world space coordinates */
 	inline AABB BoundingBox() const { return bounding_box; }
 
+	/* Move the object by replacing its transform and recomputing its bounding box, after which any BVH containing
+	the object must be refit (see BVH_Node::Refit) or rebuilt. Lists and BVHs store their objects in world space and
+	cannot be moved as a whole (see WorldSpaceTransform), an Instance of them can. */
+	virtual void SetTransform(const Transform& t_transform) = 0;
+
+
+	/* Split the part of this object inside `box` at the plane where the coordinate along `axis` equals
+	`position`, returning the world space bounds of both halves. Spatial split BVH builds use this to
+	clip primitive references. By default only the bounding box itself is split. */
+	virtual void SplitBoundingBox(const AABB& box, int axis, Real position, AABB& left, AABB& right) const
+	{
+		bounding_box.Intersection(box).Split(axis, position, left, right);
+	}
+
 
 	/* Functions for importance sampling of the hittable (useful for emissive objects) */
 
 	/* Determine the value of the PDF for a given origin and direction in world space */
-	virtual double PDF_Value(const Point3& origin, const Vec3& direction) const
+	virtual Real PDF_Value(const Point3& origin, const Vec3& direction) const
 	{
 		return 0.0;
 	}
@@ -44,6 +109,10 @@ public:
 protected:
 	/* The axis aligned bounding box which tightly encloses the world space dimensions of the object */
 	AABB bounding_box;
+
+protected:
+	/* SetTransform of objects in world space: warns and leaves the object where it is */
+	void WorldSpaceTransform(const char* name) const;
 };
 
 
@@ -52,35 +121,48 @@ class Sphere : public Hittable
 {
 public:
 	/* Manually set the transform when generating a sphere */
-	Sphere(const Transform& t_transform, std::shared_ptr<Material> material);
+	Sphere(const Transform& t_transform, MaterialHandle material);
 
 	/* Set transform and motion_vector */
-	Sphere(const Transform& t_transform, const Vec3& motion_vector, std::shared_ptr<Material> material);
+	Sphere(const Transform& t_transform, const Vec3& motion_vector, MaterialHandle material);
 
 	/* Standard sphere generation with center and radius. This sets up the initial transforms for you */
-	Sphere(const Vec3& center, double radius, std::shared_ptr<Material> material);
+	Sphere(const Vec3& center, Real radius, MaterialHandle material);
 
 	/* For motion blur spheres, provide a start and stopping position and radius */
-	Sphere(const Point3& start, const Point3& stop, double radius, std::shared_ptr<Material> material);
+	Sphere(const Point3& start, const Point3& stop, Real radius, MaterialHandle material);
 
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
 
-	double PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	bool IsClosed() const override { return true; }
+
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
 
 	Vec3 Random(const Point3& origin) const override;
 
+	void SetTransform(const Transform& t_transform) override;
+
+	/* Set the UV coordinates of the sphere based on the hit point on a sphere of radius 1 centered at the origin */
+	static void GetSphereUV(const Point3& p, Real& u, Real& v);
+
 private:
-	std::shared_ptr<Material> material;
+	MaterialHandle material;
 	Vec3 motion_vector;
 
 private:
-	static Vec3 RandomToSphere(double radius_squared, double distance_squared);
+	/* Find the nearest intersection in ray_t of a model space ray with the sphere at the provided (model space) center */
+	static bool Intersect(const Ray& model_ray, const Point3& center, Interval ray_t, Real& t);
 
-	/* Return the center of the sphere (in model space) at time t */
-	Point3 SphereCenter(double time) const;
+	static Vec3 RandomToSphere(Real radius_squared, Real distance_squared);
 
-	/* Set the UV coordinates of the sphere based on the hit point on a sphere of radius 1 */
-	static void GetSphereUV(const Point3& p, double& u, double& v);
+	/* Return the center of the sphere (in model space) at time t */
+	Point3 SphereCenter(Real time) const;
 
 	void SetBoundingBox();
 };
@@ -91,54 +173,111 @@ class Parallelogram : public Hittable
 {
 public:
 	/* Construct a parallelogram using an origin Q and two vectors u, v that define its sides */
-	Parallelogram(const Point3& Q, const Vec3& u, const Vec3& v, std::shared_ptr<Material> material);
+	Parallelogram(const Point3& Q, const Vec3& u, const Vec3& v, MaterialHandle material);
 
 	/* Construct a unit quad centered at the origin with normal along +z transformed by the given transform */
-	Parallelogram(const Transform& t_transform, std::shared_ptr<Material> material);
+	Parallelogram(const Transform& t_transform, MaterialHandle material);
 
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
 
-	double PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
 	Vec3 Random(const Point3& origin) const override;
 
+	void SplitBoundingBox(const AABB& box, int axis, Real position, AABB& left, AABB& right) const override;
+
+	void SetTransform(const Transform& t_transform) override;
 
 private:
-	Point3 Q;
-	Vec3 u, v, w;
-	std::shared_ptr<Material> material;
-	Vec3 normal;
-	double D;
-	double area;
+	Point3 Q; /* Model space origin and sides */
+	Vec3 u, v;
+	Vec3 normal; /* Model space unit normal */
+	MaterialHandle material;
+
+	/* The parallelogram is static, so its plane is baked into world space (see Bake) and
+	rays are intersected without transforming them */
+	Point3 world_Q;
+	Vec3 world_u, world_v, world_w;
+	Vec3 world_normal;
+	Real world_D;
+	Real area; /* world space area */
 
 private:
-	/* Given the hit point in plane coordinates, return false if it is outside the primitive.
-	Otherwise, set the UV coordinates of the hit and return true. */
-	bool IsInterior(double a, double b, HitRecord& hrec) const;
+	/* Given the hit point in plane coordinates, return false if it is outside the primitive */
+	bool IsInterior(Real a, Real b) const;
 
-	/* Compute the bounding box encapsulating all four vertices */
-	void SetBoundingBox();
+	/* Find the intersection in ray_t of a world space ray with the parallelogram and its plane coordinates */
+	bool Intersect(const Ray& ray, Interval ray_t, Real& t, Real& alpha, Real& beta) const;
+
+	/* Transform the model space origin and sides by the current transform and precompute the world space
+	plane, area and bounding box. Called whenever the transform changes. */
+	void Bake();
 };
 
 
 /* Forward declaration */
 namespace objl { struct Vertex; }
 
+/* Moller-Trumbore intersection of a ray with the triangle spanned by vertex v0p and the edge vectors e01 and e02.
+Returns true if the ray hits it in ray_t, along with the hit distance and the barycentric coordinates of the hit */
+inline bool IntersectTriangle(const Ray& ray, const Point3& v0p, const Vec3& e01, const Vec3& e02, Interval ray_t, Real& t, Real& u, Real& v)
+{
+	/* https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm */
+
+	Vec3 ray_cross_e02 = glm::cross(ray.direction, e02);
+	Real det = glm::dot(e01, ray_cross_e02);
+
+	/* No hit if the ray is parallel to the triangle */
+	if (std::fabs(det) < Eps) return false;
+
+	/* Is the ray within the bounds of the triangle? */
+	Real inv_det = 1.0 / det;
+	Vec3 s = ray.origin - v0p;
+	u = inv_det * glm::dot(s, ray_cross_e02);
+	if (u < 0.0 || u > 1.0) return false;
+
+	Vec3 s_cross_e01 = glm::cross(s, e01);
+	v = inv_det * glm::dot(ray.direction, s_cross_e01);
+	if (v < 0.0 || u + v > 1.0) return false;
+
+	/* The ray is within the triangle, test the intersection point */
+	t = inv_det * glm::dot(e02, s_cross_e01);
+	return ray_t.Surrounds(t);
+}
+
 class Triangle : public Hittable
 {
 public:
 	/* Construct a triangle (in model space!) using the positions of its three vertices.
 	The normal is computed from the triangle vertices. */
-	Triangle(const Transform& t_transform, const Point3& v0p, const Point3& v1p, const Point3& v2p, std::shared_ptr<Material> material);
+	Triangle(const Transform& t_transform, const Point3& v0p, const Point3& v1p, const Point3& v2p, MaterialHandle material);
 
 	/* Construct a triangle using the vertices provided by objl */
-	Triangle(const Transform& t_transform, const objl::Vertex& v0, const objl::Vertex& v1, const objl::Vertex& v2, std::shared_ptr<Material> material);
+	Triangle(const Transform& t_transform, const objl::Vertex& v0, const objl::Vertex& v1, const objl::Vertex& v2, MaterialHandle material);
 
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
 
-	double PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
 
 	Vec3 Random(const Point3& origin) const override;
 
+	void SplitBoundingBox(const AABB& box, int axis, Real position, AABB& left, AABB& right) const override;
+
+	void SetTransform(const Transform& t_transform) override;
+
+	/* Move the vertices (in model space) of a deforming mesh. The vertex normals are reset to the face normal */
+	void SetVertices(const Point3& new_v0p, const Point3& new_v1p, const Point3& new_v2p);
+
+	/* Move the vertices (in model space) of a deforming mesh, providing new vertex normals */
+	void SetVertices(const Point3& new_v0p, const Point3& new_v1p, const Point3& new_v2p, const Vec3& new_v0n, const Vec3& new_v1n, const Vec3& new_v2n);
+
 private:
 	Point3 v0p; /* Vertex 0 position */
 	Point3 v1p; /* Vertex 1 position */
@@ -146,33 +285,125 @@ private:
 	Vec3 v0n; /* Vertex 0 normal */
 	Vec3 v1n; /* Vertex 1 normal */
 	Vec3 v2n; /* Vertex 2 normal */
-	Vec3 e01; /* Vector from v0p to v1p */
-	Vec3 e02; /* Vector from v0p to v2p */
-	std::shared_ptr<Material> material;
-	double area; /* world space area */
+	MaterialHandle material;
+
+	/* The model space vertices above are baked into world space (see Bake) so that
+	rays are intersected without transforming them */
+	Point3 world_v0p;
+	Vec3 world_e01; /* Vector from world_v0p to the world space vertex 1 */
+	Vec3 world_e02; /* Vector from world_v0p to the world space vertex 2 */
+	Vec3 world_normal; /* Unit length world space face normal */
+	Real area; /* world space area */
 
 private:
-	void SetBoundingBox();
-	void ComputeArea();
+	/* Transform the model space vertices by the current transform and precompute the world space
+	edges, face normal, area and bounding box. Called whenever the transform or vertices change. */
+	void Bake();
 
-	/* Computes the interpolated normal vector for the triangle using the provided barycentric coordinates */
-	Vec3 ComputeInterpolatedNormal(double u, double v) const;
+	/* Find the intersection in ray_t of a world space ray with the triangle and its barycentric coordinates */
+	bool Intersect(const Ray& ray, Interval ray_t, Real& t, Real& u, Real& v) const;
+
+	/* Computes the interpolated model space normal vector for the triangle using the provided barycentric coordinates */
+	Vec3 ComputeInterpolatedNormal(Real u, Real v) const;
 };
 
 
+/* A box (cuboid) given by a transformed unit cube centered at the origin. Unlike a list of six Parallelograms,
+the ray is transformed into box space once and intersected with all faces in a single slab test. */
+class OrientedBox : public Hittable
+{
+public:
+	/* The unit cube [-0.5, 0.5]^3 under the provided transform */
+	OrientedBox(const Transform& t_transform, MaterialHandle material);
+
+	/* An axis aligned box with the two provided opposite vertices 'a' and 'b' */
+	OrientedBox(const Point3& a, const Point3& b, MaterialHandle material);
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	bool IsClosed() const override { return true; }
+
+	/* Note: like a list of the six faces, a face is picked uniformly and then a point uniformly on it */
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	Vec3 Random(const Point3& origin) const override;
+
+	void SetTransform(const Transform& t_transform) override;
+
+	/* Find the distances along the (world space) ray at which it enters and exits the box, which may be negative
+	if the ray starts inside or past the box. Returns false if the ray misses the box. The faces that are crossed
+	are returned as face indices (2 * axis, plus 1 for the positive side) if requested. */
+	bool Span(const Ray& ray, Real& t_enter, Real& t_exit, int* enter_face = nullptr, int* exit_face = nullptr) const;
+
+private:
+	MaterialHandle material;
+	Real face_area[3]; /* World space areas of the two faces perpendicular to each model axis */
+
+private:
+	/* Slab test of a model space ray against the unit cube */
+	static bool IntersectUnitCube(const Ray& model_ray, Real& t_enter, Real& t_exit, int& enter_face, int& exit_face);
+
+	/* Returns the model space outward normal of a face */
+	static Vec3 FaceNormal(int face);
+
+	/* Recompute the face areas and bounding box after the transform changed */
+	void Bake();
+};
+
 
 class ConstantMedium : public Hittable
 {
 public:
-	ConstantMedium(std::shared_ptr<Hittable> boundary, double density, std::shared_ptr<Texture> texture);
-	ConstantMedium(std::shared_ptr<Hittable> boundary, double density, const Color& albedo);
+	/* The phase function is typically an Isotropic material */
+	ConstantMedium(std::shared_ptr<Hittable> boundary, Real density, MaterialHandle phase_function);
 
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
 
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	/* Move the boundary, and the medium with it */
+	void SetTransform(const Transform& t_transform) override;
+
 private:
 	std::shared_ptr<Hittable> boundary;
-	double neg_inv_density;
-	std::shared_ptr<Material> phase_function;
+	Real neg_inv_density;
+	MaterialHandle phase_function;
+
+private:
+	void SetBoundingBox();
+};
+
+
+
+/* Places a shared object (typically a model space BVH over a mesh, the bottom level of a two level
+hierarchy) in the world with its own transform. Any number of instances can reference one object
+without copying its geometry. The ray is transformed once per instance rather than per primitive. */
+class Instance : public Hittable
+{
+public:
+	Instance(const Transform& t_transform, std::shared_ptr<Hittable> object);
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	bool IsClosed() const override { return object->IsClosed(); }
+
+	/* Note: the PDF is exact for rigid transforms with uniform scaling */
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	Vec3 Random(const Point3& origin) const override;
+
+	void SetTransform(const Transform& t_transform) override;
+
+private:
+	std::shared_ptr<Hittable> object;
 
 private:
 	void SetBoundingBox();
@@ -193,9 +424,21 @@ public:
 
 	void Add(std::shared_ptr<Hittable> hittable);
 
+	/* Recompute the bounding box after objects of the list were moved */
+	void UpdateBoundingBox();
+
 	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
 
-	double PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	/* True if all objects are closed */
+	bool IsClosed() const override;
+
+	void SetTransform(const Transform& t_transform) override { WorldSpaceTransform("HittableList"); }
+
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
 	Vec3 Random(const Point3& origin) const override;
 };
 
@@ -203,12 +446,16 @@ public:
 /* Compound shapes */
 
 /* Returns a 3D box that contains the two provided opposite vertices 'a' and 'b' */
-std::shared_ptr<HittableList> Box(const Point3& a, const Point3& b, std::shared_ptr<Material> material);
+std::shared_ptr<OrientedBox> Box(const Point3& a, const Point3& b, MaterialHandle material);
 
 /* Returns a unit cube centered at the origin with the provided material transformed with the provided transform. */
-std::shared_ptr<HittableList> Box(const Transform& t_transform, std::shared_ptr<Material> material);
+std::shared_ptr<OrientedBox> Box(const Transform& t_transform, MaterialHandle material);
+
+/* Split the part of a convex world space polygon inside `box` at an axis aligned plane
+and return the bounds of both halves (used by the spatial split BVH builder) */
+void SplitPolygonBounds(const Point3* vertices, int count, const AABB& box, int axis, Real position, AABB& left, AABB& right);
 
-/* Load a triangle mesh */
-HittableList LoadMesh(const Transform& t_transform, const std::string& filepath, std::shared_ptr<Material> material);
+/* Load a triangle mesh as a list of separate triangles (see LoadIndexedMesh in mesh.h for a compact alternative) */
+HittableList LoadMesh(const Transform& t_transform, const std::string& filepath, MaterialHandle material);
 
 } /* namespace rt */
\ No newline at end of file
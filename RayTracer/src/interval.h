@@ -8,7 +8,7 @@ class Interval
 public:
 	Interval() : min(+Inf), max(-Inf) {} /* Default interval is empty */
 
-	Interval(double min, double max) : min(min), max(max) {}
+	Interval(Real min, Real max) : min(min), max(max) {}
 
 	Interval(const Interval& a, const Interval& b)
 	{
@@ -17,25 +17,25 @@ public:
 		max = a.max >= b.max ? a.max : b.max;
 	}
 
-	double Size() const { return max - min; }
-	bool Contains(double x) const { return min <= x && x <= max; }
-	bool Surrounds(double x) const { return min < x && x < max; }
+	Real Size() const { return max - min; }
+	bool Contains(Real x) const { return min <= x && x <= max; }
+	bool Surrounds(Real x) const { return min < x && x < max; }
 	
-	double Clamp(double x) const 
+	Real Clamp(Real x) const 
 	{
 		if (x < min) return min;
 		if (x > max) return max;
 		return x;
 	}
 
-	Interval Expand(double delta)
+	Interval Expand(Real delta)
 	{
-		double padding = delta / 2.0;
+		Real padding = delta / 2.0;
 		return Interval(min - padding, max + padding);
 	}
 
 public:
-	double min, max;
+	Real min, max;
 	//static const Interval empty;
 	//static const Interval universe;
 };
@@ -0,0 +1,228 @@
+#include "linear_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+namespace rt
+{
+/* ====================== */
+/* ====== BVH Node ====== */
+/* ====================== */
+
+void LinearBVH_Node::SetBounds(const AABB& box)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& ax = box.AxisInterval(axis);
+
+		float lo = (float)ax.min;
+		float hi = (float)ax.max;
+		if ((double)lo > ax.min) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+		if ((double)hi < ax.max) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+
+		bounds_min[axis] = lo;
+		bounds_max[axis] = hi;
+	}
+}
+
+
+AABB LinearBVH_Node::Bounds() const
+{
+	return AABB(Interval(bounds_min[0], bounds_max[0]), Interval(bounds_min[1], bounds_max[1]), Interval(bounds_min[2], bounds_max[2]));
+}
+
+
+BVH_BuildParams LinearBVH_LeafParams(const BVH_BuildParams& params)
+{
+	BVH_BuildParams leaf_params = params;
+	leaf_params.max_leaf_size = std::min(leaf_params.max_leaf_size, LinearBVH_Node::max_prim_count);
+	return leaf_params;
+}
+
+
+std::vector<LinearBVH_Node> FlattenBVH(const BVH_BuildTree& tree)
+{
+	std::vector<LinearBVH_Node> nodes;
+	if (tree.nodes.empty()) return nodes;
+	nodes.reserve(tree.nodes.size());
+
+	/* Depth first walk: left children are emitted directly after their parent,
+	right children are patched in once their position is known */
+	std::vector<std::pair<unsigned int, std::uint32_t>> stack; /* (build node, parent linear node or UINT32_MAX) */
+	stack.push_back({ 0, UINT32_MAX });
+
+	while (!stack.empty())
+	{
+		auto [build_index, parent] = stack.back();
+		stack.pop_back();
+
+		const BVH_BuildNode& build_node = tree.nodes[build_index];
+		std::uint32_t linear_index = (std::uint32_t)nodes.size();
+		if (parent != UINT32_MAX) nodes[parent].offset = linear_index;
+
+		LinearBVH_Node node;
+		node.SetBounds(build_node.bounds);
+		node.axis = (std::uint8_t)build_node.axis;
+		node.pad = 0;
+
+		if (build_node.IsLeaf())
+		{
+			assert(build_node.prim_count <= LinearBVH_Node::max_prim_count);
+			node.offset = build_node.first_prim;
+			node.prim_count = (std::uint16_t)build_node.prim_count;
+			nodes.push_back(node);
+			continue;
+		}
+
+		node.offset = 0;
+		node.prim_count = 0;
+		nodes.push_back(node);
+
+		/* Push the right child first so the left child is emitted next */
+		stack.push_back({ build_node.right, linear_index });
+		stack.push_back({ build_node.left, UINT32_MAX });
+	}
+
+	return nodes;
+}
+
+
+/* ======================== */
+/* ====== Linear BVH ====== */
+/* ======================== */
+
+LinearBVH::LinearBVH(const HittableList& list, const BVH_BuildParams& params)
+	: primitives(list.objects)
+{
+	for (const auto& primitive : primitives) bounding_box = AABB(bounding_box, primitive->BoundingBox());
+	closed = list.IsClosed();
+	Build(params);
+}
+
+
+void LinearBVH::Build(const BVH_BuildParams& params)
+{
+	BVH_BuildParams build_params = LinearBVH_LeafParams(params);
+
+	BVH_BuildTree tree = BuildHittableTree(primitives, build_params);
+	sah_cost = tree.SAH_Cost(build_params);
+	built_sah_cost = sah_cost;
+
+	primitive_indices.assign(tree.prim_indices.begin(), tree.prim_indices.end());
+	nodes = FlattenBVH(tree);
+}
+
+
+bool LinearBVH::Refit(const BVH_BuildParams& params)
+{
+	if (nodes.empty()) return false;
+
+	bounding_box = RefitNode(0, BVH_RefitThreadDepth(primitives.size(), params));
+	sah_cost = ComputeSAH_Cost(params);
+
+	if (params.refit_rebuild_threshold <= 0.0 || sah_cost <= params.refit_rebuild_threshold * built_sah_cost) return false;
+
+	Build(params);
+	return true;
+}
+
+
+AABB LinearBVH::RefitNode(std::uint32_t index, int thread_depth)
+{
+	LinearBVH_Node& node = nodes[index];
+
+	AABB bounds;
+	if (node.IsLeaf())
+	{
+		for (std::uint32_t i = node.offset; i < node.offset + node.prim_count; i++)
+		{
+			bounds = AABB(bounds, primitives[primitive_indices[i]]->BoundingBox());
+		}
+	}
+	else if (thread_depth > 0)
+	{
+		AABB left_bounds;
+		std::thread worker([&]() { left_bounds = RefitNode(index + 1, thread_depth - 1); });
+		AABB right_bounds = RefitNode(node.offset, thread_depth - 1);
+		worker.join();
+		bounds = AABB(left_bounds, right_bounds);
+	}
+	else
+	{
+		bounds = AABB(RefitNode(index + 1, 0), RefitNode(node.offset, 0));
+	}
+
+	node.SetBounds(bounds);
+	return bounds;
+}
+
+
+double LinearBVH::ComputeSAH_Cost(const BVH_BuildParams& params) const
+{
+	/* Children are stored after their parents, so a reverse sweep visits children first */
+	std::vector<double> cost(nodes.size());
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		const LinearBVH_Node& node = nodes[i];
+		if (node.IsLeaf())
+		{
+			cost[i] = SAH_LeafCost(node.prim_count, params);
+			continue;
+		}
+
+		cost[i] = params.traversal_cost + (nodes[i + 1].Bounds().SurfaceArea() * cost[i + 1]
+				+ nodes[node.offset].Bounds().SurfaceArea() * cost[node.offset]) / node.Bounds().SurfaceArea();
+	}
+
+	return cost[0];
+}
+
+
+bool LinearBVH::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	return TraverseLinearBVH(nodes, ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		bool hit = false;
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->Hit(ray, t, hrec))
+			{
+				hit = true;
+				t.max = hrec.t;
+			}
+		}
+		return hit;
+		});
+}
+
+
+bool LinearBVH::Occluded(const Ray& ray, Real t_max) const
+{
+	return TraverseLinearBVH<true>(nodes, ray, Interval(RayEps, t_max), [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->Occluded(ray, t.max)) return true;
+		}
+		return false;
+		});
+}
+
+
+bool LinearBVH::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	if (!closed) return Hittable::HitInterval(ray, ray_t, spans);
+
+	bool hit = false;
+	TraverseLinearBVH(nodes, ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->HitInterval(ray, t, spans)) hit = true;
+		}
+		return false; /* Keep the full interval to find all spans */
+		});
+
+	return hit;
+}
+
+} /* namespace rt */
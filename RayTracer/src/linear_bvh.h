@@ -0,0 +1,163 @@
+#pragma once
+
+#include "common.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_builder.h"
+
+#include <cstdint>
+
+namespace rt
+{
+
+/* A compact (32 byte) node of a flattened BVH. Nodes are stored depth first so the left
+child of an interior node immediately follows it in the node array. */
+class LinearBVH_Node
+{
+public:
+	float bounds_min[3]; /* Bounds are rounded outwards to float so they stay conservative */
+	float bounds_max[3];
+	std::uint32_t offset; /* Leaves: first entry in the primitive index array. Interior: index of the right child */
+	std::uint16_t prim_count; /* 0 for interior nodes */
+	std::uint8_t axis; /* Split axis, used to visit the nearer child first */
+	std::uint8_t pad;
+
+	static const size_t max_prim_count = UINT16_MAX; /* Largest leaf, see LinearBVH_LeafParams */
+
+public:
+	bool IsLeaf() const { return prim_count > 0; }
+
+	/* Store the provided bounds, rounding outwards */
+	void SetBounds(const AABB& box);
+
+	/* Returns the node bounds as an AABB */
+	AABB Bounds() const;
+
+	/* Slab test against a ray given its origin and the reciprocal of its direction */
+	inline bool Hit(const Point3& origin, const Vec3& inv_direction, Real t_min, Real t_max) const
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			Real t0 = (bounds_min[axis] - origin[axis]) * inv_direction[axis];
+			Real t1 = (bounds_max[axis] - origin[axis]) * inv_direction[axis];
+			if (inv_direction[axis] < 0.0) std::swap(t0, t1);
+
+			/* Note: comparisons with NaN (from 0 * Inf) are false, keeping the test conservative */
+			if (t0 > t_min) t_min = t0;
+			if (t1 < t_max) t_max = t1;
+			if (t_max < t_min) return false;
+		}
+		return true;
+	}
+};
+
+static_assert(sizeof(LinearBVH_Node) == 32, "LinearBVH_Node should stay 32 bytes");
+
+
+/* Returns the build parameters with max_leaf_size limited to what a LinearBVH_Node leaf can count */
+BVH_BuildParams LinearBVH_LeafParams(const BVH_BuildParams& params);
+
+/* Flatten a build tree into depth first ordered linear nodes. The leaves of the tree must not hold more than
+LinearBVH_Node::max_prim_count primitives (true for trees built with LinearBVH_LeafParams) */
+std::vector<LinearBVH_Node> FlattenBVH(const BVH_BuildTree& tree);
+
+
+/* Iterative traversal of a flattened BVH. `intersect_leaf(first, count, ray_t)` is called for each
+leaf the ray reaches; it should return true on a hit and shrink ray_t.max to the hit distance.
+Any hit traversals (for occlusion queries) return as soon as a leaf reports a hit. */
+template <bool any_hit = false, typename LeafFn>
+bool TraverseLinearBVH(const std::vector<LinearBVH_Node>& nodes, const Ray& ray, Interval ray_t, LeafFn intersect_leaf)
+{
+	if (nodes.empty()) return false;
+
+	const Vec3 inv_direction = 1.0 / ray.direction;
+	const bool direction_is_negative[3] = { inv_direction.x < 0.0, inv_direction.y < 0.0, inv_direction.z < 0.0 };
+
+	std::uint32_t stack[BVH_Builder::max_depth];
+	int stack_size = 0;
+	std::uint32_t current = 0;
+	bool hit_anything = false;
+
+	while (true)
+	{
+		const LinearBVH_Node& node = nodes[current];
+
+		if (node.Hit(ray.origin, inv_direction, ray_t.min, ray_t.max))
+		{
+			if (node.IsLeaf())
+			{
+				if (intersect_leaf(node.offset, node.prim_count, ray_t))
+				{
+					if constexpr (any_hit) return true;
+					hit_anything = true;
+				}
+			}
+			else
+			{
+				/* Visit the nearer child first and defer the other one */
+				if (direction_is_negative[node.axis])
+				{
+					stack[stack_size++] = current + 1;
+					current = node.offset;
+				}
+				else
+				{
+					stack[stack_size++] = node.offset;
+					current = current + 1;
+				}
+				continue;
+			}
+		}
+
+		if (stack_size == 0) break;
+		current = stack[--stack_size];
+	}
+
+	return hit_anything;
+}
+
+
+/* A BVH stored as a contiguous node array with a separate primitive index array, traversed without recursion */
+class LinearBVH : public Hittable
+{
+public:
+	LinearBVH(const HittableList& list, const BVH_BuildParams& params = BVH_BuildParams());
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	/* True if all primitives are closed */
+	bool IsClosed() const override { return closed; }
+
+	void SetTransform(const Transform& t_transform) override { WorldSpaceTransform("LinearBVH"); }
+
+	/* Returns the expected cost of a ray query as estimated by the surface area heuristic */
+	double SAH_Cost() const { return sah_cost; }
+
+	size_t NodeCount() const { return nodes.size(); }
+
+	/* Refit the BVH (see BVH_BuildParams::refit_rebuild_threshold) */
+	bool Refit(const BVH_BuildParams& params = BVH_BuildParams());
+
+private:
+	std::vector<std::shared_ptr<Hittable>> primitives;
+	bool closed = false;
+	std::vector<std::uint32_t> primitive_indices; /* Leaves reference ranges of this array */
+	std::vector<LinearBVH_Node> nodes;
+	double sah_cost = 0.0;
+	double built_sah_cost = 0.0;
+
+private:
+	void Build(const BVH_BuildParams& params);
+
+	/* Refit the subtree rooted at `index` and return its bounds. The subtrees `thread_depth` levels further down are refit on separate threads */
+	AABB RefitNode(std::uint32_t index, int thread_depth);
+
+	/* Returns the SAH cost of the tree from the current node bounds */
+	double ComputeSAH_Cost(const BVH_BuildParams& params) const;
+};
+
+} /* namespace rt */
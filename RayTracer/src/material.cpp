@@ -8,19 +8,19 @@ namespace rt
 /* ====== Lambertian ====== */
 /* ======================== */
 
-bool Lambertian::Scatter(const Ray& ray_in, const HitRecord& hrec, ScatterRecord& srec) const
+bool Lambertian::Scatter(const Ray& ray_in, const SurfaceInteraction& interaction, const TextureTable& textures, ScatterRecord& srec) const
 {
-	srec.attenuation = texture->Value(hrec.u, hrec.v, hrec.posn);
-	srec.pdf_ptr = std::make_shared<CosinePDF>(hrec.transform.GetWorldNormal(hrec.normal));
+	srec.attenuation = textures[texture].Value(interaction.u, interaction.v, interaction.posn, textures);
+	srec.pdf = CosinePDF(interaction.transform.GetWorldNormal(interaction.normal));
 	srec.skip_pdf = false;
 	return true;
 }
 
 
-double Lambertian::ScatteringPDF(const Ray& ray_in, const HitRecord& hrec, const Ray& ray_out) const
+Real Lambertian::ScatteringPDF(const Ray& ray_in, const SurfaceInteraction& interaction, const Ray& ray_out) const
 {
-	Vec3 world_normal = glm::normalize(hrec.transform.GetWorldNormal(hrec.normal));
-	double cosine = glm::dot(world_normal, glm::normalize(ray_out.direction));
+	Vec3 world_normal = glm::normalize(interaction.transform.GetWorldNormal(interaction.normal));
+	Real cosine = glm::dot(world_normal, glm::normalize(ray_out.direction));
 	return cosine < 0.0 ? 0.0 : cosine / Pi;
 }
 
@@ -28,18 +28,17 @@ double Lambertian::ScatteringPDF(const Ray& ray_in, const HitRecord& hrec, const
 /* ====== Metal ====== */
 /* =================== */
 
-bool Metal::Scatter(const Ray& ray_in, const HitRecord& hrec, ScatterRecord& srec) const
+bool Metal::Scatter(const Ray& ray_in, const SurfaceInteraction& interaction, const TextureTable& textures, ScatterRecord& srec) const
 {
-	Ray model_ray = hrec.transform.WorldToModel(ray_in);
+	Ray model_ray = interaction.transform.WorldToModel(ray_in);
 	
-	Vec3 reflected = Reflect(model_ray.direction, hrec.normal);
+	Vec3 reflected = Reflect(model_ray.direction, interaction.normal);
 	reflected = glm::normalize(reflected);
 	if (roughness > 0.0) reflected += roughness * RandomUnitVector();
 	
 	srec.attenuation = albedo;
-	srec.pdf_ptr = nullptr;
 	srec.skip_pdf = true;
-	srec.skip_pdf_ray = hrec.transform.ModelToWorld(Ray(hrec.posn + Eps * hrec.normal, reflected, ray_in.time));
+	srec.skip_pdf_ray = interaction.transform.ModelToWorld(Ray(interaction.posn + RayEps * interaction.normal, reflected, ray_in.time));
 		
 	return true;
 }
@@ -48,33 +47,32 @@ bool Metal::Scatter(const Ray& ray_in, const HitRecord& hrec, ScatterRecord& sre
 /* ====== Dielectric ====== */
 /* ======================== */
 
-bool Dielectric::Scatter(const Ray& ray_in, const HitRecord& hrec, ScatterRecord& srec) const
+bool Dielectric::Scatter(const Ray& ray_in, const SurfaceInteraction& interaction, const TextureTable& textures, ScatterRecord& srec) const
 {
 	srec.attenuation = Color(1.0, 1.0, 1.0);
-	srec.pdf_ptr = nullptr;
 	srec.skip_pdf = true;
 
-	double eta_in_over_out = eta_in / eta_out;
-	double refraction_index = hrec.front_face ? (1.0 / eta_in_over_out) : eta_in_over_out;
+	Real eta_in_over_out = eta_in / eta_out;
+	Real refraction_index = interaction.front_face ? (1.0 / eta_in_over_out) : eta_in_over_out;
 
-	Ray model_ray = hrec.transform.WorldToModel(ray_in);
+	Ray model_ray = interaction.transform.WorldToModel(ray_in);
 	Vec3 unit_direction = glm::normalize(model_ray.direction);
-	double cos_theta = std::fmin(glm::dot(-unit_direction, hrec.normal), 1.0);
-	double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+	Real cos_theta = std::fmin(glm::dot(-unit_direction, interaction.normal), 1.0);
+	Real sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
 
 	bool cannot_refract = refraction_index * sin_theta > 1.0;
 	Vec3 direction;
 
-	if (cannot_refract || Reflectance(cos_theta, refraction_index) > RandomDouble()) direction = Reflect(unit_direction, hrec.normal);
-	else direction = Refract(unit_direction, hrec.normal, refraction_index);
+	if (cannot_refract || Reflectance(cos_theta, refraction_index) > RandomDouble()) direction = Reflect(unit_direction, interaction.normal);
+	else direction = Refract(unit_direction, interaction.normal, refraction_index);
 
-	srec.skip_pdf_ray = hrec.transform.ModelToWorld(Ray(hrec.posn + Eps * direction, direction, ray_in.time));
+	srec.skip_pdf_ray = interaction.transform.ModelToWorld(Ray(interaction.posn + RayEps * direction, direction, ray_in.time));
 	return true;
 }
 
-double Dielectric::Reflectance(double cosine, double refraction_index)
+Real Dielectric::Reflectance(Real cosine, Real refraction_index)
 {
-	double r0 = (1.0 - refraction_index) / (1.0 + refraction_index);
+	Real r0 = (1.0 - refraction_index) / (1.0 + refraction_index);
 	r0 = r0 * r0;
 	return r0 + (1.0 - r0) * std::pow((1.0 - cosine), 5.0);
 }
@@ -84,16 +82,16 @@ double Dielectric::Reflectance(double cosine, double refraction_index)
 /* ====== Isotropic ====== */
 /* ======================= */
 
-bool Isotropic::Scatter(const Ray& ray_in, const HitRecord& hrec, ScatterRecord& srec) const
+bool Isotropic::Scatter(const Ray& ray_in, const SurfaceInteraction& interaction, const TextureTable& textures, ScatterRecord& srec) const
 {
-	srec.attenuation = texture->Value(hrec.u, hrec.v, hrec.posn);
-	srec.pdf_ptr = std::make_shared<SpherePDF>();
+	srec.attenuation = textures[texture].Value(interaction.u, interaction.v, interaction.posn, textures);
+	srec.pdf = SpherePDF();
 	srec.skip_pdf = false;
 	return true;
 }
 
 
-double Isotropic::ScatteringPDF(const Ray& ray_in, const HitRecord& hrec, const Ray& ray_out) const
+Real Isotropic::ScatteringPDF(const Ray& ray_in, const SurfaceInteraction& interaction, const Ray& ray_out) const
 {
 	return 1.0 / (4.0 * Pi);
 }
@@ -102,10 +100,10 @@ double Isotropic::ScatteringPDF(const Ray& ray_in, const HitRecord& hrec, const
 /* ====== Diffuse Light ====== */
 /* =========================== */
 
-Color DiffuseLight::Emitted(const Ray& ray_in, const HitRecord& hrec) const
+Color DiffuseLight::Emitted(const Ray& ray_in, const SurfaceInteraction& interaction, const TextureTable& textures) const
 {
-	if (!hrec.front_face) return Color(0.0, 0.0, 0.0); /* No light emitted from back face of light sources */
-	return texture->Value(hrec.u, hrec.v, hrec.posn);
+	if (!interaction.front_face) return Color(0.0, 0.0, 0.0); /* No light emitted from back face of light sources */
+	return textures[texture].Value(interaction.u, interaction.v, interaction.posn, textures);
 }
 
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 
 #include "common.h"
 
+#include <type_traits>
+
 /* Custom wrapper over glm */
 
 namespace rt
@@ -16,13 +18,50 @@ namespace rt
 /* === Accessor redefinitions === */
 /* ============================== */
 
-using Vec2 = glm::dvec2;
-using Point2 = glm::dvec2;
-using Vec3 = glm::dvec3;
-using Point3 = glm::dvec3;
-using Color = glm::dvec3;
-using Vec4 = glm::dvec4;
-using Mat4 = glm::dmat4;
+/* All of these use the Real scalar type (see common.h) */
+using Vec2 = glm::vec<2, Real>;
+using Point2 = glm::vec<2, Real>;
+using Vec3 = glm::vec<3, Real>;
+using Point3 = glm::vec<3, Real>;
+using Color = glm::vec<3, Real>;
+using Vec4 = glm::vec<4, Real>;
+using Mat3 = glm::mat<3, 3, Real>;
+using Mat4 = glm::mat<4, 4, Real>;
+
+/* Single precision vectors for compact storage (e.g., mesh vertex buffers) */
+using Vec2f = glm::vec2;
+using Vec3f = glm::vec3;
+
+
+/* ====================================== */
+/* === Mixed scalar-vector arithmetic === */
+/* ====================================== */
+
+/* glm only combines vectors with scalars of their own type. These overloads convert other scalars (e.g., double
+literals and constants in a float build) to the vector's scalar type, so the same code compiles for either Real */
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator*(S s, const glm::vec<L, T, Q>& v) { return T(s) * v; }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator*(const glm::vec<L, T, Q>& v, S s) { return v * T(s); }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator/(S s, const glm::vec<L, T, Q>& v) { return T(s) / v; }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator/(const glm::vec<L, T, Q>& v, S s) { return v / T(s); }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator+(S s, const glm::vec<L, T, Q>& v) { return T(s) + v; }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator+(const glm::vec<L, T, Q>& v, S s) { return v + T(s); }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator-(S s, const glm::vec<L, T, Q>& v) { return T(s) - v; }
+
+template <typename S, glm::length_t L, typename T, glm::qualifier Q> requires (std::is_arithmetic_v<S> && !std::is_same_v<S, T>)
+inline glm::vec<L, T, Q> operator-(const glm::vec<L, T, Q>& v, S s) { return v - T(s); }
 
 
 /* =============================== */
@@ -39,7 +78,7 @@ public:
 		BuildFromW(normal);
 	}
 
-	Vec3 Local(double a, double b, double c) const
+	Vec3 Local(Real a, Real b, Real c) const
 	{
 		return a * u + b * v + c * w;
 	}
@@ -82,7 +121,7 @@ inline bool Equal(T u, T v)
 template <typename T>
 inline bool NearZero(T v)
 {
-	return glm::all(glm::epsilonEqual(v, T(0.0), Eps));
+	return glm::all(glm::epsilonEqual(v, T(0.0), (typename T::value_type)Eps));
 }
 
 /* Generates a Vec3 with all components between 0.0 and 1.0 */
@@ -136,13 +175,13 @@ inline Vec3 RandomOnHemisphere(const Vec3& normal)
 /* Generate a cosine weighted random direction along +z */
 inline Vec3 RandomCosineDirection()
 {
-	double r1 = RandomDouble();
-	double r2 = RandomDouble();
+	Real r1 = RandomDouble();
+	Real r2 = RandomDouble();
 
-	double phi = 2.0 * Pi * r1;
-	double x = std::cos(phi) * std::sqrt(r2);
-	double y = std::sin(phi) * std::sqrt(r2);
-	double z = std::sqrt(1 - r2);
+	Real phi = 2.0 * Pi * r1;
+	Real x = std::cos(phi) * std::sqrt(r2);
+	Real y = std::sin(phi) * std::sqrt(r2);
+	Real z = std::sqrt(1 - r2);
 
 	return Vec3(x, y, z);
 }
@@ -173,9 +212,9 @@ inline Vec3 Reflect(const Vec3& v, const Vec3& n)
 }
 
 /* Refract the (Vec3) incident ray direction along the provided normal using the provided index of refraction ratio */
-inline Vec3 Refract(const Vec3& incident_dir, const Vec3& normal, double eta_in_over_out)
+inline Vec3 Refract(const Vec3& incident_dir, const Vec3& normal, Real eta_in_over_out)
 {
-	double cos_theta = std::fmin(glm::dot(-incident_dir, normal), 1.0);
+	Real cos_theta = std::fmin(glm::dot(-incident_dir, normal), 1.0);
 	Vec3 r_out_perp = eta_in_over_out * (incident_dir + cos_theta * normal);
 	Vec3 r_out_parallel = -std::sqrt(std::fabs(1.0 - glm::length2(r_out_perp))) * normal;
 	return r_out_perp + r_out_parallel;
@@ -0,0 +1,267 @@
+#include "mesh.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <memory_resource>
+
+namespace rt
+{
+/* ================== */
+/* ====== Mesh ====== */
+/* ================== */
+
+Mesh::Mesh(const Transform& t_transform, std::vector<Vec3f> positions, std::vector<Vec3f> normals, std::vector<Vec2f> uvs,
+	std::vector<std::uint32_t> indices, MaterialHandle material, const BVH_BuildParams& params)
+	: positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)), indices(std::move(indices)), material(material), layout(params.layout)
+{
+	transform = t_transform;
+
+	if (!this->normals.empty() && this->normals.size() != this->positions.size())
+	{
+		std::cout << "[rt::Mesh] WARNING: The number of vertex normals does not match the number of positions. Using face normals!" << std::endl;
+		this->normals.clear();
+	}
+
+	if (!this->uvs.empty() && this->uvs.size() != this->positions.size())
+	{
+		std::cout << "[rt::Mesh] WARNING: The number of texture coordinates does not match the number of positions. Ignoring them!" << std::endl;
+		this->uvs.clear();
+	}
+
+	this->indices.resize(this->indices.size() - this->indices.size() % 3);
+
+	Build(params);
+	SetBoundingBox();
+}
+
+
+void Mesh::Build(const BVH_BuildParams& params)
+{
+	/* The BVH is built over the model space triangles, so rays are transformed once per mesh */
+	std::vector<BVH_BuildPrimitive> build_prims(TriangleCount());
+	for (std::uint32_t i = 0; i < (std::uint32_t)build_prims.size(); i++)
+	{
+		Point3 p0 = Position(i, 0), p1 = Position(i, 1), p2 = Position(i, 2);
+		build_prims[i] = BVH_BuildPrimitive(AABB(AABB(p0, p1), AABB(p0, p2)), i);
+	}
+
+	BVH_SplitFunction split = [this](unsigned int index, const AABB& box, int axis, Real position, AABB& left, AABB& right) {
+		Point3 vertices[3] = { Position(index, 0), Position(index, 1), Position(index, 2) };
+		SplitPolygonBounds(vertices, 3, box, axis, position, left, right);
+	};
+
+	BVH_BuildTree tree = BVH_Builder(LinearBVH_LeafParams(params), split).Build(std::move(build_prims));
+	triangle_indices.assign(tree.prim_indices.begin(), tree.prim_indices.end());
+
+	if (layout == LayoutWide4) wide4_nodes = CollapseBVH<4>(tree);
+	else if (layout == LayoutWide8) wide8_nodes = CollapseBVH<8>(tree);
+	else linear_nodes = FlattenBVH(tree);
+}
+
+
+void Mesh::SetBoundingBox()
+{
+	/* Enclose the transformed vertices (tighter than transforming the model space bounds) */
+	bounding_box = AABB();
+	for (const Vec3f& position : positions)
+	{
+		Point3 w = transform.PointModelToWorld(Point3(position));
+		bounding_box = AABB(bounding_box, AABB(w, w));
+	}
+}
+
+
+template <bool any_hit, typename LeafFn>
+bool Mesh::Traverse(const Ray& model_ray, Interval ray_t, LeafFn intersect_leaf) const
+{
+	if (layout == LayoutWide4) return TraverseWideBVH<4, any_hit>(wide4_nodes, model_ray, ray_t, intersect_leaf);
+	if (layout == LayoutWide8) return TraverseWideBVH<8, any_hit>(wide8_nodes, model_ray, ray_t, intersect_leaf);
+	return TraverseLinearBVH<any_hit>(linear_nodes, model_ray, ray_t, intersect_leaf);
+}
+
+
+bool Mesh::Intersect(std::uint32_t triangle, const Ray& model_ray, Interval ray_t, Real& t, Real& u, Real& v) const
+{
+	Point3 p0 = Position(triangle, 0);
+	return IntersectTriangle(model_ray, p0, Position(triangle, 1) - p0, Position(triangle, 2) - p0, ray_t, t, u, v);
+}
+
+
+bool Mesh::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+
+	return Traverse(model_ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		bool hit = false;
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			Real t_hit, u, v;
+			if (Intersect(triangle_indices[i], model_ray, t, t_hit, u, v))
+			{
+				hit = true;
+				t.max = t_hit;
+				hrec.Set(this, t_hit, u, v, triangle_indices[i]);
+			}
+		}
+		return hit;
+		});
+}
+
+
+void Mesh::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+	std::uint32_t triangle = hrec.prim_id;
+
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+	interaction.material = material;
+	interaction.SetFaceNormal(model_ray.direction, ShadingNormal(triangle, hrec.u, hrec.v));
+	interaction.transform = transform;
+
+	if (uvs.empty())
+	{
+		interaction.u = hrec.u;
+		interaction.v = hrec.v;
+	}
+	else
+	{
+		const std::uint32_t* tri = &indices[3 * triangle];
+		Vec2 uv = (1.0 - hrec.u - hrec.v) * Vec2(uvs[tri[0]]) + hrec.u * Vec2(uvs[tri[1]]) + hrec.v * Vec2(uvs[tri[2]]);
+		interaction.u = uv.x;
+		interaction.v = uv.y;
+	}
+}
+
+
+bool Mesh::Occluded(const Ray& ray, Real t_max) const
+{
+	Ray model_ray = transform.WorldToModel(ray);
+
+	return Traverse<true>(model_ray, Interval(RayEps, t_max), [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			Real t_hit, u, v;
+			if (Intersect(triangle_indices[i], model_ray, t, t_hit, u, v)) return true;
+		}
+		return false;
+		});
+}
+
+
+Real Mesh::PDF_Value(const Point3& origin, const Vec3& direction) const
+{
+	if (indices.empty()) return 0.0;
+
+	/* Every triangle along the direction could have been sampled, so all intersections contribute */
+	Ray model_ray = transform.WorldToModel(Ray(origin, direction));
+	Real inv_count = 1.0 / (Real)TriangleCount();
+	Real value = 0.0;
+
+	/* With spatial splits a triangle can be referenced by several leaves, so the triangles counted so far are
+	remembered to count each one once. They are kept on the stack, spilling into the current (scratch) arena or
+	the heap for rays crossing many triangles. */
+	std::uint32_t counted_buffer[64];
+	std::pmr::monotonic_buffer_resource counted_memory(counted_buffer, sizeof(counted_buffer), Arena::Current() ? Arena::Current() : std::pmr::get_default_resource());
+	std::pmr::vector<std::uint32_t> counted(&counted_memory);
+	bool shared_references = triangle_indices.size() > TriangleCount();
+
+	Traverse(model_ray, Interval(RayEps, Inf), [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			std::uint32_t triangle = triangle_indices[i];
+			Real t_hit, u, v;
+			if (!Intersect(triangle, model_ray, t, t_hit, u, v)) continue;
+
+			if (shared_references)
+			{
+				if (std::find(counted.begin(), counted.end(), triangle) != counted.end()) continue;
+				counted.push_back(triangle);
+			}
+
+			/* The density is that of the (flat) triangle, so the world space face normal is used */
+			Point3 p0 = Position(triangle, 0);
+			Vec3 world_normal = glm::normalize(transform.GetWorldNormal(glm::cross(Position(triangle, 1) - p0, Position(triangle, 2) - p0)));
+
+			Real distance_squared = t_hit * t_hit * glm::length2(direction);
+			Real cosine = std::fabs(glm::dot(direction, world_normal)) / glm::length(direction);
+			value += inv_count * distance_squared / (cosine * WorldArea(triangle));
+		}
+		return false; /* Keep the full interval to find all intersections */
+		});
+
+	return value;
+}
+
+
+Vec3 Mesh::Random(const Point3& origin) const
+{
+	if (indices.empty()) return Vec3(0.0, 0.0, 1.0);
+
+	std::uint32_t triangle = std::min((std::uint32_t)(RandomDouble() * TriangleCount()), (std::uint32_t)TriangleCount() - 1);
+
+	Point3 world_space_v0p = transform.PointModelToWorld(Position(triangle, 0));
+	Vec3 world_space_e01 = transform.VectorModelToWorld(Position(triangle, 1) - Position(triangle, 0));
+	Vec3 world_space_e02 = transform.VectorModelToWorld(Position(triangle, 2) - Position(triangle, 0));
+
+	Real r1 = RandomDouble();
+	Real r2 = RandomDouble();
+	if (r1 + r2 > 1.0)
+	{
+		r1 = 1.0 - r1;
+		r2 = 1.0 - r2;
+	}
+
+	return world_space_v0p + (r1 * world_space_e01) + (r2 * world_space_e02) - origin;
+}
+
+
+void Mesh::SetTransform(const Transform& t_transform)
+{
+	transform = t_transform;
+	SetBoundingBox();
+}
+
+
+size_t Mesh::MemoryUsage() const
+{
+	return sizeof(Mesh)
+		+ positions.capacity() * sizeof(Vec3f)
+		+ normals.capacity() * sizeof(Vec3f)
+		+ uvs.capacity() * sizeof(Vec2f)
+		+ indices.capacity() * sizeof(std::uint32_t)
+		+ triangle_indices.capacity() * sizeof(std::uint32_t)
+		+ linear_nodes.capacity() * sizeof(LinearBVH_Node)
+		+ wide4_nodes.capacity() * sizeof(WideBVH_Node<4>)
+		+ wide8_nodes.capacity() * sizeof(WideBVH_Node<8>);
+}
+
+
+Vec3 Mesh::ShadingNormal(std::uint32_t triangle, Real u, Real v) const
+{
+	const std::uint32_t* tri = &indices[3 * triangle];
+
+	/* Like Triangle, fall back to the face normal unless all three vertex normals are provided */
+	if (!normals.empty())
+	{
+		Vec3 n0 = Vec3(normals[tri[0]]), n1 = Vec3(normals[tri[1]]), n2 = Vec3(normals[tri[2]]);
+		if (!NearZero(n0) && !NearZero(n1) && !NearZero(n2))
+		{
+			return glm::normalize(n0 + u * (n1 - n0) + v * (n2 - n0));
+		}
+	}
+
+	Point3 p0 = Position(triangle, 0);
+	return glm::normalize(glm::cross(Position(triangle, 1) - p0, Position(triangle, 2) - p0));
+}
+
+
+Real Mesh::WorldArea(std::uint32_t triangle) const
+{
+	Point3 p0 = Position(triangle, 0);
+	Vec3 world_e01 = transform.VectorModelToWorld(Position(triangle, 1) - p0);
+	Vec3 world_e02 = transform.VectorModelToWorld(Position(triangle, 2) - p0);
+	return 0.5 * glm::length(glm::cross(world_e01, world_e02));
+}
+
+} /* namespace rt */
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+#include "hittable.h"
+#include "bvh_builder.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+
+#include <cstdint>
+
+namespace rt
+{
+
+/* A triangle mesh stored as shared vertex buffers: contiguous positions, normals and texture coordinates
+indexed by a triangle index buffer, with a single transform and material for the whole mesh. The mesh
+owns a model space BVH over its triangles whose leaves reference triangles by index, so a triangle costs
+a few dozen bytes rather than a heap allocated Triangle (plus its BVH reference) each. */
+class Mesh : public Hittable
+{
+public:
+	/* Construct a mesh (in model space!) from its vertex positions and three vertex indices per triangle.
+	The vertex normals and texture coordinates are optional: either empty or one per position. Without
+	normals the face normal is used and without texture coordinates the hit's uv are the barycentric
+	coordinates (as for Triangle). The triangle BVH is built with `params`, in the requested layout
+	(the binary tree layout is stored as a linear node array). */
+	Mesh(const Transform& t_transform, std::vector<Vec3f> positions, std::vector<Vec3f> normals, std::vector<Vec2f> uvs,
+		std::vector<std::uint32_t> indices, MaterialHandle material, const BVH_BuildParams& params = BVH_BuildParams());
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	/* Note: triangles are sampled uniformly, like a HittableList of Triangles */
+	Real PDF_Value(const Point3& origin, const Vec3& direction) const override;
+	Vec3 Random(const Point3& origin) const override;
+
+	void SetTransform(const Transform& t_transform) override;
+
+	size_t TriangleCount() const { return indices.size() / 3; }
+	size_t VertexCount() const { return positions.size(); }
+
+	/* Returns the number of bytes used by the mesh, including its vertex, index and BVH buffers */
+	size_t MemoryUsage() const;
+
+private:
+	std::vector<Vec3f> positions;
+	std::vector<Vec3f> normals; /* Empty if the mesh has no vertex normals */
+	std::vector<Vec2f> uvs; /* Empty if the mesh has no texture coordinates */
+	std::vector<std::uint32_t> indices; /* Three vertex indices per triangle */
+	MaterialHandle material;
+
+	BVH_Layout layout;
+	std::vector<std::uint32_t> triangle_indices; /* BVH leaves reference ranges of this array */
+	std::vector<LinearBVH_Node> linear_nodes; /* Only the nodes of the layout in use are stored */
+	std::vector<WideBVH_Node<4>> wide4_nodes;
+	std::vector<WideBVH_Node<8>> wide8_nodes;
+
+private:
+	void Build(const BVH_BuildParams& params);
+	void SetBoundingBox();
+
+	/* Model space vertex position of a corner (0, 1 or 2) of a triangle */
+	Point3 Position(std::uint32_t triangle, int corner) const { return Point3(positions[indices[3 * triangle + corner]]); }
+
+	/* Intersect a model space ray with a single triangle */
+	bool Intersect(std::uint32_t triangle, const Ray& model_ray, Interval ray_t, Real& t, Real& u, Real& v) const;
+
+	/* Returns the (unit length) model space shading normal at barycentric coordinates u, v of a triangle */
+	Vec3 ShadingNormal(std::uint32_t triangle, Real u, Real v) const;
+
+	/* Returns the world space area of a triangle */
+	Real WorldArea(std::uint32_t triangle) const;
+
+	/* Traverse the triangle BVH in its stored layout (see TraverseLinearBVH) */
+	template <bool any_hit = false, typename LeafFn>
+	bool Traverse(const Ray& model_ray, Interval ray_t, LeafFn intersect_leaf) const;
+};
+
+
+/* Load a triangle mesh with shared vertex buffers. Vertices of the file that are identical in position,
+normal and texture coordinates are merged. The mesh's BVH is built with `params` */
+std::shared_ptr<Mesh> LoadIndexedMesh(const Transform& t_transform, const std::string& filepath, MaterialHandle material, const BVH_BuildParams& params = BVH_BuildParams());
+
+} /* namespace rt */
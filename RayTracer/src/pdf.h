@@ -1,6 +1,6 @@
 #pragma once
 
-#include <vector>
+#include <variant>
 
 #include "common.h"
 #include "hittable.h"
@@ -9,35 +9,28 @@
 namespace rt
 {
 
-/* Probability Distribution Function class */
-class PDF
-{
-public:
-	virtual ~PDF() {}
-
-	virtual double Value(const Vec3& direction) const = 0;
-	virtual Vec3 Generate() const = 0;
-};
-
+/* Probability Distribution Functions over directions. Value returns the density of a direction and Generate
+samples a direction. The PDFs are small value types that are kept on the stack (see PDF_Variant) so that
+scattering does not allocate. */
 
-class SpherePDF : public PDF
+class SpherePDF
 {
 public:
 	SpherePDF() {}
 
-	double Value(const Vec3& direction) const override
+	Real Value(const Vec3& direction) const
 	{
 		return 1.0 / (4.0 * Pi);
 	}
 
-	Vec3 Generate() const override
+	Vec3 Generate() const
 	{
 		return RandomUnitVector();
 	}
 };
 
 
-class CosinePDF : public PDF
+class CosinePDF
 {
 public:
 	CosinePDF(const Vec3& w)
@@ -45,13 +38,13 @@ public:
 		onb = OrthonormalBasis(w);
 	}
 
-	double Value(const Vec3& direction) const override
+	Real Value(const Vec3& direction) const
 	{
-		double cosine_theta = glm::dot(glm::normalize(direction), onb.w);
+		Real cosine_theta = glm::dot(glm::normalize(direction), onb.w);
 		return std::fmax(0.0, cosine_theta / Pi);
 	}
 
-	Vec3 Generate() const override
+	Vec3 Generate() const
 	{
 		return onb.Local(RandomCosineDirection());
 	}
@@ -61,72 +54,99 @@ private:
 };
 
 
-class HittablePDF : public PDF 
+class HittablePDF
 {
 public:
+	/* Note: the objects are referenced, not copied, so they must outlive the PDF */
 	HittablePDF(const Hittable& objects, const Point3& origin)
-		: objects(objects), origin(origin) {}
+		: objects(&objects), origin(origin) {}
 
 
-	double Value(const Vec3& direction) const override
+	Real Value(const Vec3& direction) const
 	{
-		return objects.PDF_Value(origin, direction);
+		return objects->PDF_Value(origin, direction);
 	}
 
-	Vec3 Generate() const override
+	Vec3 Generate() const
 	{
-		return objects.Random(origin);
+		return objects->Random(origin);
 	}
 
 private:
-	const Hittable& objects;
+	const Hittable* objects;
 	Point3 origin;
 };
 
 
-class MixturePDF : public PDF
+/* One of the provided PDF types, stored by value. Calls are dispatched to the type it holds. */
+template <typename... PDFs>
+class PDF_Variant
 {
 public:
-	/* Generate a mixture PDF from two PDFs */
-	MixturePDF(std::shared_ptr<PDF> pdf0, std::shared_ptr<PDF> pdf1)
-	{
-		pdfs.push_back(pdf0);
-		pdfs.push_back(pdf1);
+	std::variant<PDFs...> variant;
 
-		length = (int)pdfs.size();
-		inv_length = 1.0 / (double)pdfs.size();
+public:
+	PDF_Variant() {}
+
+	template <typename T>
+	PDF_Variant(const T& pdf) : variant(pdf) {}
+
+	/* Convert from a variant of (a subset of) the same types */
+	template <typename... Others>
+	PDF_Variant(const PDF_Variant<Others...>& other)
+		: variant(std::visit([](const auto& pdf) { return std::variant<PDFs...>(pdf); }, other.variant)) {}
+
+
+	Real Value(const Vec3& direction) const
+	{
+		return std::visit([&direction](const auto& pdf) { return pdf.Value(direction); }, variant);
 	}
 
-	/* Generate a mixture PDF from an arbitrary length vector of PDFs */
-	MixturePDF(std::vector<std::shared_ptr<PDF>> pdfs) 
-		: pdfs(pdfs) 
+	Vec3 Generate() const
 	{
-		length = (int)pdfs.size();
-		inv_length = 1.0 / (double)pdfs.size();
+		return std::visit([](const auto& pdf) { return pdf.Generate(); }, variant);
 	}
+};
+
+/* The PDFs a material scatters with and a mixture can be made of */
+using BasicPDF = PDF_Variant<SpherePDF, CosinePDF, HittablePDF>;
+
+
+class MixturePDF
+{
+public:
+	/* Generate an equal mixture of two PDFs */
+	MixturePDF(const BasicPDF& pdf0, const BasicPDF& pdf1)
+		: pdfs{ pdf0, pdf1 } {}
 
 
-	double Value(const Vec3& direction) const override
+	Real Value(const Vec3& direction) const
 	{
-		double value = 0.0;
-		for (const auto& pdf : pdfs)
-		{
-			value += inv_length * pdf->Value(direction);
-		}
-		return value;
+		return 0.5 * pdfs[0].Value(direction) + 0.5 * pdfs[1].Value(direction);
 	}
 
-	Vec3 Generate() const override
+	Vec3 Generate() const
 	{
-		int index = (int)(RandomDouble() * length);
-		return pdfs[index]->Generate();
+		int index = (int)(RandomDouble() * 2.0);
+		return pdfs[index].Generate();
 	}
 
 private:
-	std::vector<std::shared_ptr<PDF>> pdfs;
-	int length;
-	double inv_length;
+	BasicPDF pdfs[2];
+};
+
+/* Any of the PDFs */
+using PDF = PDF_Variant<SpherePDF, CosinePDF, HittablePDF, MixturePDF>;
+
+
+class ScatterRecord
+{
+public:
+	Color attenuation;
+	BasicPDF pdf;
+	bool skip_pdf;
+	Ray skip_pdf_ray;
 };
 
 
-} /* namespace rt */
\ No newline at end of file
+} /* namespace rt */
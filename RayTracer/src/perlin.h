@@ -31,7 +31,7 @@ public:
 		delete[] perm_z;
 	}
 
-	double Noise(const Point3& p) const
+	Real Noise(const Point3& p) const
 	{
 		/* Get the fractional component */
 		auto u = p.x - std::floor(p.x);
@@ -58,11 +58,11 @@ public:
 		return PerlinInterpolate(c, u, v, w); /* Note: this can return negative values! */
 	}
 
-	double Turbulence(const Point3& p, int depth) const
+	Real Turbulence(const Point3& p, int depth) const
 	{
-		double accumulator = 0.0;
+		Real accumulator = 0.0;
 		Point3 temp_p = p;
-		double weight = 1.0;
+		Real weight = 1.0;
 
 		for (int i = 0; i < depth; i++)
 		{
@@ -109,14 +109,14 @@ private:
 		}
 	}
 
-	static double PerlinInterpolate(Vec3 c[2][2][2], double u, double v, double w)
+	static Real PerlinInterpolate(Vec3 c[2][2][2], Real u, Real v, Real w)
 	{
 		/* Hermitian smoothing */
-		double uu = u * u * (3 - 2 * u);
-		double vv = v * v * (3 - 2 * v);
-		double ww = w * w * (3 - 2 * w);
+		Real uu = u * u * (3 - 2 * u);
+		Real vv = v * v * (3 - 2 * v);
+		Real ww = w * w * (3 - 2 * w);
 
-		double accumulator = 0.0;
+		Real accumulator = 0.0;
 
 		for (int i = 0; i < 2; i++)
 		{
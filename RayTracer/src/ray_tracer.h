@@ -8,7 +8,14 @@
 #include "hittable.h"
 #include "material.h"
 #include "bvh.h"
+#include "mesh.h"
+#include "sphere_set.h"
 #include "utils.h"
+#include "benchmark.h"
+#include "simd.h"
+
+#include <chrono>
+#include <thread>
 
 /* This header file is what provides the interface for the ray tracer to other programs. */
 
@@ -21,6 +28,12 @@ std::vector<unsigned char> RayTrace(Scene* scene, Camera* camera)
 	return Render(*scene, *camera);
 }
 
+/* Pass in the scene and render with this camera for about `time_budget` seconds (see RenderProgressive) */
+std::vector<unsigned char> RayTraceProgressive(Scene* scene, Camera* camera, double time_budget, const RenderParams& params = RenderParams())
+{
+	return RenderProgressive(*scene, *camera, time_budget, params);
+}
+
 enum Scenes
 {
 	BasicMaterials,
@@ -32,80 +45,91 @@ enum Scenes
 	CornellBox,
 	Showcase0,
 	TriangleMesh,
+	InstancedMeshes,
 };
 
-/* Generate one of the default scenes */
-Scene GenerateScene(Scenes scene)
+/* Generate one of the default scenes. All BVHs in the scene are constructed with the provided build parameters.
+The objects, BVH nodes, materials and textures of the scene are allocated from an arena owned by the scene
+and freed all at once with it, unless `use_arena` is false (then they are allocated from the heap). */
+Scene GenerateScene(Scenes scene, const BVH_BuildParams& bvh_params = BVH_BuildParams(), bool use_arena = true)
 {
+	std::unique_ptr<Arena> arena = use_arena ? std::make_unique<Arena>() : nullptr;
+	ArenaScope arena_scope(arena.get());
+
 	HittableList world;
 	HittableList lights;
-	Texture* sky = new SolidColor(0.7, 0.8, 1.0);
+	MaterialTable materials;
+	TextureTable textures;
+	TextureHandle sky = AddSolidColor(textures, Color(0.7, 0.8, 1.0));
 
 	switch (scene)
 	{
 
 	case BasicMaterials:
 	{
-		sky = new ImageTexture("overcast_soil_puresky_4k.hdr");
+		sky = textures.Add<ImageTexture>("overcast_soil_puresky_4k.hdr");
 
 		/* Ground plane with checker texture */
-		auto checker_texture = std::make_shared<CheckerTexture>(2.5, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+		auto checker_texture = AddChecker(textures, 2.5, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
 		Transform tg;
 		tg.Scale(100.0);
-		world.Add(std::make_shared<Parallelogram>(tg, std::make_shared<Lambertian>(checker_texture)));
-		//world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, std::make_shared<Lambertian>(checker_texture)));
+		world.Add(MakeShared<Parallelogram>(tg, materials.Add<Lambertian>(checker_texture)));
+		//world.Add(MakeShared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, materials.Add<Lambertian>(checker_texture)));
 
 		/* Add in some custom larger spheres */
-		auto material1 = std::make_shared<Lambertian>(std::make_shared<TurbulenceTexture>(4.0));
+		auto material1 = materials.Add<Lambertian>(textures.Add<TurbulenceTexture>(4.0));
 		Transform t1;
 		t1.Translate(0.0, -6.0, 2.0);
 		t1.Rotate(45.0, Vec3(0.0, 0.0, 1.0));
 		t1.Scale(2.0, 4.0, 2.0);
-		world.Add(std::make_shared<Sphere>(t1, material1));
+		world.Add(MakeShared<Sphere>(t1, material1));
 
-		auto material2 = std::make_shared<Dielectric>(1.5);
+		auto material2 = materials.Add<Dielectric>(1.5);
 		Transform t2;
 		t2.Translate(0.0, 0.0, 4.0);
 		t2.Scale(3.0, 2.0, 3.0);
-		world.Add(std::make_shared<Sphere>(t2, material2));
+		world.Add(MakeShared<Sphere>(t2, material2));
 
-		auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+		auto material3 = materials.Add<Metal>(Color(0.7, 0.6, 0.5), 0.0);
 		Transform t3;
 		t3.Translate(0.0, 5.0, 4.0);
 		t3.Rotate(35.0, Vec3(0.0, 1.0, 1.0));
 		t3.Scale(4.0, 2.0, 4.0);
-		world.Add(std::make_shared<Sphere>(t3, material3));
+		world.Add(MakeShared<Sphere>(t3, material3));
 
-		//auto light = std::make_shared<DiffuseLight>(Color(10.0));
-		//auto s4 = std::make_shared<Sphere>(light);
+		//auto light = materials.Add<DiffuseLight>(AddSolidColor(textures, Color(10.0)));
+		//auto s4 = MakeShared<Sphere>(light);
 		//s4->transform.Translate(0.0, 0.0, 12.0);
 		//s4->transform.Scale(3.0, 3.0, 1.0);
 		//world.Add(s4);
 
-		auto material4 = std::make_shared<Metal>(Color(0.5, 0.6, 0.7), 0.0001);
+		auto material4 = materials.Add<Metal>(Color(0.5, 0.6, 0.7), 0.0001);
 		Transform t4;
 		t4.Translate(-10.0, 0.0, 5.0);
 		t4.Rotate(90.0, Vec3(0.0, 1.0, 0.0));
 		t4.Scale(10.0, 20.0, 1.0);
-		world.Add(std::make_shared<Parallelogram>(t4, material4));
+		world.Add(MakeShared<Parallelogram>(t4, material4));
 
 		Transform t5;
 		t5.Translate(0.0, -5.0, 8.0);
 		t5.Rotate(45.0, Vec3(0.0, 1.0, 1.0));
 		t5.Scale(4.0);
-		world.Add(std::make_shared<ConstantMedium>(std::make_shared<HittableList>(Box(t5, material3)), 0.1, Color(0.0)));
+		world.Add(MakeShared<ConstantMedium>(Box(t5, material3), 0.1, materials.Add<Isotropic>(AddSolidColor(textures, Color(0.0)))));
 
 		Transform t6;
-		world.Add(std::make_shared<Triangle>(t6, Point3(0.0, -1.0, 1.0), Point3(0.0, 1.0, 1.0), Point3(1.0, 0.0, 1.0), material4));
+		world.Add(MakeShared<Triangle>(t6, Point3(0.0, -1.0, 1.0), Point3(0.0, 1.0, 1.0), Point3(1.0, 0.0, 1.0), material4));
 
 		break;
 	}
 
 	case ScatteredSpheres:
 	{
+		/* All spheres are collected into a single SphereSet */
+		std::vector<SphereSetEntry> spheres;
+
 		/* Ground sphere */
-		auto material_ground = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, material_ground));
+		auto material_ground = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.5, 0.5, 0.5)));
+		spheres.emplace_back(Point3(0.0, 0.0, -1000.0), 1000.0, material_ground);
 
 		/* Add some random spheres */
 		for (int a = -11; a < 11; a++)
@@ -121,13 +145,13 @@ Scene GenerateScene(Scenes scene)
 					&& glm::length(center - Point3(0.0, 0.0, 1.0)) > 1.2 
 					&& glm::length(center - Point3(-4.0, 0.0, 1.0)) > 1.2)
 				{
-					std::shared_ptr<Material> sphere_material;
+					MaterialHandle sphere_material;
 
 					if (choose_mat < 0.6)
 					{
 						/* Diffuse */
 						Color albedo = RandomVec3() * RandomVec3();
-						sphere_material = std::make_shared<Lambertian>(albedo);
+						sphere_material = materials.Add<Lambertian>(AddSolidColor(textures, albedo));
 
 					}
 					else if (choose_mat < 0.95)
@@ -135,37 +159,42 @@ Scene GenerateScene(Scenes scene)
 						/* Metal */
 						Color albedo = RandomVec3(0.5, 1.0);
 						double fuzz = RandomDouble(0, 0.5);
-						sphere_material = std::make_shared<Metal>(albedo, fuzz);
+						sphere_material = materials.Add<Metal>(albedo, fuzz);
 					}
 					else
 					{
 						/* Glass */
-						sphere_material = std::make_shared<Dielectric>(1.5);
+						sphere_material = materials.Add<Dielectric>(1.5);
 					}
 
-					world.Add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+					spheres.emplace_back(center, 0.2, sphere_material);
 				}
 			}
 		}
 
 		/* Add in some custom larger spheres */
-		auto material1 = std::make_shared<Dielectric>(1.5);
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, 1.0), 1.0, material1));
+		auto material1 = materials.Add<Dielectric>(1.5);
+		spheres.emplace_back(Point3(0.0, 0.0, 1.0), 1.0, material1);
 
-		auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-		world.Add(std::make_shared<Sphere>(Point3(-4.0, 0.0, 1.0), 1.0, material2));
+		auto material2 = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.4, 0.2, 0.1)));
+		spheres.emplace_back(Point3(-4.0, 0.0, 1.0), 1.0, material2);
 
-		auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-		world.Add(std::make_shared<Sphere>(Point3(4.0, 0.0, 1.0), 1.0, material3));
+		auto material3 = materials.Add<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+		spheres.emplace_back(Point3(4.0, 0.0, 1.0), 1.0, material3);
+
+		world.Add(MakeShared<SphereSet>(spheres, bvh_params));
 
 		break;
 	}
 
 	case BouncingSpheres:
 	{
+		/* All spheres are collected into a single SphereSet */
+		std::vector<SphereSetEntry> spheres;
+
 		/* Ground sphere with checker texture */
-		auto checker_texture = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, std::make_shared<Lambertian>(checker_texture)));
+		auto checker_texture = AddChecker(textures, 0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+		spheres.emplace_back(Point3(0.0, 0.0, -1000.0), 1000.0, materials.Add<Lambertian>(checker_texture));
 
 		/* Add some random spheres */
 		for (int a = -11; a < 11; a++)
@@ -181,13 +210,13 @@ Scene GenerateScene(Scenes scene)
 					&& glm::length(center - Point3(0.0, 0.0, 1.0)) > 1.2
 					&& glm::length(center - Point3(-4.0, 0.0, 1.0)) > 1.2)
 				{
-					std::shared_ptr<Material> sphere_material;
+					MaterialHandle sphere_material;
 
 					if (choose_mat < 0.6)
 					{
 						/* Diffuse */
 						Color albedo = RandomVec3() * RandomVec3();
-						sphere_material = std::make_shared<Lambertian>(albedo);
+						sphere_material = materials.Add<Lambertian>(AddSolidColor(textures, albedo));
 
 					}
 					else if (choose_mat < 0.9)
@@ -195,59 +224,61 @@ Scene GenerateScene(Scenes scene)
 						/* Metal */
 						Color albedo = RandomVec3(0.5, 1.0);
 						double fuzz = RandomDouble(0, 0.5);
-						sphere_material = std::make_shared<Metal>(albedo, fuzz);
+						sphere_material = materials.Add<Metal>(albedo, fuzz);
 					}
 					else
 					{
 						/* Glass */
-						sphere_material = std::make_shared<Dielectric>(1.5);
+						sphere_material = materials.Add<Dielectric>(1.5);
 					}
 
-					world.Add(std::make_shared<Sphere>(
+					spheres.emplace_back(
 						center,
 						choose_bounce < 0.3 ? center + Vec3(0.0, 0.0, RandomDouble(0.0, 2.0)) : center,
 						0.2,
-						sphere_material)
+						sphere_material
 					);
 				}
 			}
 		}
 
 		/* Add in some custom larger spheres */
-		auto material1 = std::make_shared<Dielectric>(1.5);
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, 1.0), 1.0, material1));
+		auto material1 = materials.Add<Dielectric>(1.5);
+		spheres.emplace_back(Point3(0.0, 0.0, 1.0), 1.0, material1);
 
-		auto earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
-		auto earth_surface = std::make_shared<Lambertian>(earth_texture);
-		world.Add(std::make_shared<Sphere>(Point3(-4.0, 0.0, 1.0), 1.0, earth_surface));
+		auto earth_texture = textures.Add<ImageTexture>("earthmap.jpg");
+		auto earth_surface = materials.Add<Lambertian>(earth_texture);
+		spheres.emplace_back(Point3(-4.0, 0.0, 1.0), 1.0, earth_surface);
 
-		auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-		world.Add(std::make_shared<Sphere>(Point3(4.0, 0.0, 1.0), 1.0, material3));
+		auto material3 = materials.Add<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+		spheres.emplace_back(Point3(4.0, 0.0, 1.0), 1.0, material3);
+
+		world.Add(MakeShared<SphereSet>(spheres, bvh_params));
 
 		break;
 	}
 
 	case Earth:
 	{
-		auto earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
-		auto earth_surface = std::make_shared<Lambertian>(earth_texture);
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, 0.0), 2.0, earth_surface));
+		auto earth_texture = textures.Add<ImageTexture>("earthmap.jpg");
+		auto earth_surface = materials.Add<Lambertian>(earth_texture);
+		world.Add(MakeShared<Sphere>(Point3(0.0, 0.0, 0.0), 2.0, earth_surface));
 		break;
 	}
 
 	case PerlinSpheres:
 	{
-		auto perlin_texture = std::make_shared<PerlinTexture>(4.0);
-		auto turbulence_texture = std::make_shared<TurbulenceTexture>(4.0);
-		auto marble_texture = std::make_shared<MarbleTexture>(4.0);
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, std::make_shared<Lambertian>(perlin_texture)));
-		world.Add(std::make_shared<Sphere>(Point3(4.0, 4.0, 2.0), 2.0,std::make_shared<Lambertian>(turbulence_texture)));
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, 2.0), 2.0, std::make_shared<Lambertian>(marble_texture)));
+		auto perlin_texture = textures.Add<PerlinTexture>(4.0);
+		auto turbulence_texture = textures.Add<TurbulenceTexture>(4.0);
+		auto marble_texture = textures.Add<MarbleTexture>(4.0);
+		world.Add(MakeShared<Sphere>(Point3(0.0, 0.0, -1000.0), 1000.0, materials.Add<Lambertian>(perlin_texture)));
+		world.Add(MakeShared<Sphere>(Point3(4.0, 4.0, 2.0), 2.0,materials.Add<Lambertian>(turbulence_texture)));
+		world.Add(MakeShared<Sphere>(Point3(0.0, 0.0, 2.0), 2.0, materials.Add<Lambertian>(marble_texture)));
 
-		auto diffuse_light = std::make_shared<DiffuseLight>(Color(10.0, 10.0, 10.0));
-		world.Add(std::make_shared<Sphere>(Point3(0.0, 0.0, 8.0), 2.0, diffuse_light));
+		auto diffuse_light = materials.Add<DiffuseLight>(AddSolidColor(textures, Color(10.0, 10.0, 10.0)));
+		world.Add(MakeShared<Sphere>(Point3(0.0, 0.0, 8.0), 2.0, diffuse_light));
 
-		sky = new ImageTexture("overcast_soil_puresky_4k.hdr");
+		sky = textures.Add<ImageTexture>("overcast_soil_puresky_4k.hdr");
 
 		break;
 	}
@@ -255,18 +286,18 @@ Scene GenerateScene(Scenes scene)
 	case Parallelograms:
 	{
 		/* Materials */ 
-		auto left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
-		auto back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
-		auto right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
-		auto upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
-		auto lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
+		auto left_red = materials.Add<Lambertian>(AddSolidColor(textures, Color(1.0, 0.2, 0.2)));
+		auto back_green = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.2, 1.0, 0.2)));
+		auto right_blue = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.2, 0.2, 1.0)));
+		auto upper_orange = materials.Add<Lambertian>(AddSolidColor(textures, Color(1.0, 0.5, 0.0)));
+		auto lower_teal = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.2, 0.8, 0.8)));
 
 		/* Parallelograms */
-		world.Add(std::make_shared<Parallelogram>(Point3(-3.0, -2.0, 5.0), Vec3(0.0, 0.0, -4.0), Vec3(0.0, 4.0, 0.0), left_red));
-		world.Add(std::make_shared<Parallelogram>(Point3(-2.0, -2.0, 0.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 4.0, 0.0), back_green));
-		world.Add(std::make_shared<Parallelogram>(Point3(3.0, -2.0, 1.0), Vec3(0.0, 0.0, 4.0), Vec3(0.0, 4.0, 0.0), right_blue));
-		world.Add(std::make_shared<Parallelogram>(Point3(-2.0, 3.0, 1.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 0.0, 4.0), upper_orange));
-		world.Add(std::make_shared<Parallelogram>(Point3(-2.0, -3.0, 5.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 0.0, -4.0), lower_teal));
+		world.Add(MakeShared<Parallelogram>(Point3(-3.0, -2.0, 5.0), Vec3(0.0, 0.0, -4.0), Vec3(0.0, 4.0, 0.0), left_red));
+		world.Add(MakeShared<Parallelogram>(Point3(-2.0, -2.0, 0.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 4.0, 0.0), back_green));
+		world.Add(MakeShared<Parallelogram>(Point3(3.0, -2.0, 1.0), Vec3(0.0, 0.0, 4.0), Vec3(0.0, 4.0, 0.0), right_blue));
+		world.Add(MakeShared<Parallelogram>(Point3(-2.0, 3.0, 1.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 0.0, 4.0), upper_orange));
+		world.Add(MakeShared<Parallelogram>(Point3(-2.0, -3.0, 5.0), Vec3(4.0, 0.0, 0.0), Vec3(0.0, 0.0, -4.0), lower_teal));
 
 		break;
 	}
@@ -274,53 +305,53 @@ Scene GenerateScene(Scenes scene)
 	case CornellBox:
 	{
 		/* Background */
-		sky = new SolidColor(0.0, 0.0, 0.0);
-		//sky = new ImageTexture("overcast_soil_puresky_4k.hdr");
+		sky = AddSolidColor(textures, Color(0.0, 0.0, 0.0));
+		//sky = textures.Add<ImageTexture>("overcast_soil_puresky_4k.hdr");
 
 		/* Materials */
-		auto red     = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
-		auto white   = std::make_shared<Lambertian>(Color(0.73, 0.73, 0.73));
-		auto green   = std::make_shared<Lambertian>(Color(0.12, 0.45, 0.15));
-		auto light   = std::make_shared<DiffuseLight>(Color(15.0, 15.0, 15.0));
-		auto glass   = std::make_shared<Dielectric>(1.5);
-		auto bubble  = std::make_shared<Dielectric>(0.666666);
-		auto mirror  = std::make_shared<Metal>(Color(0.73), 0.0);
-		auto checker = std::make_shared<Lambertian>(std::make_shared<CheckerTexture>(0.1, Color(0.1, 0.1, 0.4), Color(0.73, 0.73, 0.73)));
+		auto red     = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.65, 0.05, 0.05)));
+		auto white   = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.73, 0.73, 0.73)));
+		auto green   = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.12, 0.45, 0.15)));
+		auto light   = materials.Add<DiffuseLight>(AddSolidColor(textures, Color(15.0, 15.0, 15.0)));
+		auto glass   = materials.Add<Dielectric>(1.5);
+		auto bubble  = materials.Add<Dielectric>(0.666666);
+		auto mirror  = materials.Add<Metal>(Color(0.73), 0.0);
+		auto checker = materials.Add<Lambertian>(AddChecker(textures, 0.1, Color(0.1, 0.1, 0.4), Color(0.73, 0.73, 0.73)));
 
 		/* Cornell box */
 		Transform left_t;
 		left_t.Translate(0.0, -5.0, 5.0);
 		left_t.Rotate(-90.0, Vec3(1.0, 0.0, 0.0));
 		left_t.Scale(10.0);
-		world.Add(std::make_shared<Parallelogram>(left_t, green));
+		world.Add(MakeShared<Parallelogram>(left_t, green));
 
 		Transform right_t;
 		right_t.Translate(0.0, 5.0, 5.0);
 		right_t.Rotate(90.0, Vec3(1.0, 0.0, 0.0));
 		right_t.Scale(10.0);
-		world.Add(std::make_shared<Parallelogram>(right_t, red));
+		world.Add(MakeShared<Parallelogram>(right_t, red));
 
 		Transform bottom_t;
 		bottom_t.Scale(10.0);
-		world.Add(std::make_shared<Parallelogram>(bottom_t, white));
+		world.Add(MakeShared<Parallelogram>(bottom_t, white));
 
 		Transform top_t;
 		top_t.Translate(0.0, 0.0, 10.0);
 		//top_t.Rotate(180.0, Vec3(1.0, 0.0, 0.0)); /* we should be flipping it but it causes problems? */
 		top_t.Scale(10.0);
-		world.Add(std::make_shared<Parallelogram>(top_t, white));
+		world.Add(MakeShared<Parallelogram>(top_t, white));
 
 		Transform back_t;
 		back_t.Translate(-5.0, 0.0, 5.0);
 		back_t.Rotate(90.0, Vec3(0.0, 1.0, 0.0));
 		back_t.Scale(10.0);
-		world.Add(std::make_shared<Parallelogram>(back_t, checker));
+		world.Add(MakeShared<Parallelogram>(back_t, checker));
 		
 		Transform light_t;
 		light_t.Translate(0.0, 0.0, 10.0 - Eps);
 		light_t.Rotate(180.0, Vec3(1.0, 0.0, 0.0));
 		light_t.Scale(3.0);
-		auto light_p = std::make_shared<Parallelogram>(light_t, light);
+		auto light_p = MakeShared<Parallelogram>(light_t, light);
 		lights.Add(light_p);
 		world.Add(light_p);
 
@@ -330,28 +361,28 @@ Scene GenerateScene(Scenes scene)
 		//box_t.Translate(-2.0, -2.0, 3.0);
 		//box_t.Rotate(20.0, Vec3(0.0, 0.0, 1.0));
 		//box_t.Scale(2.5, 2.5, 6.0);
-		//auto box = std::make_shared<HittableList>(Box(box_t, mirror));
+		//auto box = Box(box_t, mirror);
 		//world.Add(box);
 		//lights.Add(box);
 
 		//Transform sphere_t;
 		//sphere_t.Translate(1.5, 1.5, 2.0);
 		//sphere_t.Scale(2.0);
-		//auto sphere = std::make_shared<Sphere>(sphere_t, glass);
+		//auto sphere = MakeShared<Sphere>(sphere_t, glass);
 		//world.Add(sphere);
 		//lights.Add(sphere);
 
 		Transform sphere_t;
 		sphere_t.Translate(0.0, 0.0, 5.0);
 		sphere_t.Scale(2.0);
-		auto sphere = std::make_shared<Sphere>(sphere_t, glass);
+		auto sphere = MakeShared<Sphere>(sphere_t, glass);
 		world.Add(sphere);
 		lights.Add(sphere);
 
 		//Transform t;
 		//t.Rotate(90.0, Vec3(0.0, 0.0, 1.0));
 		//t.Scale(6.0);
-		//auto mesh = std::make_shared<BVH_Node>(LoadMesh(t, "stanford-bunny-s.obj", glass));
+		//auto mesh = MakeShared<BVH_Node>(LoadMesh(t, "stanford-bunny-s.obj", glass));
 		//world.Add(mesh);
 		//lights.Add(mesh);
 
@@ -359,7 +390,7 @@ Scene GenerateScene(Scenes scene)
 		//t.Rotate(120.0, Vec3(0.0, 0.0, 1.0));
 		//t.Rotate(90.0, Vec3(1.0, 0.0, 0.0));
 		//t.Scale(7.0);
-		//auto mesh = std::make_shared<BVH_Node>(LoadMesh(t, "dragon.obj", white));
+		//auto mesh = MakeShared<BVH_Node>(LoadMesh(t, "dragon.obj", white));
 		//world.Add(mesh);
 		////lights.Add(mesh);
 
@@ -369,27 +400,27 @@ Scene GenerateScene(Scenes scene)
 	case Showcase0:
 	{
 		/* Black background */
-		sky = new ImageTexture("milky_way.jpg");
+		sky = textures.Add<ImageTexture>("milky_way.jpg");
 
 		/* Single large diffuse overhead light */
-		auto light_material = std::make_shared<DiffuseLight>(Color(7.0));
+		auto light_material = materials.Add<DiffuseLight>(AddSolidColor(textures, Color(7.0)));
 		Transform light_t;
 		light_t.Translate(0.0, 0.0, 15.0);
 		light_t.Rotate(180.0, Vec3(1.0, 0.0, 0.0));
 		light_t.Scale(10.0);
-		auto light = std::make_shared<Parallelogram>(light_t, light_material);
+		auto light = MakeShared<Parallelogram>(light_t, light_material);
 		world.Add(light);
 		lights.Add(light);
 
 		/* Fog throughout the scene */
-		auto white_material = std::make_shared<Lambertian>(Color(0.73));
+		auto white_material = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.73)));
 		Transform fog_t;
 		fog_t.Scale(1000.0);
-		world.Add(std::make_shared<ConstantMedium>(std::make_shared<HittableList>(Box(fog_t, white_material)), 0.0001, Color(0.1)));
+		world.Add(MakeShared<ConstantMedium>(Box(fog_t, white_material), 0.0001, materials.Add<Isotropic>(AddSolidColor(textures, Color(0.1)))));
 
 		/* Create a 'ground' out of multiple staggered height boxes */
 		HittableList ground;
-		auto ground_material = std::make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+		auto ground_material = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.48, 0.83, 0.53)));
 		int boxes_per_side = 20;
 		for (int i = 0; i < boxes_per_side; i++)
 		{
@@ -410,10 +441,12 @@ Scene GenerateScene(Scenes scene)
 			}
 		}
 		/* Create a BVH of these boxes and add to the world */
-		world.Add(std::make_shared<BVH_Node>(ground));
+		world.Add(BuildBVH(ground, bvh_params));
 
 		/* Make a rotated 'box' of lambertian spheres */
-		HittableList box_of_spheres;
+		/* Each sphere is a uniformly scaled and translated unit sphere, so the box can be a SphereSet
+		(the spheres are white, so dropping the rotation of their texture coordinates is invisible) */
+		std::vector<SphereSetEntry> box_of_spheres;
 		Transform bs_t;
 		bs_t.Translate(0.0, 6.0, 9.0);
 		bs_t.Rotate(45.0, Vec3(0.0, 1.0, 1.0));
@@ -427,96 +460,129 @@ Scene GenerateScene(Scenes scene)
 			s_t.Scale(0.05);
 
 			/* Combined transform */
-			Transform bss_t(bs_t.model_to_world * s_t.model_to_world);
+			Transform bss_t(bs_t.Matrix() * s_t.Matrix());
 
-			box_of_spheres.Add(std::make_shared<Sphere>(bss_t, white_material));
+			Real radius = glm::length(bss_t.VectorModelToWorld(Vec3(1.0, 0.0, 0.0)));
+			box_of_spheres.emplace_back(bss_t.PointModelToWorld(Point3(0.0)), radius, white_material);
 		}
-		world.Add(std::make_shared<BVH_Node>(box_of_spheres));
+		world.Add(MakeShared<SphereSet>(box_of_spheres, bvh_params));
 
 		/* Motion blur sphere */
-		auto blur_material = std::make_shared<Lambertian>(Color(0.9, 0.4, 0.6));
+		auto blur_material = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.9, 0.4, 0.6)));
 		Transform blur_t;
 		blur_t.Translate(2.0, 2.5, 2.0);
 		blur_t.Scale(1.0);
-		world.Add(std::make_shared<Sphere>(blur_t, Vec3(0.0, 1.0, 0.0), blur_material));
+		world.Add(MakeShared<Sphere>(blur_t, Vec3(0.0, 1.0, 0.0), blur_material));
 
 		/* Globe */
-		auto globe_material = std::make_shared<Lambertian>(std::make_shared<ImageTexture>("earthmap.jpg"));
+		auto globe_material = materials.Add<Lambertian>(textures.Add<ImageTexture>("earthmap.jpg"));
 		Transform globe_t;
 		globe_t.Translate(-7.0, -7.0, 6.0);
 		globe_t.Scale(3.0);
-		world.Add(std::make_shared<Sphere>(globe_t, globe_material));
+		world.Add(MakeShared<Sphere>(globe_t, globe_material));
 
 		/* Glass ball */
-		auto glass_material = std::make_shared<Dielectric>(1.5);
+		auto glass_material = materials.Add<Dielectric>(1.5);
 		Transform glass_t;
 		glass_t.Translate(4.0, -2.0, 3.5);
 		glass_t.Scale(1.75);
-		auto glass_ball = std::make_shared<Sphere>(glass_t, glass_material);
+		auto glass_ball = MakeShared<Sphere>(glass_t, glass_material);
 		world.Add(glass_ball);
 		lights.Add(glass_ball);
 
 		/* Metal spheroid */
-		auto smooth_metal_material = std::make_shared<Metal>(Color(0.7, 0.5, 0.4), 0.0);
+		auto smooth_metal_material = materials.Add<Metal>(Color(0.7, 0.5, 0.4), 0.0);
 		Transform ms_t;
 		ms_t.Translate(-4.0, 4.0, 4.0);
 		ms_t.Rotate(30.0, Vec3(0.0, 0.0, 1.0));
 		ms_t.Scale(5.0, 2.0, 2.0);
-		world.Add(std::make_shared<Sphere>(ms_t, smooth_metal_material));
+		world.Add(MakeShared<Sphere>(ms_t, smooth_metal_material));
 
 		/* Noise spheroid */
-		auto turbulence_texture = std::make_shared<TurbulenceTexture>(100.0);
-		auto turbulence_material = std::make_shared<Lambertian>(turbulence_texture);
+		auto turbulence_texture = textures.Add<TurbulenceTexture>(100.0);
+		auto turbulence_material = materials.Add<Lambertian>(turbulence_texture);
 		Transform mt_t;
 		mt_t.Translate(3.0, 6.0, 3.0);
 		mt_t.Scale(1.0, 1.0, 1.5);
-		world.Add(std::make_shared<Sphere>(mt_t, turbulence_material));
+		world.Add(MakeShared<Sphere>(mt_t, turbulence_material));
 
 		/* Fog cuboid */
 		Transform c_t;
 		c_t.Translate(-12.0, 0.0, 8.0);
 		c_t.Rotate(-60.0, Vec3(0.0, 1.0, 1.0));
 		c_t.Scale(4.0);
-		world.Add(std::make_shared<ConstantMedium>(std::make_shared<HittableList>(Box(c_t, white_material)), 0.2, Color(0.73)));
+		world.Add(MakeShared<ConstantMedium>(Box(c_t, white_material), 0.2, materials.Add<Isotropic>(AddSolidColor(textures, Color(0.73)))));
 
 		break;
 	}
 
 	case TriangleMesh:
 	{
-		sky = new ImageTexture("overcast_soil_puresky_4k.hdr");
+		sky = textures.Add<ImageTexture>("overcast_soil_puresky_4k.hdr");
 
 		/* Materials */
-		auto checker_texture = std::make_shared<CheckerTexture>(2.5, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-		auto checker_material = std::make_shared<Lambertian>(checker_texture);
-		auto red = std::make_shared<Lambertian>(Color(0.65, 0.05, 0.05));
-		auto smooth_metal = std::make_shared<Metal>(Color(0.7, 0.5, 0.4), 0.0);
-		auto rough_metal = std::make_shared<Metal>(Color(0.7, 0.5, 0.4), 0.1);
-		auto mirror = std::make_shared<Metal>(Color(0.73), 0.0);
-		auto glass = std::make_shared<Dielectric>(1.5);
+		auto checker_texture = AddChecker(textures, 2.5, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+		auto checker_material = materials.Add<Lambertian>(checker_texture);
+		auto red = materials.Add<Lambertian>(AddSolidColor(textures, Color(0.65, 0.05, 0.05)));
+		auto smooth_metal = materials.Add<Metal>(Color(0.7, 0.5, 0.4), 0.0);
+		auto rough_metal = materials.Add<Metal>(Color(0.7, 0.5, 0.4), 0.1);
+		auto mirror = materials.Add<Metal>(Color(0.73), 0.0);
+		auto glass = materials.Add<Dielectric>(1.5);
 
 		/* Ground plane */
 		Transform tg;
 		tg.Scale(100.0);
-		world.Add(std::make_shared<Parallelogram>(tg, checker_material));
+		world.Add(MakeShared<Parallelogram>(tg, checker_material));
 
-		/* Mesh */
+		/* Mesh (indexed, with its own BVH built in model space) */
 		Transform t;
 
 		t.Rotate(90.0, Vec3(0.0, 0.0, 1.0));
 		t.Scale(6.0);
-		auto mesh = LoadMesh(t, "stanford-bunny-s.obj", mirror);
+		auto mesh = LoadIndexedMesh(t, "stanford-bunny-s.obj", mirror, bvh_params);
 
 		//t.Rotate(120.0, Vec3(0.0, 0.0, 1.0));
 		//t.Rotate(90.0, Vec3(1.0, 0.0, 0.0));
 		//t.Scale(6.0);
-		//auto mesh = LoadMesh(t, "dragon.obj", glass);
+		//auto mesh = LoadIndexedMesh(t, "dragon.obj", glass, bvh_params);
 
 		//t.Rotate(180.0, Vec3(0.0, 0.0, 1.0));
 		//t.Scale(6.0);
-		//auto mesh = LoadMesh(t, "low-poly-bunny.obj", glass);
+		//auto mesh = LoadIndexedMesh(t, "low-poly-bunny.obj", glass, bvh_params);
 		
-		world.Add(std::make_shared<BVH_Node>(mesh));
+		world.Add(mesh);
+
+		break;
+	}
+
+	case InstancedMeshes:
+	{
+		sky = textures.Add<ImageTexture>("overcast_soil_puresky_4k.hdr");
+
+		/* Ground plane */
+		auto checker_texture = AddChecker(textures, 2.5, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+		Transform tg;
+		tg.Scale(100.0);
+		world.Add(MakeShared<Parallelogram>(tg, materials.Add<Lambertian>(checker_texture)));
+
+		/* A single model space bunny mesh shared by a field of randomly placed instances */
+		auto bunny = LoadIndexedMesh(Transform(), "stanford-bunny.obj", materials.Add<Lambertian>(AddSolidColor(textures, Color(0.73))), bvh_params);
+
+		HittableList instances;
+		int per_side = 32;
+		for (int i = 0; i < per_side; i++)
+		{
+			for (int j = 0; j < per_side; j++)
+			{
+				Transform t;
+				t.Translate(-3.0 * i + RandomDouble() - 0.5, 3.0 * (j - per_side / 2) + RandomDouble() - 0.5, 0.0);
+				t.Rotate(360.0 * RandomDouble(), Vec3(0.0, 0.0, 1.0));
+				t.Rotate(90.0, Vec3(1.0, 0.0, 0.0));
+				t.Scale(10.0 + 5.0 * RandomDouble());
+				instances.Add(MakeShared<Instance>(t, bunny));
+			}
+		}
+		world.Add(BuildBVH(instances, bvh_params));
 
 		break;
 	}
@@ -529,9 +595,287 @@ Scene GenerateScene(Scenes scene)
 	}
 
 	/* Construct BVH */
-	world = HittableList(std::make_shared<BVH_Node>(world));
+	world = HittableList(BuildBVH(world, bvh_params));
+
+	return Scene(world, lights, sky, std::move(materials), std::move(textures), std::move(arena));
+}
+
+
+/* Compare closest hit and occlusion (any hit) rays/s of the BVH layouts on one of the default scenes. The scene is rebuilt
+for every layout and all layouts are traced (single threaded) with the same primary rays from the default viewpoint. */
+void BenchmarkBVH_Layouts(Scenes scene, size_t ray_count = 1000000, const BVH_BuildParams& bvh_params = BVH_BuildParams())
+{
+	const BVH_Layout layouts[] = { LayoutBinaryTree, LayoutLinear, LayoutWide4, LayoutWide8 };
+	const char* names[] = { "BVH_Node", "LinearBVH", "BVH4", "BVH8" };
+
+	std::cout << "[rt::Benchmark] Scene " << scene << ", SIMD: " << SIMD_InstructionSet() << std::endl;
+
+	std::vector<Ray> rays = GenerateBenchmarkRays(Point3(17.5, 0.0, 5.0), Point3(0.0, 0.0, 5.0), 60.0, ray_count);
+	for (int i = 0; i < 4; i++)
+	{
+		BVH_BuildParams params = bvh_params;
+		params.layout = layouts[i];
+		Scene s = GenerateScene(scene, params);
+
+		PrintBenchmarkResult(BenchmarkHittable(names[i], s.world, rays));
+		PrintBenchmarkResult(BenchmarkOccluded(std::string(names[i]) + " (occlusion)", s.world, rays));
+	}
+}
+
+
+/* Compare the rays/s (including all bounces) of rendering one of the default scenes from the default viewpoint with
+the original per-pixel scheduling and with the tile scheduler on 1, 2, 4, ... up to max_threads threads (0 uses all
+hardware threads), followed by several tile sizes and orders on max_threads threads. Every configuration renders
+`samples` samples per pixel of an image_size x image_size image. */
+void BenchmarkRenderScheduling(Scenes scene, unsigned int image_size = 256, int samples = 4, int max_threads = 0)
+{
+	if (max_threads <= 0) max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	std::cout << "[rt::Benchmark] Scene " << scene << ", rendering " << image_size << "x" << image_size << " at " << samples << " samples per pixel" << std::endl;
+
+	Scene s = GenerateScene(scene);
+	PerspectiveCamera camera = BenchmarkCamera(image_size);
+
+	auto rays_per_second = [&](const std::string& name, const RenderParams& params) {
+		RenderStats total;
+		for (int i = 0; i < samples; i++)
+		{
+			RenderStats stats;
+			Render(s, camera, params, &stats);
+			total.rays += stats.rays;
+			total.seconds += stats.seconds;
+		}
+
+		std::cout << "[rt::Benchmark]   " << name << ": " << total.RaysPerSecond() / 1.0e6 << " Mrays/s";
+		return total.RaysPerSecond();
+	};
+
+	RenderParams per_pixel;
+	per_pixel.schedule = SchedulePerPixel;
+	double per_pixel_rate = rays_per_second("per pixel", per_pixel);
+	std::cout << std::endl;
+
+	RenderParams params;
+	double single_thread_rate = 0.0;
+	for (int threads = 1; ; threads = std::min(2 * threads, max_threads))
+	{
+		params.thread_count = threads;
+		double rate = rays_per_second(std::to_string(params.tile_size) + " px Morton tiles, " + std::to_string(threads) + " thread(s)", params);
+		if (threads == 1) single_thread_rate = rate;
+
+		std::cout << " (" << rate / single_thread_rate << "x of 1 thread, " << rate / per_pixel_rate << "x of per pixel)" << std::endl;
+		if (threads == max_threads) break;
+	}
+
+	const TileOrder orders[] = { TileOrderScanline, TileOrderMorton, TileOrderSpiral };
+	const char* order_names[] = { "scanline", "Morton", "spiral" };
+	for (unsigned int tile_size : { 8u, 16u, 32u, 64u })
+	{
+		for (int order = 0; order < 3; order++)
+		{
+			params.tile_size = tile_size;
+			params.tile_order = orders[order];
+			double rate = rays_per_second(std::to_string(tile_size) + " px " + order_names[order] + " tiles", params);
+			std::cout << " (" << rate / per_pixel_rate << "x of per pixel)" << std::endl;
+		}
+	}
+}
+
+
+/* Compare the rays needed to bring every tile of an image_size x image_size image of one of the default scenes (from the
+default viewpoint) below the relative error `threshold` (as estimated by adaptive sampling, see RenderParams::adaptive)
+with uniform and adaptive sampling. Both stop at max_samples samples per pixel. */
+void BenchmarkAdaptiveSampling(Scenes scene, unsigned int image_size = 128, double threshold = 0.05, unsigned int max_samples = 1024)
+{
+	std::cout << "[rt::Benchmark] Scene " << scene << ", adaptive sampling with a threshold of " << threshold << " at " << image_size << "x" << image_size << std::endl;
+
+	Scene s = GenerateScene(scene);
 
-	return Scene(world, lights, sky);
+	RenderParams adaptive_params;
+	adaptive_params.adaptive = true;
+	adaptive_params.adaptive_threshold = threshold;
+	adaptive_params.max_samples = max_samples;
+	std::vector<Tile> tiles = GenerateTiles(image_size, image_size, adaptive_params.tile_size, adaptive_params.tile_order);
+
+	size_t rays[2] = {};
+	for (int adaptive = 0; adaptive < 2; adaptive++)
+	{
+		PerspectiveCamera camera = BenchmarkCamera(image_size);
+
+		/* The uniform render checks the same error estimate after every pass, without skipping any tiles */
+		auto converged = [&]() {
+			if (adaptive) return camera.Converged();
+			return std::none_of(tiles.begin(), tiles.end(), [&](const Tile& tile) { return TileNeedsSamples(camera, tile, adaptive_params); });
+		};
+
+		RenderStats total;
+		while (camera.GetSampleCount() < max_samples && !converged())
+		{
+			RenderStats stats;
+			Render(s, camera, adaptive ? adaptive_params : RenderParams(), &stats);
+			total.pixel_samples += stats.pixel_samples;
+			total.rays += stats.rays;
+			total.seconds += stats.seconds;
+		}
+
+		std::cout << "[rt::Benchmark]   " << (adaptive ? "adaptive" : "uniform") << ": " << camera.GetSampleCount() << " passes, "
+			<< total.pixel_samples << " pixel samples, " << total.rays / 1.0e6 << " Mrays, " << total.seconds << " s" << std::endl;
+		rays[adaptive] = total.rays;
+	}
+
+	std::cout << "[rt::Benchmark]   adaptive traced " << (double)rays[1] / rays[0] << "x the rays of uniform" << std::endl;
+}
+
+
+/* Compare the efficiency of rendering one of the default scenes from the default viewpoint with paths traced to max_depth
+and with Russian roulette after 1, 3 and 5 bounces. Every configuration renders `samples` samples per pixel of an
+image_size x image_size image. The efficiency is 1 / (variance * time), where the variance is the mean over all pixels
+of the estimated variance of their mean luminance, i.e., how fast the noise of the image goes down. */
+void BenchmarkRussianRoulette(Scenes scene, unsigned int image_size = 64, unsigned int samples = 64, int max_depth = 10)
+{
+	std::cout << "[rt::Benchmark] Scene " << scene << ", Russian roulette at " << image_size << "x" << image_size << ", " << samples << " samples per pixel, max depth " << max_depth << std::endl;
+
+	Scene s = GenerateScene(scene);
+
+	double base_efficiency = 0.0;
+	for (int russian_roulette_depth : { -1, 1, 3, 5 })
+	{
+		PerspectiveCamera camera = BenchmarkCamera(image_size);
+		camera.max_depth = max_depth;
+		camera.russian_roulette_depth = russian_roulette_depth;
+
+		RenderStats total;
+		for (unsigned int i = 0; i < samples; i++)
+		{
+			RenderStats stats;
+			Render(s, camera, RenderParams(), &stats);
+			total.rays += stats.rays;
+			total.seconds += stats.seconds;
+		}
+
+		double mean = 0.0;
+		double variance = 0.0;
+		for (size_t pixel = 0; pixel < camera.pixel_samples.size(); pixel++)
+		{
+			const double* color = &camera.image_accumulator[3 * pixel];
+			double n = camera.pixel_samples[pixel];
+			mean += 0.2126 * color[0] + 0.7152 * color[1] + 0.0722 * color[2];
+			variance += camera.luminance_m2[pixel] / (n * (n - 1.0));
+		}
+		mean /= camera.pixel_samples.size();
+		variance /= camera.pixel_samples.size();
+
+		double efficiency = 1.0 / (variance * total.seconds);
+		if (russian_roulette_depth < 0) base_efficiency = efficiency;
+
+		std::string name = russian_roulette_depth < 0 ? "full depth" : "roulette after " + std::to_string(russian_roulette_depth);
+		std::cout << "[rt::Benchmark]   " << name << ": " << total.rays / 1.0e6 << " Mrays, " << total.seconds << " s, mean luminance " << mean
+			<< ", variance " << variance << ", efficiency " << efficiency / base_efficiency << "x of full depth" << std::endl;
+	}
+}
+
+
+/* Count the heap allocations made while rendering `samples` samples per pixel of an image_size x image_size image of
+one of the default scenes from the default viewpoint on thread_count threads (0 uses all hardware threads). A first sample is rendered beforehand, so that the workers of the
+tile scheduler are started and the tiles generated. Requires a build with RT_COUNT_ALLOCATIONS (see AllocationCount). */
+void BenchmarkRenderAllocations(Scenes scene, unsigned int image_size = 128, int samples = 4, int thread_count = 0)
+{
+#if defined(RT_COUNT_ALLOCATIONS)
+	std::cout << "[rt::Benchmark] Scene " << scene << ", heap allocations rendering " << image_size << "x" << image_size << " at " << samples << " samples per pixel on "
+		<< (thread_count > 0 ? std::to_string(thread_count) : "all") << " thread(s)" << std::endl;
+
+	Scene s = GenerateScene(scene);
+	PerspectiveCamera camera = BenchmarkCamera(image_size);
+	RenderParams params;
+	params.thread_count = thread_count;
+	Render(s, camera, params);
+
+	RenderStats total;
+	size_t allocations = AllocationCount();
+	for (int i = 0; i < samples; i++)
+	{
+		RenderStats stats;
+		Render(s, camera, params, &stats);
+		total.pixel_samples += stats.pixel_samples;
+		total.rays += stats.rays;
+		total.seconds += stats.seconds;
+	}
+	allocations = AllocationCount() - allocations;
+
+	std::cout << "[rt::Benchmark]   " << allocations << " allocations (" << (double)allocations / samples << " per Render call, "
+		<< (double)allocations / total.rays << " per ray), " << total.RaysPerSecond() / 1.0e6 << " Mrays/s" << std::endl;
+#else
+	std::cout << "[rt::Benchmark] Heap allocations are only counted in builds with RT_COUNT_ALLOCATIONS defined" << std::endl;
+#endif
+}
+
+
+/* Compare the SAH cost and closest hit rays/s of the top level BVH of one of the default scenes built with and
+without the treelet restructuring pass (with bvh_params.treelet_leaf_count leaves per treelet, or 7 if it is not set) */
+void BenchmarkBVH_Treelets(Scenes scene, size_t ray_count = 1000000, const BVH_BuildParams& bvh_params = BVH_BuildParams())
+{
+	std::cout << "[rt::Benchmark] Scene " << scene << ", treelet restructuring" << std::endl;
+
+	std::vector<Ray> rays = GenerateBenchmarkRays(Point3(17.5, 0.0, 5.0), Point3(0.0, 0.0, 5.0), 60.0, ray_count);
+	for (int restructure = 0; restructure < 2; restructure++)
+	{
+		BVH_BuildParams params = bvh_params;
+		params.treelet_leaf_count = restructure == 0 ? 0 : (bvh_params.treelet_leaf_count > 2 ? bvh_params.treelet_leaf_count : 7);
+		Scene s = GenerateScene(scene, params);
+
+		const char* name = restructure == 0 ? "original" : "restructured";
+		std::cout << "[rt::Benchmark]   " << name << ": SAH cost " << BVH_SAH_Cost(*s.world.objects[0]) << std::endl;
+		PrintBenchmarkResult(BenchmarkHittable(name, s.world, rays));
+	}
+}
+
+
+/* Measure the memory used by each of the default scenes and their closest hit rays/s (single threaded, from the
+default viewpoint) in the precision this build uses for Real. Run it in a default and an RT_USE_FLOAT build to
+compare the two. */
+void BenchmarkPrecision(size_t ray_count = 1000000, const BVH_BuildParams& bvh_params = BVH_BuildParams())
+{
+	std::cout << "[rt::Benchmark] Precision: " << (std::is_same_v<Real, float> ? "float" : "double") << ", SIMD: " << SIMD_InstructionSet() << std::endl;
+
+	std::vector<Ray> rays = GenerateBenchmarkRays(Point3(17.5, 0.0, 5.0), Point3(0.0, 0.0, 5.0), 60.0, ray_count);
+	for (int scene = BasicMaterials; scene <= InstancedMeshes; scene++)
+	{
+		size_t heap_before = HeapUsage();
+		Scene s = GenerateScene((Scenes)scene, bvh_params);
+		size_t heap_after = HeapUsage();
+
+		std::cout << "[rt::Benchmark] Scene " << scene << ": " << (heap_after > heap_before ? heap_after - heap_before : 0) / 1.0e6 << " MB" << std::endl;
+		PrintBenchmarkResult(BenchmarkHittable("Scene " + std::to_string(scene), s.world, rays));
+	}
+}
+
+/* Compare the time it takes to construct and to destroy each of the default scenes with its objects allocated
+from the scene's arena and from the heap, along with the arena's allocation statistics */
+void BenchmarkSceneAllocation(const BVH_BuildParams& bvh_params = BVH_BuildParams())
+{
+	std::cout << "[rt::Benchmark] Scene allocation" << std::endl;
+
+	for (int scene = BasicMaterials; scene <= InstancedMeshes; scene++)
+	{
+		for (int use_arena = 0; use_arena < 2; use_arena++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			auto s = std::make_unique<Scene>(GenerateScene((Scenes)scene, bvh_params, use_arena == 1));
+			auto built = std::chrono::high_resolution_clock::now();
+
+			size_t bytes = s->arena ? s->arena->BytesAllocated() : 0;
+			size_t allocations = s->arena ? s->arena->AllocationCount() : 0;
+
+			s.reset();
+			auto destroyed = std::chrono::high_resolution_clock::now();
+
+			std::cout << "[rt::Benchmark] Scene " << scene << (use_arena ? " (arena): " : " (heap):  ")
+				<< "build " << std::chrono::duration<double, std::milli>(built - start).count() << " ms, "
+				<< "destroy " << std::chrono::duration<double, std::milli>(destroyed - built).count() << " ms";
+			if (use_arena) std::cout << ", " << allocations << " allocations, " << bytes / 1.0e6 << " MB";
+			std::cout << std::endl;
+		}
+	}
 }
 
 } /* namespace rt */
\ No newline at end of file
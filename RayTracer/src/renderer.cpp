@@ -1,108 +1,286 @@
 #include "renderer.h"
 
+#include <atomic>
+#include <chrono>
 #include <limits>
 
 namespace rt
 {
-std::vector<unsigned char> Render(const Scene& scene, Camera& camera)
+/* Number of rays traced by the calling thread (see TraceRay), for RenderStats */
+static thread_local size_t traced_rays = 0;
+
+/* Number of pixel samples taken by the calling thread (see PixelColor), for RenderStats */
+static thread_local size_t sampled_pixels = 0;
+
+/* The persistent workers of the tile schedule, restarted when a different thread count is requested */
+static TileScheduler& SharedTileScheduler(int thread_count)
 {
-	auto rendered_image = std::vector<unsigned char>(camera.image_width * camera.image_height * 3);
+	static std::unique_ptr<TileScheduler> scheduler;
 
-#define MULTI_THREADED true
-#if MULTI_THREADED
-	/*Setupiteratorsforstd::foreach*/
-	auto horizontal_iter = std::vector<unsigned int>(camera.image_width);
-	auto vertical_iter = std::vector<unsigned int>(camera.image_height);
-	for (unsigned int i = 0; i < camera.image_width; i++) horizontal_iter[i] = i;
-	for (unsigned int i = 0; i < camera.image_height; i++) vertical_iter[i] = i;
+	if (thread_count <= 0) thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+	if (!scheduler || scheduler->ThreadCount() != thread_count) scheduler = std::make_unique<TileScheduler>(thread_count);
 
-	/* Main (parallelized) ray tracing loop */
-	std::for_each(std::execution::par, vertical_iter.begin(), vertical_iter.end(), [&](unsigned int j) {
-		std::for_each(std::execution::par, horizontal_iter.begin(), horizontal_iter.end(), [&](unsigned int i) {
+	return *scheduler;
+}
 
-			PixelColor(rendered_image, i, j, scene, camera);
+/* The tiles of the last requested image size and tiling, so they are not regenerated on every call */
+static const std::vector<Tile>& CachedTiles(unsigned int width, unsigned int height, unsigned int tile_size, TileOrder order)
+{
+	static std::vector<Tile> tiles;
+	static unsigned int cached_width = 0, cached_height = 0, cached_tile_size = 0;
+	static TileOrder cached_order = TileOrderScanline;
 
-			});
-		});
-#else
-	for (unsigned int j = 0; j < camera.image_height; j++)
+	if (tiles.empty() || width != cached_width || height != cached_height || tile_size != cached_tile_size || order != cached_order)
 	{
-		for (unsigned int i = 0; i < camera.image_width; i++)
+		tiles = GenerateTiles(width, height, tile_size, order);
+		cached_width = width;
+		cached_height = height;
+		cached_tile_size = tile_size;
+		cached_order = order;
+	}
+
+	return tiles;
+}
+
+/* Take one sample of every pixel of the tile if it needs samples. Returns the number of pixels that need more samples after it. */
+static size_t RenderTile(const Tile& tile, const Scene& scene, Camera& camera, const RenderParams& params)
+{
+	if (!TileNeedsSamples(camera, tile, params)) return 0;
+
+	for (unsigned int j = tile.y0; j < tile.y1; j++)
+	{
+		for (unsigned int i = tile.x0; i < tile.x1; i++)
 		{
-			PixelColor(rendered_image, i, j, world, camera);
+			PixelColor(i, j, scene, camera);
 		}
 	}
-#endif
-
-	/* Iterate the sample count for this camera */
-	camera.current_samples++;
 
-	return rendered_image;
+	return TileNeedsSamples(camera, tile, params) ? tile.PixelCount() : 0;
 }
 
+/* Luminance of a linear RGB color */
+static double Luminance(double r, double g, double b)
+{
+	return 0.2126 * r + 0.7152 * g + 0.0722 * b;
+}
 
-Color TraceRay(const Ray& ray_in, int depth, const Scene& scene)
+std::vector<unsigned char> Render(const Scene& scene, Camera& camera, const RenderParams& params, RenderStats* stats)
 {
-	/* If we exceed the ray bounce limit, no more light is gathered */
-	if (depth <= 0) return Color(0.0, 0.0, 0.0);
-
-	HitRecord hrec;
-	
-	/* If the ray hits nothing, sample the sky texture */
-	/* Check if the ray hits anything in the scene and update the hrec if it does */
-	if (!scene.world.Hit(ray_in, Interval(Eps, Inf), hrec))
+	auto start = std::chrono::high_resolution_clock::now();
+	std::atomic<size_t> ray_count = 0;
+	std::atomic<size_t> sample_count = 0;
+	std::atomic<size_t> active_count = 0;
+
+	if (params.schedule == ScheduleTiles)
 	{
-		return scene.SampleSky(ray_in);
+		/* Each worker renders whole tiles, so neighboring rays (which tend to traverse the same parts of the scene)
+		are traced one after the other on the same thread */
+		const std::vector<Tile>& tiles = CachedTiles(camera.image_width, camera.image_height, params.tile_size, params.tile_order);
+		SharedTileScheduler(params.thread_count).Run(tiles, [&](const Tile& tile, int worker) {
+			size_t rays_before = traced_rays;
+			size_t samples_before = sampled_pixels;
+			active_count += RenderTile(tile, scene, camera, params);
+			ray_count += traced_rays - rays_before;
+			sample_count += sampled_pixels - samples_before;
+			});
 	}
+	else
+	{
+		/* Set up iterators for std::foreach */
+		auto horizontal_iter = std::vector<unsigned int>(camera.image_width);
+		auto vertical_iter = std::vector<unsigned int>(camera.image_height);
+		for (unsigned int i = 0; i < camera.image_width; i++) horizontal_iter[i] = i;
+		for (unsigned int i = 0; i < camera.image_height; i++) vertical_iter[i] = i;
+
+		/* Main (parallelized) ray tracing loop */
+		std::for_each(std::execution::par, vertical_iter.begin(), vertical_iter.end(), [&](unsigned int j) {
+			std::for_each(std::execution::par, horizontal_iter.begin(), horizontal_iter.end(), [&](unsigned int i) {
 
-	ScatterRecord srec;
-	Color color_from_emission = hrec.material->Emitted(ray_in, hrec);
+				size_t rays_before = traced_rays;
+				PixelColor(i, j, scene, camera);
+				if (stats) ray_count += traced_rays - rays_before;
+				if (stats) sample_count++;
+				active_count++;
+
+				});
+			});
+	}
 
-	/* If the material the ray hit does not cause it to scatter, return the emitted color */
-	if (!hrec.material->Scatter(ray_in, hrec, srec)) return color_from_emission;
+	/* Every pixel has one more sample (unless adaptive sampling skipped it). Note: this is also true if a progressive
+	render is part way through a pass, since the pixels it has already sampled in that pass had one more sample than
+	the rest before this call. */
+	camera.completed_passes++;
+	camera.active_pixels = active_count;
 
-	/* If the material does not use a pdf... */
-	if (srec.skip_pdf)
+	if (stats)
 	{
-		/* Recursively trace the ray without modifying the attenuation with the pdf */
-		return srec.attenuation * TraceRay(srec.skip_pdf_ray, depth - 1, scene);
+		stats->pixel_samples = sample_count;
+		stats->rays = ray_count;
+		stats->seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
-	/* Combine the light pdf with existing pdfs */
-	Point3 world_posn = hrec.transform.PointModelToWorld(hrec.posn);
-	MixturePDF pdf(srec.pdf_ptr, srec.pdf_ptr);
-	if (!scene.lights.objects.empty())
+	return camera.rendered_image;
+}
+
+
+std::vector<unsigned char> RenderProgressive(const Scene& scene, Camera& camera, double time_budget, const RenderParams& params, RenderStats* stats)
+{
+	using Clock = std::chrono::high_resolution_clock;
+	auto start = Clock::now();
+	auto elapsed = [&start] { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+	const std::vector<Tile>& tiles = CachedTiles(camera.image_width, camera.image_height, params.tile_size, params.tile_order);
+	TileScheduler& scheduler = SharedTileScheduler(params.thread_count);
+	if (camera.next_tile >= tiles.size()) camera.next_tile = 0;
+
+	std::atomic<size_t> ray_count = 0;
+	std::atomic<size_t> sample_count = 0;
+	std::vector<Tile> batch;
+
+	/* The tiles are rendered in batches, each sized from the time the previous batch took per tile. Only half of
+	the remaining time is planned for, since tiles can take very different times (e.g., sky vs. a glass object). */
+	double tile_seconds = 0.0;
+	do
 	{
-		/* Set up the light pdfs with the origin for the scattered ray set in world space */
-		auto light_ptr = std::make_shared<HittablePDF>(scene.lights, world_posn);
-		pdf = MixturePDF(light_ptr, srec.pdf_ptr);
+		size_t count = scheduler.ThreadCount();
+		if (tile_seconds > 0.0)
+		{
+			double remaining = time_budget - elapsed();
+			if (remaining <= 0.0) break;
+			count = (size_t)(0.5 * remaining / tile_seconds);
+		}
+		count = std::min(count, tiles.size() - camera.next_tile);
+		if (count == 0) break;
+
+		batch.assign(tiles.begin() + camera.next_tile, tiles.begin() + camera.next_tile + count);
+		auto batch_start = Clock::now();
+		std::atomic<size_t> active_count = 0;
+		scheduler.Run(batch, [&](const Tile& tile, int worker) {
+			size_t rays_before = traced_rays;
+			size_t samples_before = sampled_pixels;
+			active_count += RenderTile(tile, scene, camera, params);
+			ray_count += traced_rays - rays_before;
+			sample_count += sampled_pixels - samples_before;
+			});
+		tile_seconds = std::chrono::duration<double>(Clock::now() - batch_start).count() / count;
+
+		/* Start the next pass once every tile was sampled */
+		camera.next_tile += count;
+		camera.pass_active_pixels += active_count;
+		if (camera.next_tile == tiles.size())
+		{
+			camera.next_tile = 0;
+			camera.completed_passes++;
+			camera.active_pixels = camera.pass_active_pixels;
+			camera.pass_active_pixels = 0;
+
+			/* Nothing is left to sample. The next call checks all pixels again, in case the parameters changed. */
+			if (camera.Converged()) break;
+		}
+	} while (elapsed() < time_budget);
+
+	if (stats)
+	{
+		stats->pixel_samples = sample_count;
+		stats->rays = ray_count;
+		stats->seconds = elapsed();
 	}
 
-	Ray scattered = Ray(world_posn, pdf.Generate(), ray_in.time);
-	double pdf_value = pdf.Value(scattered.direction);
+	return camera.rendered_image;
+}
 
-	double scattering_pdf = hrec.material->ScatteringPDF(ray_in, hrec, scattered);
 
-	/* Otherwise, determine the scattered color by recursively tracing the ray */
-	Color color_from_scatter = Color(0.0);
-	if (pdf_value > Eps) /* Prevent near-zero values... this is a hack */
+Color TraceRay(const Ray& ray_in, int max_depth, const Scene& scene, int russian_roulette_depth)
+{
+	/* Light gathered so far, and the fraction of the light arriving along the current ray that reaches the camera */
+	Color radiance = Color(0.0);
+	Color throughput = Color(1.0);
+	Ray ray = ray_in;
+
+	/* Once we exceed the ray bounce limit, no more light is gathered */
+	for (int bounce = 0; bounce < max_depth; bounce++)
 	{
-		color_from_scatter = (srec.attenuation * scattering_pdf * TraceRay(scattered, depth - 1, scene)) / pdf_value;
+		traced_rays++;
+
+		HitRecord hrec;
+
+		/* If the ray hits nothing, sample the sky texture */
+		/* Check if the ray hits anything in the scene and update the hrec if it does */
+		if (!scene.world.Hit(ray, Interval(RayEps, Inf), hrec))
+		{
+			radiance += throughput * scene.SampleSky(ray);
+			break;
+		}
+
+		/* The surface interaction is only computed for the closest hit */
+		SurfaceInteraction interaction;
+		hrec.Interaction(ray, interaction);
+
+		const Material& material = scene.materials[interaction.material];
+
+		ScatterRecord srec;
+		radiance += throughput * material.Emitted(ray, interaction, scene.textures);
+
+		/* If the material the ray hit does not cause it to scatter, the path ends with the emitted color */
+		if (!material.Scatter(ray, interaction, scene.textures, srec)) break;
+
+		/* If the material does not use a pdf... */
+		if (srec.skip_pdf)
+		{
+			/* Continue with the scattered ray without modifying the attenuation with the pdf */
+			throughput *= srec.attenuation;
+			ray = srec.skip_pdf_ray;
+		}
+		else
+		{
+			/* Combine the light pdf with existing pdfs */
+			Point3 world_posn = interaction.transform.PointModelToWorld(interaction.posn);
+			PDF pdf = srec.pdf;
+			if (!scene.lights.objects.empty())
+			{
+				/* Set up the light pdfs with the origin for the scattered ray set in world space */
+				pdf = MixturePDF(HittablePDF(scene.lights, world_posn), srec.pdf);
+			}
+
+			Ray scattered = Ray(world_posn, pdf.Generate(), ray.time);
+			Real pdf_value = pdf.Value(scattered.direction);
+
+			Real scattering_pdf = material.ScatteringPDF(ray, interaction, scattered);
+
+			/* Prevent near-zero values... this is a hack */
+			if (pdf_value <= Eps) break;
+
+			throughput *= srec.attenuation * scattering_pdf / pdf_value;
+			ray = scattered;
+		}
+
+		/* Russian roulette: past the minimum depth, end the path with a probability that grows as its throughput drops
+		and divide the throughput of the surviving paths by their survival probability, so the expected radiance is unchanged */
+		if (russian_roulette_depth >= 0 && bounce + 1 >= russian_roulette_depth)
+		{
+			Real survival = std::max(throughput.r, std::max(throughput.g, throughput.b));
+			if (survival < 1.0)
+			{
+				if (RandomDouble() >= survival) break;
+				throughput /= survival;
+			}
+		}
 	}
 
-	return color_from_emission + color_from_scatter;
+	return radiance;
 }
 
-void PixelColor(std::vector<unsigned char>& rendered_image, unsigned int i, unsigned int j, const Scene& scene, Camera& camera)
+void PixelColor(unsigned int i, unsigned int j, const Scene& scene, Camera& camera)
 {
 	/* Determine the index to start of this pixel */
 	unsigned int pixel = 3 * (j * camera.image_width + i);
+	unsigned int& samples = camera.pixel_samples[j * camera.image_width + i];
 
 	/* Create a ray from this pixel using the given camera */
 	Ray ray = camera.GenerateRay(i, j);
 
 	/* Trace ray and determine new color */
-	Color pixel_color = TraceRay(ray, camera.max_depth, scene);
+	Color pixel_color = TraceRay(ray, camera.max_depth, scene, camera.russian_roulette_depth);
 	double r = pixel_color.r;
 	double g = pixel_color.g;
 	double b = pixel_color.b;
@@ -123,10 +301,18 @@ void PixelColor(std::vector<unsigned char>& rendered_image, unsigned int i, unsi
 	double cg = camera.image_accumulator[pixel + 1];
 	double cb = camera.image_accumulator[pixel + 2];
 
+	/* Update the variance estimate of the pixel's luminance (Welford's method) */
+	double luminance = Luminance(r, g, b);
+	double old_mean = Luminance(cr, cg, cb);
+	double new_mean = old_mean + (luminance - old_mean) / (samples + 1);
+	camera.luminance_m2[pixel / 3] += (luminance - old_mean) * (luminance - new_mean);
+
 	/* Determine the new accumulated color */
-	r = (r + camera.current_samples * cr) / (camera.current_samples + 1);
-	g = (g + camera.current_samples * cg) / (camera.current_samples + 1);
-	b = (b + camera.current_samples * cb) / (camera.current_samples + 1);
+	r = (r + samples * cr) / (samples + 1);
+	g = (g + samples * cg) / (samples + 1);
+	b = (b + samples * cb) / (samples + 1);
+	samples++;
+	sampled_pixels++;
 
 	/* Set the new accumulated values in the accumulator */
 	camera.image_accumulator[pixel + 0] = r;
@@ -135,9 +321,64 @@ void PixelColor(std::vector<unsigned char>& rendered_image, unsigned int i, unsi
 
 	/* Clamp the color from 0-255 and set the pixel values to return */
 	static const Interval intensity(0.000, 0.999);
+	std::vector<unsigned char>& rendered_image = camera.rendered_image;
 	rendered_image[pixel + 0] = (unsigned char)(256 * intensity.Clamp(camera.gamma_correct ? LinearToGamma(r) : r));
 	rendered_image[pixel + 1] = (unsigned char)(256 * intensity.Clamp(camera.gamma_correct ? LinearToGamma(g) : g));
 	rendered_image[pixel + 2] = (unsigned char)(256 * intensity.Clamp(camera.gamma_correct ? LinearToGamma(b) : b));
 }
 
+bool TileNeedsSamples(const Camera& camera, const Tile& tile, const RenderParams& params)
+{
+	/* The pixels of a tile are sampled together, so they have the same count unless the tiling changed part way through a pass */
+	unsigned int samples = camera.pixel_samples[(size_t)tile.y0 * camera.image_width + tile.x0];
+	for (unsigned int j = tile.y0; j < tile.y1; j++)
+	{
+		for (unsigned int i = tile.x0; i < tile.x1; i++) samples = std::min(samples, camera.pixel_samples[(size_t)j * camera.image_width + i]);
+	}
+
+	if (params.max_samples > 0 && samples >= params.max_samples) return false;
+	if (!params.adaptive || samples < std::max(2u, params.adaptive_min_samples)) return true;
+
+	/* The error of dark pixels is compared to that of a pixel with this luminance instead, since a
+	relative error of the few dark samples is both unreliable and invisible in the displayed image */
+	static const double min_luminance = 0.02;
+
+	/* RMS of the relative errors of the pixels. A pixel whose samples so far are all black (e.g., the light was not
+	found yet) has no error estimate of its own, so it is sampled for as long as the pixels around it are. */
+	double sum = 0.0;
+	for (unsigned int j = tile.y0; j < tile.y1; j++)
+	{
+		for (unsigned int i = tile.x0; i < tile.x1; i++)
+		{
+			size_t pixel = (size_t)j * camera.image_width + i;
+			unsigned int n = camera.pixel_samples[pixel];
+			const double* color = &camera.image_accumulator[3 * pixel];
+
+			double mean = std::max(Luminance(color[0], color[1], color[2]), min_luminance);
+			double variance = camera.luminance_m2[pixel] / (n - 1);
+			sum += variance / (n * mean * mean);
+		}
+	}
+
+	return std::sqrt(sum / tile.PixelCount()) > params.adaptive_threshold;
+}
+
+std::vector<unsigned char> SampleCountImage(const Camera& camera)
+{
+	unsigned int max_samples = 1;
+	for (unsigned int samples : camera.pixel_samples) max_samples = std::max(max_samples, samples);
+
+	std::vector<unsigned char> image(camera.pixel_samples.size() * 3);
+	for (size_t pixel = 0; pixel < camera.pixel_samples.size(); pixel++)
+	{
+		/* Heat map: black -> red -> yellow -> white */
+		double t = 3.0 * camera.pixel_samples[pixel] / max_samples;
+		image[3 * pixel + 0] = (unsigned char)(255.0 * std::clamp(t, 0.0, 1.0));
+		image[3 * pixel + 1] = (unsigned char)(255.0 * std::clamp(t - 1.0, 0.0, 1.0));
+		image[3 * pixel + 2] = (unsigned char)(255.0 * std::clamp(t - 2.0, 0.0, 1.0));
+	}
+
+	return image;
+}
+
 }
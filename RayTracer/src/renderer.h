@@ -9,19 +9,86 @@
 #include "cameras.h"
 #include "scene.h"
 #include "pdf.h"
+#include "tile_scheduler.h"
 
 
 namespace rt 
 {
 
-/* Render the provided scene with the provided camera */
-std::vector<unsigned char> Render(const Scene& scene, Camera& camera);
+/* How the pixels of an image are distributed over threads */
+enum RenderSchedule
+{
+	ScheduleTiles, /* Tiles processed by persistent workers that steal from each other (see TileScheduler) */
+	SchedulePerPixel, /* Every pixel is a separate std::for_each task (the original scheduling, kept for comparison) */
+};
+
+
+/* Parameters of Render */
+class RenderParams
+{
+public:
+	RenderSchedule schedule = ScheduleTiles;
+
+	/* Number of pixels per side of a tile */
+	unsigned int tile_size = 16;
+
+	/* Order the tiles are handed out in */
+	TileOrder tile_order = TileOrderMorton;
+
+	/* Number of worker threads of the tile scheduler (0 uses all hardware threads). The workers are kept
+	alive between calls and only restarted when a different count is requested. */
+	int thread_count = 0;
+
+	/* Adaptive sampling: a tile is only sampled while the estimated relative error of its pixels (the RMS over its pixels
+	of the standard error of the mean luminance of their samples over that mean) is above adaptive_threshold, so the
+	samples go to the noisy parts of the image instead of, e.g., the ones that only see the sky. Every tile first takes
+	adaptive_min_samples samples, since the variance estimate of a few samples can be far too low. Camera::Converged
+	tells when no tile needs more samples. Only the tile schedule supports adaptive sampling and max_samples. */
+	bool adaptive = false;
+	double adaptive_threshold = 0.02;
+	unsigned int adaptive_min_samples = 16;
+
+	/* Pixels are no longer sampled once they have this many samples (0 for no limit) */
+	unsigned int max_samples = 0;
+};
+
+
+/* Statistics of a Render call */
+class RenderStats
+{
+public:
+	size_t pixel_samples = 0; /* Number of camera rays (i.e., the number of pixels sampled) */
+	size_t rays = 0; /* Number of rays traced through the scene, including all bounces */
+	double seconds = 0.0;
+
+public:
+	double RaysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+};
+
+
+/* Render the provided scene with the provided camera (one sample per pixel). If stats is provided, it is filled in. */
+std::vector<unsigned char> Render(const Scene& scene, Camera& camera, const RenderParams& params = RenderParams(), RenderStats* stats = nullptr);
+
+/* Render the provided scene with the provided camera for about `time_budget` seconds, e.g., once per frame of an
+interactive viewer. Tiles are sampled in the order of `params` for as long as the budget allows, and the next call
+continues from the first tile that was not sampled, so a pass over the image can be spread over several calls.
+At least one batch of tiles (one per worker) is always rendered. The tiling should stay the same until a pass
+completes. Returns the whole accumulated image. The number of pixel samples taken is returned in stats. */
+std::vector<unsigned char> RenderProgressive(const Scene& scene, Camera& camera, double time_budget, const RenderParams& params = RenderParams(), RenderStats* stats = nullptr);
+
+/* Trace a path starting with the given ray through the scene for at most max_depth bounces. Paths are ended with
+Russian roulette from the russian_roulette_depth'th bounce on (a negative depth traces every path to max_depth). */
+Color TraceRay(const Ray& ray_in, int max_depth, const Scene& scene, int russian_roulette_depth = -1);
+
+/* Take a sample of the provided pixel index given the scene and camera, and accumulate it in the camera's image */
+void PixelColor(unsigned int i, unsigned int j, const Scene& scene, Camera& camera);
 
-/* Trace the given ray through the scene */
-Color TraceRay(const Ray& ray_in, int depth, const Scene& scene);
+/* Returns true if the tile of the camera's image needs more samples with these parameters */
+bool TileNeedsSamples(const Camera& camera, const Tile& tile, const RenderParams& params);
 
-/* Determine the color the provided pixel index given the scene and camera */
-void PixelColor(std::vector<unsigned char>& rendered_image, unsigned int i, unsigned int j, const Scene& scene, Camera& camera);
+/* Returns an image of the number of samples of each pixel of the camera, for viewing where adaptive sampling spends its
+samples. The counts are scaled to the largest count and colored from black (fewest) through red and yellow to white. */
+std::vector<unsigned char> SampleCountImage(const Camera& camera);
 
 }
 
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "arena.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+
+/* Owns the resources (materials or textures) of a scene, which are referred to by their index in the table.
+Handing out handles instead of shared pointers keeps the table the sole owner of the resources' lifetimes
+and keeps reference counting out of the render path. Handles stay valid as resources are added. */
+template <typename T>
+class ResourceTable
+{
+public:
+	using Handle = std::uint32_t;
+
+public:
+	ResourceTable() {}
+	ResourceTable(ResourceTable&&) = default;
+	ResourceTable& operator=(ResourceTable&&) = default;
+
+	/* Construct a resource of type U (derived from T) from the provided arguments and return its handle.
+	The resource is allocated from the current arena (see MakeUnique) */
+	template <typename U, typename... Args>
+	Handle Add(Args&&... args)
+	{
+		resources.push_back(MakeUnique<U>(std::forward<Args>(args)...));
+		return (Handle)(resources.size() - 1);
+	}
+
+	const T& operator[](Handle handle) const { return *resources[handle]; }
+
+	size_t Size() const { return resources.size(); }
+
+private:
+	std::vector<ArenaPtr<T>> resources;
+};
+
+} /* namespace rt */
@@ -2,6 +2,8 @@
 
 #include "hittable.h"
 #include "texture.h"
+#include "material.h"
+#include "arena.h"
 
 namespace rt
 {
@@ -9,22 +11,34 @@ namespace rt
 class Scene
 {
 public:
-	Scene(HittableList& world, HittableList& lights, Texture* sky) 
-		: world(world), lights(lights), sky(sky) {}
+	/* The scene takes ownership of the materials and textures that the objects and the sky refer to, and of
+	the arena its objects were allocated from (nullptr if they were allocated from the heap) */
+	Scene(HittableList& world, HittableList& lights, TextureHandle sky, MaterialTable&& materials, TextureTable&& textures, std::unique_ptr<Arena> arena = nullptr)
+		: arena(std::move(arena)), world(world), lights(lights), sky(sky), materials(std::move(materials)), textures(std::move(textures)) {}
+
+	/* Note: assigning a scene would release its arena before the objects allocated from it */
+	Scene(Scene&&) = default;
+	Scene& operator=(Scene&&) = delete;
 
 	Color SampleSky(const Ray& ray) const
 	{
 		/* Convert the ray's direction to UV coordinates */
-		double u = 0.5 * (1.0 + (std::atan2(ray.direction.y, ray.direction.x) * InvPi));
-		double v = std::atan2(glm::length(Vec2(ray.direction.x, ray.direction.y)), ray.direction.z) * InvPi;
+		Real u = 0.5 * (1.0 + (std::atan2(ray.direction.y, ray.direction.x) * InvPi));
+		Real v = std::atan2(glm::length(Vec2(ray.direction.x, ray.direction.y)), ray.direction.z) * InvPi;
 
-		return sky->Value(u, v, ray.origin); /* Note the ray.origin is not used for most sky textures... Maybe later? */
+		return textures[sky].Value(u, v, ray.origin, textures); /* Note the ray.origin is not used for most sky textures... Maybe later? */
 	}
 
 public:
+	/* Declared first so that it is destroyed last, after everything allocated from it */
+	std::unique_ptr<Arena> arena;
+
 	HittableList world;
 	HittableList lights;
-	Texture* sky;
+	TextureHandle sky;
+
+	MaterialTable materials;
+	TextureTable textures;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+/* Compile-time selection of the SIMD instruction sets used by the ray tracer.
+AVX is enabled when the compiler targets it (e.g., /arch:AVX2 or -mavx2) and SSE is
+always available on x64. Define RT_DISABLE_SIMD to force the scalar fallbacks. */
+
+#if !defined(RT_DISABLE_SIMD)
+
+#if defined(__AVX__)
+#define RT_SIMD_AVX 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_SIMD_SSE 1
+#endif
+
+#endif /* RT_DISABLE_SIMD */
+
+#if defined(RT_SIMD_AVX) || defined(RT_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+namespace rt
+{
+
+/* Returns a human readable name of the instruction set the SIMD code paths were compiled for */
+inline const char* SIMD_InstructionSet()
+{
+#if defined(RT_SIMD_AVX)
+	return "AVX";
+#elif defined(RT_SIMD_SSE)
+	return "SSE";
+#else
+	return "Scalar";
+#endif
+}
+
+} /* namespace rt */
@@ -0,0 +1,257 @@
+#include "sphere_set.h"
+#include "simd.h"
+
+namespace rt
+{
+/* =========================== */
+/* ====== Sphere Batches ===== */
+/* =========================== */
+
+/* The four lanes of a sphere batch in Real precision: a single AVX register for doubles (or two SSE registers
+without AVX), a single SSE register for floats and a plain array for the scalar fallback */
+class SphereLanes
+{
+public:
+#if defined(RT_USE_FLOAT) && defined(RT_SIMD_SSE)
+	__m128 v;
+
+	static SphereLanes Load(const Real* p) { return { _mm_loadu_ps(p) }; }
+	static SphereLanes Set(Real x) { return { _mm_set1_ps(x) }; }
+	void Store(Real* p) const { _mm_storeu_ps(p, v); }
+
+	friend SphereLanes operator+(SphereLanes a, SphereLanes b) { return { _mm_add_ps(a.v, b.v) }; }
+	friend SphereLanes operator-(SphereLanes a, SphereLanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+	friend SphereLanes operator*(SphereLanes a, SphereLanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+	/* Square root, with negative lanes (misses) clamped to 0 */
+	friend SphereLanes ClampedSqrt(SphereLanes a) { return { _mm_sqrt_ps(_mm_max_ps(a.v, _mm_setzero_ps())) }; }
+#elif !defined(RT_USE_FLOAT) && defined(RT_SIMD_AVX)
+	__m256d v;
+
+	static SphereLanes Load(const Real* p) { return { _mm256_loadu_pd(p) }; }
+	static SphereLanes Set(Real x) { return { _mm256_set1_pd(x) }; }
+	void Store(Real* p) const { _mm256_storeu_pd(p, v); }
+
+	friend SphereLanes operator+(SphereLanes a, SphereLanes b) { return { _mm256_add_pd(a.v, b.v) }; }
+	friend SphereLanes operator-(SphereLanes a, SphereLanes b) { return { _mm256_sub_pd(a.v, b.v) }; }
+	friend SphereLanes operator*(SphereLanes a, SphereLanes b) { return { _mm256_mul_pd(a.v, b.v) }; }
+	friend SphereLanes ClampedSqrt(SphereLanes a) { return { _mm256_sqrt_pd(_mm256_max_pd(a.v, _mm256_setzero_pd())) }; }
+#elif !defined(RT_USE_FLOAT) && defined(RT_SIMD_SSE)
+	__m128d lo, hi;
+
+	static SphereLanes Load(const Real* p) { return { _mm_loadu_pd(p), _mm_loadu_pd(p + 2) }; }
+	static SphereLanes Set(Real x) { return { _mm_set1_pd(x), _mm_set1_pd(x) }; }
+	void Store(Real* p) const { _mm_storeu_pd(p, lo); _mm_storeu_pd(p + 2, hi); }
+
+	friend SphereLanes operator+(SphereLanes a, SphereLanes b) { return { _mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi) }; }
+	friend SphereLanes operator-(SphereLanes a, SphereLanes b) { return { _mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi) }; }
+	friend SphereLanes operator*(SphereLanes a, SphereLanes b) { return { _mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi) }; }
+	friend SphereLanes ClampedSqrt(SphereLanes a)
+	{
+		return { _mm_sqrt_pd(_mm_max_pd(a.lo, _mm_setzero_pd())), _mm_sqrt_pd(_mm_max_pd(a.hi, _mm_setzero_pd())) };
+	}
+#else
+	Real v[4];
+
+	static SphereLanes Load(const Real* p) { return { { p[0], p[1], p[2], p[3] } }; }
+	static SphereLanes Set(Real x) { return { { x, x, x, x } }; }
+	void Store(Real* p) const { for (int i = 0; i < 4; i++) p[i] = v[i]; }
+
+	friend SphereLanes operator+(SphereLanes a, SphereLanes b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+	friend SphereLanes operator-(SphereLanes a, SphereLanes b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+	friend SphereLanes operator*(SphereLanes a, SphereLanes b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+	friend SphereLanes ClampedSqrt(SphereLanes a) { for (int i = 0; i < 4; i++) a.v[i] = std::sqrt(std::max(a.v[i], Real(0.0))); return a; }
+#endif
+};
+
+static_assert(SphereSet::batch_size == 4, "SphereLanes holds four spheres");
+
+
+/* ======================= */
+/* ====== Sphere Set ===== */
+/* ======================= */
+
+SphereSet::SphereSet(const std::vector<SphereSetEntry>& spheres, const BVH_BuildParams& params)
+	: layout(params.layout)
+{
+	Build(spheres, params);
+}
+
+
+void SphereSet::Build(const std::vector<SphereSetEntry>& spheres, const BVH_BuildParams& params)
+{
+	std::vector<BVH_BuildPrimitive> build_prims(spheres.size());
+	for (unsigned int i = 0; i < (unsigned int)spheres.size(); i++)
+	{
+		/* Enclose the sphere at both ends of its motion */
+		const SphereSetEntry& sphere = spheres[i];
+		Vec3 r = Vec3(sphere.radius);
+		Point3 stop = sphere.center + sphere.motion_vector;
+		AABB box = AABB(AABB(sphere.center - r, sphere.center + r), AABB(stop - r, stop + r));
+
+		build_prims[i] = BVH_BuildPrimitive(box, i);
+		bounding_box = AABB(bounding_box, box);
+	}
+
+	BVH_BuildTree tree = BVH_Builder(LinearBVH_LeafParams(params)).Build(std::move(build_prims));
+
+	/* Store the spheres in the order the leaves reference them, so that every leaf is a contiguous range of the
+	arrays (spatial split builds may reference a sphere from several leaves, in which case it is stored repeatedly) */
+	size_t count = tree.prim_indices.size();
+	size_t padded_count = count + batch_size - 1;
+	for (std::vector<Real>* array : { &center_x, &center_y, &center_z, &radius, &motion_x, &motion_y, &motion_z })
+	{
+		array->assign(padded_count, 0.0);
+	}
+	materials.resize(count);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const SphereSetEntry& sphere = spheres[tree.prim_indices[i]];
+		center_x[i] = sphere.center.x;
+		center_y[i] = sphere.center.y;
+		center_z[i] = sphere.center.z;
+		radius[i] = sphere.radius;
+		motion_x[i] = sphere.motion_vector.x;
+		motion_y[i] = sphere.motion_vector.y;
+		motion_z[i] = sphere.motion_vector.z;
+		materials[i] = sphere.material;
+		moving = moving || sphere.motion_vector != Vec3(0.0);
+	}
+
+	if (layout == LayoutWide4) wide4_nodes = CollapseBVH<4>(tree);
+	else if (layout == LayoutWide8) wide8_nodes = CollapseBVH<8>(tree);
+	else linear_nodes = FlattenBVH(tree);
+}
+
+
+template <bool any_hit, typename LeafFn>
+bool SphereSet::Traverse(const Ray& ray, Interval ray_t, LeafFn intersect_leaf) const
+{
+	if (layout == LayoutWide4) return TraverseWideBVH<4, any_hit>(wide4_nodes, ray, ray_t, intersect_leaf);
+	if (layout == LayoutWide8) return TraverseWideBVH<8, any_hit>(wide8_nodes, ray, ray_t, intersect_leaf);
+	return TraverseLinearBVH<any_hit>(linear_nodes, ray, ray_t, intersect_leaf);
+}
+
+
+template <bool any_hit>
+bool SphereSet::IntersectBatch(const Ray& ray, std::uint32_t first, std::uint32_t count, Interval ray_t, Real& t, std::uint32_t& index) const
+{
+	/* With the vector from the ray origin to the center oc, h = d.oc and a = d.d, the hits are at t = (h -+ sqrt(D)) / a.
+	The discriminant D = a (r^2 - |oc - (h / a) d|^2) is computed from the distance of the center to the ray,
+	which stays accurate for large spheres (where h^2 - a (|oc|^2 - r^2) cancels catastrophically) */
+	SphereLanes cx = SphereLanes::Load(&center_x[first]);
+	SphereLanes cy = SphereLanes::Load(&center_y[first]);
+	SphereLanes cz = SphereLanes::Load(&center_z[first]);
+	if (moving)
+	{
+		SphereLanes time = SphereLanes::Set(ray.time);
+		cx = cx + time * SphereLanes::Load(&motion_x[first]);
+		cy = cy + time * SphereLanes::Load(&motion_y[first]);
+		cz = cz + time * SphereLanes::Load(&motion_z[first]);
+	}
+
+	const Real a = glm::length2(ray.direction);
+	const Real inv_a = 1.0 / a;
+	SphereLanes dx = SphereLanes::Set(ray.direction.x);
+	SphereLanes dy = SphereLanes::Set(ray.direction.y);
+	SphereLanes dz = SphereLanes::Set(ray.direction.z);
+
+	SphereLanes ocx = cx - SphereLanes::Set(ray.origin.x);
+	SphereLanes ocy = cy - SphereLanes::Set(ray.origin.y);
+	SphereLanes ocz = cz - SphereLanes::Set(ray.origin.z);
+	SphereLanes h = ocx * dx + ocy * dy + ocz * dz;
+
+	SphereLanes s = h * SphereLanes::Set(inv_a);
+	SphereLanes lx = ocx - s * dx;
+	SphereLanes ly = ocy - s * dy;
+	SphereLanes lz = ocz - s * dz;
+	SphereLanes r = SphereLanes::Load(&radius[first]);
+	SphereLanes discriminant = SphereLanes::Set(a) * (r * r - (lx * lx + ly * ly + lz * lz));
+
+	SphereLanes sqrtd = ClampedSqrt(discriminant);
+	Real near_t[batch_size], far_t[batch_size], disc[batch_size];
+	((h - sqrtd) * SphereLanes::Set(inv_a)).Store(near_t);
+	((h + sqrtd) * SphereLanes::Set(inv_a)).Store(far_t);
+	discriminant.Store(disc);
+
+	/* Find the nearest root that lies in the acceptable range (the padding lanes beyond count are ignored) */
+	bool hit = false;
+	for (std::uint32_t lane = 0; lane < count; lane++)
+	{
+		if (disc[lane] < 0.0) continue;
+
+		Real root = near_t[lane];
+		if (!ray_t.Surrounds(root))
+		{
+			root = far_t[lane];
+			if (!ray_t.Surrounds(root)) continue;
+		}
+
+		t = root;
+		index = first + lane;
+		if constexpr (any_hit) return true;
+		ray_t.max = root;
+		hit = true;
+	}
+
+	return hit;
+}
+
+
+bool SphereSet::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	return Traverse(ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		bool hit = false;
+		for (std::uint32_t i = first; i < first + count; i += batch_size)
+		{
+			Real t_hit;
+			std::uint32_t index;
+			if (IntersectBatch(ray, i, std::min(first + count - i, (std::uint32_t)batch_size), t, t_hit, index))
+			{
+				hit = true;
+				t.max = t_hit;
+				hrec.Set(this, t_hit, 0.0, 0.0, index);
+			}
+		}
+		return hit;
+		});
+}
+
+
+void SphereSet::Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const
+{
+	/* Set up the model space of the hit sphere as a unit sphere at its center (like Sphere(center, radius)), so
+	that its interaction (and solid textures) match those of a Sphere. This is done for the closest hit only. */
+	std::uint32_t i = hrec.prim_id;
+	Point3 center = Point3(center_x[i], center_y[i], center_z[i]);
+	Vec3 motion_vector = Vec3(motion_x[i], motion_y[i], motion_z[i]);
+
+	interaction.transform = Transform(glm::translate(center) * glm::scale(Vec3(radius[i])));
+	Ray model_ray = interaction.transform.WorldToModel(ray);
+
+	interaction.t = hrec.t;
+	interaction.posn = model_ray.At(hrec.t);
+
+	Vec3 outward_normal = interaction.posn - interaction.transform.VectorWorldToModel(ray.time * motion_vector);
+	Sphere::GetSphereUV(outward_normal, interaction.u, interaction.v);
+
+	interaction.SetFaceNormal(model_ray.direction, outward_normal);
+	interaction.material = materials[i];
+}
+
+
+bool SphereSet::Occluded(const Ray& ray, Real t_max) const
+{
+	return Traverse<true>(ray, Interval(RayEps, t_max), [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i += batch_size)
+		{
+			Real t_hit;
+			std::uint32_t index;
+			if (IntersectBatch<true>(ray, i, std::min(first + count - i, (std::uint32_t)batch_size), t, t_hit, index)) return true;
+		}
+		return false;
+		});
+}
+
+} /* namespace rt */
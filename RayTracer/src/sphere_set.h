@@ -0,0 +1,87 @@
+#pragma once
+
+#include "common.h"
+#include "hittable.h"
+#include "bvh_builder.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+
+#include <cstdint>
+
+namespace rt
+{
+
+/* One sphere of a SphereSet */
+class SphereSetEntry
+{
+public:
+	Point3 center; /* World space center at time 0 */
+	Real radius;
+	Vec3 motion_vector; /* World space displacement of the center at time 1 */
+	MaterialHandle material;
+
+public:
+	/* A stationary sphere, like Sphere(center, radius, material) */
+	SphereSetEntry(const Point3& center, Real radius, MaterialHandle material)
+		: center(center), radius(radius), motion_vector(Vec3(0.0)), material(material) {}
+
+	/* A moving sphere, like Sphere(start, stop, radius, material). Note: Sphere applies stop - start in
+	model space, i.e., the sphere moves by radius * (stop - start). This is kept so both look the same. */
+	SphereSetEntry(const Point3& start, const Point3& stop, Real radius, MaterialHandle material)
+		: center(start), radius(radius), motion_vector(radius * (stop - start)), material(material) {}
+};
+
+
+/* A batch of spheres for sphere heavy scenes. The centers, radii, motion vectors and materials are stored in
+SoA arrays, so unlike a Sphere a member has no transform of its own: it is a world space sphere (i.e., a unit
+sphere under a translation and uniform scale) and rays are intersected without transforming them. The set owns
+a BVH over its spheres like Mesh, whose leaves reference contiguous ranges of the arrays that are intersected
+`batch_size` spheres per SIMD step. Non-uniformly scaled spheres (ellipsoids) and spheres used as lights or
+with rotated texture coordinates should stay individual Spheres. */
+class SphereSet : public Hittable
+{
+public:
+	/* Build the set and its BVH with `params`, in the requested layout (as for Mesh) */
+	SphereSet(const std::vector<SphereSetEntry>& spheres, const BVH_BuildParams& params = BVH_BuildParams());
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	void Interaction(const Ray& ray, const HitRecord& hrec, SurfaceInteraction& interaction) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	void SetTransform(const Transform& t_transform) override { WorldSpaceTransform("SphereSet"); }
+
+	size_t SphereCount() const { return materials.size(); }
+
+public:
+	/* Number of spheres intersected per SIMD step */
+	static const int batch_size = 4;
+
+private:
+	/* SoA sphere data in BVH leaf order, padded with batch_size - 1 empty spheres so batches can always be loaded whole */
+	std::vector<Real> center_x, center_y, center_z;
+	std::vector<Real> radius;
+	std::vector<Real> motion_x, motion_y, motion_z;
+	std::vector<MaterialHandle> materials;
+	bool moving = false; /* True if any sphere has a motion vector */
+
+	BVH_Layout layout;
+	std::vector<LinearBVH_Node> linear_nodes; /* Only the nodes of the layout in use are stored */
+	std::vector<WideBVH_Node<4>> wide4_nodes;
+	std::vector<WideBVH_Node<8>> wide8_nodes;
+
+private:
+	void Build(const std::vector<SphereSetEntry>& spheres, const BVH_BuildParams& params);
+
+	/* Intersect the ray with the `count` (at most batch_size) spheres starting at `first`. Returns true if any of
+	them is hit in ray_t, with the distance and index of the nearest hit (or of any hit for occlusion queries). */
+	template <bool any_hit = false>
+	bool IntersectBatch(const Ray& ray, std::uint32_t first, std::uint32_t count, Interval ray_t, Real& t, std::uint32_t& index) const;
+
+	/* Traverse the sphere BVH in its stored layout (see TraverseLinearBVH) */
+	template <bool any_hit = false, typename LeafFn>
+	bool Traverse(const Ray& ray, Interval ray_t, LeafFn intersect_leaf) const;
+};
+
+} /* namespace rt */
@@ -3,13 +3,13 @@
 namespace rt
 {
 
-Color SolidColor::Value(double u, double v, const Point3& p) const
+Color SolidColor::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	return albedo;
 }
 
 
-Color CheckerTexture::Value(double u, double v, const Point3& p) const
+Color CheckerTexture::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	auto xInt = int(std::floor(inv_scale * p.x));
 	auto yInt = int(std::floor(inv_scale * p.y));
@@ -17,11 +17,11 @@ Color CheckerTexture::Value(double u, double v, const Point3& p) const
 
 	bool isEven = (xInt + yInt + zInt) % 2 == 0;
 
-	return isEven ? even->Value(u, v, p) : odd->Value(u, v, p);
+	return textures[isEven ? even : odd].Value(u, v, p, textures);
 }
 
 
-Color ImageTexture::Value(double u, double v, const Point3& p) const
+Color ImageTexture::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	/* If we have no texture data, then return solid cyan as a debugging aid */
 	if (image.Height() <= 0) return Color(0.0, 1.0, 1.0);
@@ -35,24 +35,24 @@ Color ImageTexture::Value(double u, double v, const Point3& p) const
 	auto j = int(v * image.Height());
 	auto pixel = image.PixelData(i, j);
 
-	double color_scale = 1.0 / 255.0;
+	Real color_scale = 1.0 / 255.0;
 	return Color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
 }
 
 
 /* ====== Perlin Noise based textures ====== */
-Color PerlinTexture::Value(double u, double v, const Point3& p) const
+Color PerlinTexture::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	/* Note: we convert the output from noise which is [-1, 1] to [0, 1] */
 	return Color(1.0, 1.0, 1.0) * 0.5 * (1.0 + noise.Noise(scale * p));
 }
 
-Color TurbulenceTexture::Value(double u, double v, const Point3& p) const
+Color TurbulenceTexture::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	return Color(1.0, 1.0, 1.0) * noise.Turbulence(p, 7);
 }
 
-Color MarbleTexture::Value(double u, double v, const Point3& p) const
+Color MarbleTexture::Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 {
 	return Color(0.5, 0.5, 0.5) * (1.0 + std::sin(scale * p.z + 10 * noise.Turbulence(p, 7)));
 }
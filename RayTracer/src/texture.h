@@ -3,17 +3,27 @@
 #include "common.h"
 #include "perlin.h"
 #include "image.h"
+#include "resource_table.h"
 
 namespace rt
 {
 
+class Texture;
+
+/* Textures are owned by the scene's texture table and referred to by handle */
+using TextureTable = ResourceTable<Texture>;
+using TextureHandle = TextureTable::Handle;
+
+
 class Texture
 {
 public:
 	Texture() {}
 	virtual ~Texture() = default;
 
-	virtual Color Value(double u, double v, const Point3& p) const
+	/* Returns the texture color at uv coordinates (u, v) and (model space) point p.
+	Textures composed of other textures look them up in the provided table. */
+	virtual Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const
 	{
 		return Color(0.0, 0.0, 0.0);
 	}
@@ -24,9 +34,9 @@ class SolidColor : public Texture
 {
 public:
 	SolidColor(const Color& albedo) : albedo(albedo) {}
-	SolidColor(double r, double g, double b) : albedo(Color(r, g, b)) {}
+	SolidColor(Real r, Real g, Real b) : albedo(Color(r, g, b)) {}
 	
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
 	Color albedo;
@@ -36,17 +46,15 @@ private:
 class CheckerTexture : public Texture
 {
 public:
-	CheckerTexture(double scale, std::shared_ptr<Texture> even, std::shared_ptr<Texture> odd) 
+	CheckerTexture(Real scale, TextureHandle even, TextureHandle odd) 
 		: inv_scale(1.0 / scale), even(even), odd(odd) {}
-	CheckerTexture(double scale, const Color& c1, const Color& c2)
-		: inv_scale(1.0 / scale), even(std::make_shared<SolidColor>(c1)), odd(std::make_shared<SolidColor>(c2)) {}
 
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
-	double inv_scale; /* 1 / scale of the texture */
-	std::shared_ptr<Texture> even; /* Texture applied to even components of the grid */
-	std::shared_ptr<Texture> odd; /* Texture applied to odd components of the grid */
+	Real inv_scale; /* 1 / scale of the texture */
+	TextureHandle even; /* Texture applied to even components of the grid */
+	TextureHandle odd; /* Texture applied to odd components of the grid */
 };
 
 class ImageTexture : public Texture
@@ -54,51 +62,66 @@ class ImageTexture : public Texture
 public:
 	ImageTexture(const char* filename) : image(filename) {}
 
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
 	Image image;
 };
 
 
+
 /* ====== Perlin Noise Based Textures ====== */
 class PerlinTexture : public Texture
 {
 public:
 	PerlinTexture() {};
-	PerlinTexture(double scale) : scale(scale) {}
+	PerlinTexture(Real scale) : scale(scale) {}
 
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
 	Perlin noise;
-	double scale = 1.0;
+	Real scale = 1.0;
 };
 
 class TurbulenceTexture : public Texture
 {
 public:
 	TurbulenceTexture() {}
-	TurbulenceTexture(double scale) : scale(scale) {}
+	TurbulenceTexture(Real scale) : scale(scale) {}
 
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
 	Perlin noise;
-	double scale = 1.0;
+	Real scale = 1.0;
 };
 
 class MarbleTexture : public Texture
 {
 public:
 	MarbleTexture() {}
-	MarbleTexture(double scale) : scale(scale) {}
+	MarbleTexture(Real scale) : scale(scale) {}
 
-	Color Value(double u, double v, const Point3& p) const override;
+	Color Value(Real u, Real v, const Point3& p, const TextureTable& textures) const override;
 
 private:
 	Perlin noise;
-	double scale = 1.0;
+	Real scale = 1.0;
 };
 
+
+
+/* Add a solid color texture to the table and return its handle */
+inline TextureHandle AddSolidColor(TextureTable& textures, const Color& albedo)
+{
+	return textures.Add<SolidColor>(albedo);
+}
+
+/* Add a checker texture alternating between two solid colors (and the two colors) to the table and return its handle */
+inline TextureHandle AddChecker(TextureTable& textures, Real scale, const Color& c1, const Color& c2)
+{
+	return textures.Add<CheckerTexture>(scale, AddSolidColor(textures, c1), AddSolidColor(textures, c2));
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+
+namespace rt
+{
+/* =========================== */
+/* ====== Tile Ordering ====== */
+/* =========================== */
+
+/* Interleave the bits of x and y (x in the even bits) */
+static std::uint64_t MortonCode(std::uint32_t x, std::uint32_t y)
+{
+	std::uint64_t code = 0;
+	for (int bit = 0; bit < 32; bit++)
+	{
+		code |= (std::uint64_t)((x >> bit) & 1) << (2 * bit);
+		code |= (std::uint64_t)((y >> bit) & 1) << (2 * bit + 1);
+	}
+	return code;
+}
+
+std::vector<Tile> GenerateTiles(unsigned int width, unsigned int height, unsigned int tile_size, TileOrder order)
+{
+	tile_size = std::max(1u, tile_size);
+	unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+	unsigned int tiles_y = (height + tile_size - 1) / tile_size;
+
+	/* Sort keys of the tiles in scanline order */
+	std::vector<std::pair<double, std::uint32_t>> keys(tiles_x * tiles_y);
+	for (unsigned int ty = 0; ty < tiles_y; ty++)
+	{
+		for (unsigned int tx = 0; tx < tiles_x; tx++)
+		{
+			std::uint32_t index = ty * tiles_x + tx;
+			double key = index;
+
+			if (order == TileOrderMorton)
+			{
+				key = (double)MortonCode(tx, ty);
+			}
+			else if (order == TileOrderSpiral)
+			{
+				/* Ring around the center tile first, then the angle within the ring */
+				double dx = tx + 0.5 - 0.5 * tiles_x;
+				double dy = ty + 0.5 - 0.5 * tiles_y;
+				double ring = std::floor(std::max(std::fabs(dx), std::fabs(dy)));
+				key = ring * 8.0 + (std::atan2(dy, dx) + Pi);
+			}
+
+			keys[index] = { key, index };
+		}
+	}
+
+	std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::vector<Tile> tiles(keys.size());
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		unsigned int tx = keys[i].second % tiles_x;
+		unsigned int ty = keys[i].second / tiles_x;
+		tiles[i].x0 = tx * tile_size;
+		tiles[i].y0 = ty * tile_size;
+		tiles[i].x1 = std::min(width, tiles[i].x0 + tile_size);
+		tiles[i].y1 = std::min(height, tiles[i].y0 + tile_size);
+	}
+
+	return tiles;
+}
+
+
+/* ============================ */
+/* ====== Tile Scheduler ====== */
+/* ============================ */
+
+TileScheduler::TileScheduler(int thread_count)
+{
+	if (thread_count <= 0) thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+
+	/* Create all workers before starting any of them, since they steal from each other */
+	for (int i = 0; i < thread_count; i++) workers.push_back(std::make_unique<Worker>());
+	for (int i = 0; i < thread_count; i++) workers[i]->thread = std::thread(&TileScheduler::WorkerLoop, this, i);
+}
+
+TileScheduler::~TileScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	start_condition.notify_all();
+
+	for (auto& worker : workers) worker->thread.join();
+}
+
+void TileScheduler::Run(const std::vector<Tile>& job_tiles, const std::function<void(const Tile&, int)>& job_process_tile)
+{
+	if (job_tiles.empty()) return;
+
+	/* Split the tiles into equal contiguous shares */
+	size_t worker_count = workers.size();
+	for (size_t w = 0; w < worker_count; w++)
+	{
+		std::lock_guard<std::mutex> lock(workers[w]->mutex);
+		for (size_t i = w * job_tiles.size() / worker_count; i < (w + 1) * job_tiles.size() / worker_count; i++)
+		{
+			workers[w]->queue.push_back((std::uint32_t)i);
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	tiles = &job_tiles;
+	process_tile = &job_process_tile;
+	busy_workers = (int)worker_count;
+	job++;
+	start_condition.notify_all();
+
+	done_condition.wait(lock, [this] { return busy_workers == 0; });
+	tiles = nullptr;
+	process_tile = nullptr;
+}
+
+void TileScheduler::WorkerLoop(int index)
+{
+	SeedThreadRandom(0x9E3779B97F4A7C15ull * (std::uint64_t)(index + 1));
+
+	Worker& worker = *workers[index];
+	std::uint64_t last_job = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start_condition.wait(lock, [&] { return stop || job != last_job; });
+			if (stop) break;
+			last_job = job;
+		}
+
+		std::uint32_t tile;
+		while (NextTile(index, tile))
+		{
+			{
+				ArenaScope scope(&worker.scratch);
+				(*process_tile)((*tiles)[tile], index);
+			}
+			worker.scratch.Reset();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busy_workers == 0) done_condition.notify_one();
+	}
+
+	worker.scratch.Release();
+}
+
+bool TileScheduler::NextTile(int index, std::uint32_t& tile)
+{
+	{
+		Worker& own = *workers[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.queue.empty())
+		{
+			tile = own.queue.front();
+			own.queue.pop_front();
+			return true;
+		}
+	}
+
+	/* Steal from the back of the other queues, starting with the next worker */
+	for (size_t i = 1; i < workers.size(); i++)
+	{
+		Worker& victim = *workers[(index + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.queue.empty())
+		{
+			tile = victim.queue.back();
+			victim.queue.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+} /* namespace rt */
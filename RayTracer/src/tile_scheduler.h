@@ -0,0 +1,95 @@
+#pragma once
+
+#include "common.h"
+#include "arena.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rt
+{
+
+/* Order in which the tiles of an image are handed out */
+enum TileOrder
+{
+	TileOrderScanline, /* Row by row */
+	TileOrderMorton, /* Along a Z-order curve, so consecutive tiles are close to each other */
+	TileOrderSpiral, /* Outward from the center of the image */
+};
+
+
+/* A rectangle of pixels [x0, x1) x [y0, y1) of an image */
+class Tile
+{
+public:
+	unsigned int x0, y0;
+	unsigned int x1, y1;
+
+public:
+	unsigned int PixelCount() const { return (x1 - x0) * (y1 - y0); }
+};
+
+
+/* Split a width x height image into square tiles of tile_size pixels per side (smaller at the right and bottom
+edges of the image) and return them in the requested order */
+std::vector<Tile> GenerateTiles(unsigned int width, unsigned int height, unsigned int tile_size, TileOrder order);
+
+
+/* A pool of persistent worker threads that process the tiles of an image. Each call to Run gives every worker an
+equal, contiguous share of the tiles (in order) in its own queue. Workers take tiles from the front of their own
+queue and, once it is empty, steal from the back of the other workers' queues, so that nearby tiles stay on the
+same worker and the load is balanced at the end. Every worker has its own random number generators (seeded with
+its index, see SeedThreadRandom) and its own scratch arena, which is the current arena (see ArenaScope) while it
+processes a tile and is reset (keeping its memory) after each one. */
+class TileScheduler
+{
+public:
+	/* Start thread_count workers (0 uses all hardware threads) */
+	explicit TileScheduler(int thread_count = 0);
+	~TileScheduler();
+
+	TileScheduler(const TileScheduler&) = delete;
+	TileScheduler& operator=(const TileScheduler&) = delete;
+
+	int ThreadCount() const { return (int)workers.size(); }
+
+	/* Call process_tile(tile, worker index) for every tile on the workers and return once all tiles are done.
+	Note: Run must not be called from several threads at once. */
+	void Run(const std::vector<Tile>& tiles, const std::function<void(const Tile&, int)>& process_tile);
+
+private:
+	class Worker
+	{
+	public:
+		std::thread thread;
+		std::mutex mutex; /* Guards queue */
+		std::deque<std::uint32_t> queue; /* Indices of the tiles left to this worker */
+		Arena scratch;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	/* The current job, guarded by mutex */
+	std::mutex mutex;
+	std::condition_variable start_condition; /* Signaled when a job is started or the workers are stopped */
+	std::condition_variable done_condition; /* Signaled when the last worker finished the job */
+	const std::vector<Tile>* tiles = nullptr;
+	const std::function<void(const Tile&, int)>* process_tile = nullptr;
+	std::uint64_t job = 0; /* Incremented for every job */
+	int busy_workers = 0;
+	bool stop = false;
+
+private:
+	void WorkerLoop(int index);
+
+	/* Take the next tile of the worker's own queue, or steal one from another worker. Returns false if there are none left */
+	bool NextTile(int index, std::uint32_t& tile);
+};
+
+} /* namespace rt */
@@ -5,25 +5,84 @@
 namespace rt
 {
 
+/* An affine transformation stored as a 3x4 matrix: the linear part (rotation, scale and shear)
+and the translation. The implicit last row of the equivalent 4x4 matrix is always (0, 0, 0, 1). */
+class AffineMatrix
+{
+public:
+	Mat3 linear = Mat3(1.0);
+	Vec3 translation = Vec3(0.0);
+
+public:
+	AffineMatrix() {}
+	AffineMatrix(const Mat3& linear, const Vec3& translation) : linear(linear), translation(translation) {}
+
+	/* Note: the last row of `m` is assumed to be (0, 0, 0, 1) */
+	explicit AffineMatrix(const Mat4& m) : linear(Mat3(m)), translation(Vec3(m[3])) {}
+
+	Mat4 ToMat4() const
+	{
+		Mat4 m = Mat4(linear);
+		m[3] = Vec4(translation, 1.0);
+		return m;
+	}
+
+	Point3 TransformPoint(const Point3& p) const
+	{
+		/* Summed in the same order as the 4x4 matrix product (see glm's mat4 * vec4) so the results are identical */
+		return (linear[0] * p.x + linear[1] * p.y) + (linear[2] * p.z + translation);
+	}
+
+	Vec3 TransformVector(const Vec3& v) const
+	{
+		return linear * v;
+	}
+
+	/* Returns the transform that first applies `inner` and then this one */
+	AffineMatrix operator*(const AffineMatrix& inner) const
+	{
+		return AffineMatrix(linear * inner.linear, linear * inner.translation + translation);
+	}
+};
+
+
 class Transform
 {
 public:
 	/* Stores the model matrix of the Object. */
-	Mat4 model_to_world = Mat4(1.0);
+	AffineMatrix model_to_world;
 
 	/* Stores the world to model transformation matrix. The ray's origin and
-	direction will be multiplied by this matrix to transform it to model space. 
-	It is the inverse of the model matrix */
-	Mat4 world_to_model = Mat4(1.0);
-
-	/* Stores the inverse transpose of the model matrix which is used to update surface normals. 
-	This is so that normals for non-uniform scaling stay perpendicular to the surface of
-	the object. */
-	Mat4 normal_to_world = Mat4(1.0);
+	direction will be multiplied by this matrix to transform it to model space.
+	It is the inverse of the model matrix. Normals are transformed by its transpose
+	(the inverse transpose of the model matrix) so that they stay perpendicular to
+	the surface of the object under non-uniform scaling. */
+	AffineMatrix world_to_model;
 
 public:
 	Transform() {}
-	Transform(Mat4 model_to_world) : model_to_world(model_to_world), world_to_model(glm::inverse(model_to_world)), normal_to_world(glm::inverseTranspose(model_to_world)) {}
+	Transform(const Mat4& model_to_world) { SetMatrix(model_to_world); }
+
+
+	/* Returns true if this is the identity transform (rays are then passed through untouched) */
+	bool IsIdentity() const { return kind == Identity; }
+
+	/* Returns the model matrix as a 4x4 matrix, e.g., to combine it with further glm transforms */
+	Mat4 Matrix() const { return model_to_world.ToMat4(); }
+
+	/* Returns the transform that first applies `inner` and then this transform.
+	E.g., an instance's transform composed with the transform of an object inside it. */
+	Transform Compose(const Transform& inner) const
+	{
+		if (inner.kind == Identity) return *this;
+		if (kind == Identity) return inner;
+
+		Transform t;
+		t.model_to_world = model_to_world * inner.model_to_world;
+		t.world_to_model = inner.world_to_model * world_to_model;
+		t.kind = Classify(t.model_to_world, t.world_to_model);
+		return t;
+	}
 
 
 	/* === Functions that apply the transformation === */
@@ -31,47 +90,55 @@ public:
 	/* Transform ray from world space to model space */
 	Ray WorldToModel(const Ray& world_ray) const
 	{
-		Point3 origin = world_to_model * Vec4(world_ray.origin, 1.0);
-		Vec3 direction = world_to_model * Vec4(world_ray.direction, 0.0);
-		return Ray(origin, direction, world_ray.time);
+		if (kind == Identity) return world_ray;
+		return Ray(PointWorldToModel(world_ray.origin), VectorWorldToModel(world_ray.direction), world_ray.time);
 	}
 
 	/* Transform ray from model space to world space */
 	Ray ModelToWorld(const Ray& model_ray) const
 	{
-		Point3 origin = model_to_world * Vec4(model_ray.origin, 1.0);
-		Vec3 direction = model_to_world * Vec4(model_ray.direction, 0.0);
-		return Ray(origin, direction, model_ray.time);
+		if (kind == Identity) return model_ray;
+		return Ray(PointModelToWorld(model_ray.origin), VectorModelToWorld(model_ray.direction), model_ray.time);
 	}
 
 	/* Transform point from model space to world space */
 	Point3 PointModelToWorld(const Point3& model_point) const
 	{
-		return model_to_world * Vec4(model_point, 1.0);
+		return ApplyToPoint(model_to_world, model_point);
 	}
 
 	/* Transform vector from model space to world space */
 	Vec3 VectorModelToWorld(const Vec3& model_vector) const
 	{
-		return model_to_world * Vec4(model_vector, 0.0);
+		return ApplyToVector(model_to_world, model_vector);
 	}
 
 	/* Transform point from world space to model space */
 	Point3 PointWorldToModel(const Point3& world_point) const
 	{
-		return world_to_model * Vec4(world_point, 1.0);
+		return ApplyToPoint(world_to_model, world_point);
 	}
 
 	/* Transform vector from world space to model space */
 	Vec3 VectorWorldToModel(const Vec3& world_vector) const
 	{
-		return world_to_model * Vec4(world_vector, 0.0);
+		return ApplyToVector(world_to_model, world_vector);
 	}
 
-	/* Transform the normal from model space to world space */
+	/* Transform the normal from model space to world space (the result is not normalized) */
 	Vec3 GetWorldNormal(const Vec3& model_normal) const
 	{
-		return normal_to_world * Vec4(model_normal, 0.0);
+		switch (kind)
+		{
+		case Identity:
+		case Translation:
+			return model_normal;
+		case UniformScale:
+			return world_to_model.linear[0][0] * model_normal;
+		default:
+			/* n * M is the product with the transpose of M */
+			return model_normal * world_to_model.linear;
+		}
 	}
 
 
@@ -79,54 +146,106 @@ public:
 
 	void SetIdentity()
 	{
-		model_to_world = Mat4(1.0);
-		world_to_model = Mat4(1.0);
-		normal_to_world = Mat4(1.0);
+		model_to_world = AffineMatrix();
+		world_to_model = AffineMatrix();
+		kind = Identity;
+	}
+
+	/* Replace the model matrix. Note: its last row must be (0, 0, 0, 1) */
+	void SetMatrix(const Mat4& m)
+	{
+		model_to_world = AffineMatrix(m);
+		world_to_model = AffineMatrix(glm::inverse(m));
+		kind = Classify(model_to_world, world_to_model);
 	}
 
 	void Translate(const Vec3& v)
 	{
-		model_to_world *= glm::translate(v);
-		UpdateMatrices();
+		SetMatrix(Matrix() * glm::translate(v));
 	}
 
-	void Translate(double x, double y, double z)
+	void Translate(Real x, Real y, Real z)
 	{
-		model_to_world *= glm::translate(Vec3(x, y, z));
-		UpdateMatrices();
+		SetMatrix(Matrix() * glm::translate(Vec3(x, y, z)));
 	}
 
 	void Scale(const Vec3& s)
 	{
-		model_to_world *= glm::scale(s);
-		UpdateMatrices();
+		SetMatrix(Matrix() * glm::scale(s));
 	}
 
-	void Scale(double x, double y, double z)
+	void Scale(Real x, Real y, Real z)
 	{
-		model_to_world *= glm::scale(Vec3(x, y, z));
-		UpdateMatrices();
+		SetMatrix(Matrix() * glm::scale(Vec3(x, y, z)));
 	}
 
-	void Scale(double s)
+	void Scale(Real s)
 	{
-		model_to_world *= glm::scale(Vec3(s));
-		UpdateMatrices();
+		SetMatrix(Matrix() * glm::scale(Vec3(s)));
 	}
 
-	void Rotate(double deg, const Vec3& axis)
+	void Rotate(Real deg, const Vec3& axis)
 	{
-		double rad = glm::radians(deg);
-		model_to_world *= glm::rotate(rad, axis);
-		UpdateMatrices();
+		Real rad = glm::radians(deg);
+		SetMatrix(Matrix() * glm::rotate(rad, axis));
 	}
 
 private:
-	/* Update the world_to_model and normal_to_world matrices based on current model_to_world */
-	inline void UpdateMatrices()
+	/* Most scene transforms only move or uniformly scale an object. These get fast paths that skip the
+	full matrix products (the results are the same since the skipped terms are exact zeros and ones). */
+	enum Kind
+	{
+		Identity,
+		Translation, /* Identity linear part */
+		UniformScale, /* Linear part is a multiple of the identity (in both directions) */
+		General,
+	};
+
+	Kind kind = Identity;
+
+private:
+	static Kind Classify(const AffineMatrix& forward, const AffineMatrix& inverse)
+	{
+		const Mat3& l = forward.linear;
+		const Mat3& il = inverse.linear;
+
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				if (i != j && (l[i][j] != 0.0 || il[i][j] != 0.0)) return General;
+			}
+		}
+
+		if (l[0][0] != l[1][1] || l[0][0] != l[2][2] || il[0][0] != il[1][1] || il[0][0] != il[2][2]) return General;
+		if (l[0][0] != 1.0 || il[0][0] != 1.0) return UniformScale;
+		if (forward.translation != Vec3(0.0)) return Translation;
+		return Identity;
+	}
+
+	Point3 ApplyToPoint(const AffineMatrix& m, const Point3& p) const
+	{
+		switch (kind)
+		{
+		case Identity: return p;
+		case Translation: return p + m.translation;
+		case UniformScale: return m.linear[0][0] * p + m.translation;
+		default: return m.TransformPoint(p);
+		}
+	}
+
+	Vec3 ApplyToVector(const AffineMatrix& m, const Vec3& v) const
 	{
-		world_to_model = glm::inverse(model_to_world);
-		normal_to_world = glm::transpose(world_to_model); /* i.e., inverse transpose of model_to_world */
+		switch (kind)
+		{
+		case Identity:
+		case Translation:
+			return v;
+		case UniformScale:
+			return m.linear[0][0] * v;
+		default:
+			return m.TransformVector(v);
+		}
 	}
 
 };
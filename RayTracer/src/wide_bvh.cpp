@@ -0,0 +1,321 @@
+#include "wide_bvh.h"
+
+#include <bit>
+#include <cmath>
+#include <thread>
+
+namespace rt
+{
+/* ====================== */
+/* ====== BVH Node ====== */
+/* ====================== */
+
+template <int N>
+void WideBVH_Node<N>::SetBounds(int slot, const AABB& box)
+{
+	float* mins[3] = { min_x, min_y, min_z };
+	float* maxs[3] = { max_x, max_y, max_z };
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const Interval& ax = box.AxisInterval(axis);
+
+		float lo = (float)ax.min;
+		float hi = (float)ax.max;
+		if ((double)lo > ax.min) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+		if ((double)hi < ax.max) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+
+		mins[axis][slot] = lo;
+		maxs[axis][slot] = hi;
+	}
+}
+
+
+template <int N>
+void WideBVH_Node<N>::Clear(int slot)
+{
+	const float inf = std::numeric_limits<float>::infinity();
+	min_x[slot] = min_y[slot] = min_z[slot] = inf;
+	max_x[slot] = max_y[slot] = max_z[slot] = -inf;
+	child[slot] = empty_slot;
+	prim_count[slot] = 0;
+}
+
+
+template <int N>
+AABB WideBVH_Node<N>::Bounds(int slot) const
+{
+	return AABB(Interval(min_x[slot], max_x[slot]), Interval(min_y[slot], max_y[slot]), Interval(min_z[slot], max_z[slot]));
+}
+
+
+/* ======================= */
+/* ====== Collapsing ===== */
+/* ======================= */
+
+/* Collapse the binary subtree rooted at `build_index` (an interior node) into a wide node and return its index */
+template <int N>
+static std::uint32_t CollapseNode(const BVH_BuildTree& tree, unsigned int build_index, std::vector<WideBVH_Node<N>>& nodes)
+{
+	std::uint32_t wide_index = (std::uint32_t)nodes.size();
+	nodes.emplace_back();
+
+	/* Start with the two children and keep opening the interior child with the largest
+	surface area (the one most likely to be hit) until all N slots are filled */
+	unsigned int children[N];
+	int child_count = 0;
+	children[child_count++] = tree.nodes[build_index].left;
+	children[child_count++] = tree.nodes[build_index].right;
+
+	while (child_count < N)
+	{
+		int best = -1;
+		double best_area = -1.0;
+		for (int i = 0; i < child_count; i++)
+		{
+			const BVH_BuildNode& candidate = tree.nodes[children[i]];
+			if (candidate.IsLeaf()) continue;
+
+			double area = candidate.bounds.SurfaceArea();
+			if (area > best_area)
+			{
+				best = i;
+				best_area = area;
+			}
+		}
+
+		if (best < 0) break;
+
+		unsigned int opened = children[best];
+		children[best] = tree.nodes[opened].left;
+		children[child_count++] = tree.nodes[opened].right;
+	}
+
+	for (int slot = 0; slot < N; slot++)
+	{
+		if (slot >= child_count)
+		{
+			nodes[wide_index].Clear(slot);
+			continue;
+		}
+
+		const BVH_BuildNode& build_child = tree.nodes[children[slot]];
+		std::uint32_t child, prim_count;
+		if (build_child.IsLeaf())
+		{
+			child = build_child.first_prim;
+			prim_count = build_child.prim_count;
+		}
+		else
+		{
+			/* Note: recursing may reallocate the node array so the node is indexed again below */
+			child = CollapseNode<N>(tree, children[slot], nodes);
+			prim_count = 0;
+		}
+
+		WideBVH_Node<N>& node = nodes[wide_index];
+		node.SetBounds(slot, build_child.bounds);
+		node.child[slot] = child;
+		node.prim_count[slot] = prim_count;
+	}
+
+	return wide_index;
+}
+
+
+template <int N>
+std::vector<WideBVH_Node<N>> CollapseBVH(const BVH_BuildTree& tree)
+{
+	std::vector<WideBVH_Node<N>> nodes;
+	if (tree.nodes.empty()) return nodes;
+
+	if (tree.nodes[0].IsLeaf())
+	{
+		/* A single leaf still needs a root node to hold its bounds */
+		WideBVH_Node<N> root;
+		for (int slot = 0; slot < N; slot++) root.Clear(slot);
+		root.SetBounds(0, tree.nodes[0].bounds);
+		root.child[0] = tree.nodes[0].first_prim;
+		root.prim_count[0] = tree.nodes[0].prim_count;
+		nodes.push_back(root);
+		return nodes;
+	}
+
+	nodes.reserve(tree.nodes.size() / (N - 1) + 1);
+	CollapseNode<N>(tree, 0, nodes);
+	return nodes;
+}
+
+
+/* ====================== */
+/* ====== Wide BVH ====== */
+/* ====================== */
+
+template <int N>
+WideBVH<N>::WideBVH(const HittableList& list, const BVH_BuildParams& params)
+	: primitives(list.objects)
+{
+	for (const auto& primitive : primitives) bounding_box = AABB(bounding_box, primitive->BoundingBox());
+	closed = list.IsClosed();
+	Build(params);
+}
+
+
+template <int N>
+void WideBVH<N>::Build(const BVH_BuildParams& params)
+{
+	BVH_BuildTree tree = BuildHittableTree(primitives, params);
+	sah_cost = tree.SAH_Cost(params);
+
+	primitive_indices.assign(tree.prim_indices.begin(), tree.prim_indices.end());
+	nodes = CollapseBVH<N>(tree);
+	built_wide_cost = ComputeWideCost(params);
+}
+
+
+template <int N>
+bool WideBVH<N>::Refit(const BVH_BuildParams& params)
+{
+	if (nodes.empty()) return false;
+
+	bounding_box = RefitNode(0, BVH_RefitThreadDepth(primitives.size(), params));
+
+	if (params.refit_rebuild_threshold <= 0.0 || ComputeWideCost(params) <= params.refit_rebuild_threshold * built_wide_cost) return false;
+
+	Build(params);
+	return true;
+}
+
+
+template <int N>
+AABB WideBVH<N>::RefitNode(std::uint32_t index, int thread_depth)
+{
+	/* A wide level spans log2(N) binary levels */
+	const int binary_levels = std::countr_zero((unsigned int)N);
+
+	AABB slot_bounds[N];
+	std::vector<std::thread> workers;
+	for (int slot = 0; slot < N; slot++)
+	{
+		const WideBVH_Node<N>& node = nodes[index];
+		if (node.IsEmpty(slot)) continue;
+
+		if (node.IsLeaf(slot))
+		{
+			for (std::uint32_t i = node.child[slot]; i < node.child[slot] + node.prim_count[slot]; i++)
+			{
+				slot_bounds[slot] = AABB(slot_bounds[slot], primitives[primitive_indices[i]]->BoundingBox());
+			}
+		}
+		else if (thread_depth > 0)
+		{
+			std::uint32_t child = node.child[slot];
+			workers.emplace_back([this, &slot_bounds, slot, child, thread_depth, binary_levels]() {
+				slot_bounds[slot] = RefitNode(child, thread_depth - binary_levels);
+				});
+		}
+		else
+		{
+			slot_bounds[slot] = RefitNode(node.child[slot], 0);
+		}
+	}
+	for (auto& worker : workers) worker.join();
+
+	AABB bounds;
+	WideBVH_Node<N>& node = nodes[index];
+	for (int slot = 0; slot < N; slot++)
+	{
+		if (node.IsEmpty(slot)) continue;
+		node.SetBounds(slot, slot_bounds[slot]);
+		bounds = AABB(bounds, slot_bounds[slot]);
+	}
+	return bounds;
+}
+
+
+template <int N>
+double WideBVH<N>::ComputeWideCost(const BVH_BuildParams& params) const
+{
+	/* Children are stored after their parents, so a reverse sweep visits children first */
+	std::vector<double> cost(nodes.size());
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		const WideBVH_Node<N>& node = nodes[i];
+
+		AABB bounds;
+		double weighted_cost = 0.0;
+		for (int slot = 0; slot < N; slot++)
+		{
+			if (node.IsEmpty(slot)) continue;
+
+			AABB slot_bounds = node.Bounds(slot);
+			double slot_cost = node.IsLeaf(slot) ? SAH_LeafCost(node.prim_count[slot], params) : cost[node.child[slot]];
+			weighted_cost += slot_bounds.SurfaceArea() * slot_cost;
+			bounds = AABB(bounds, slot_bounds);
+		}
+
+		cost[i] = params.traversal_cost + weighted_cost / bounds.SurfaceArea();
+	}
+
+	return cost[0];
+}
+
+
+template <int N>
+bool WideBVH<N>::Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const
+{
+	return TraverseWideBVH<N>(nodes, ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		bool hit = false;
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->Hit(ray, t, hrec))
+			{
+				hit = true;
+				t.max = hrec.t;
+			}
+		}
+		return hit;
+		});
+}
+
+
+template <int N>
+bool WideBVH<N>::Occluded(const Ray& ray, Real t_max) const
+{
+	return TraverseWideBVH<N, true>(nodes, ray, Interval(RayEps, t_max), [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->Occluded(ray, t.max)) return true;
+		}
+		return false;
+		});
+}
+
+
+template <int N>
+bool WideBVH<N>::HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const
+{
+	if (!closed) return Hittable::HitInterval(ray, ray_t, spans);
+
+	bool hit = false;
+	TraverseWideBVH<N>(nodes, ray, ray_t, [&](std::uint32_t first, std::uint32_t count, Interval& t) {
+		for (std::uint32_t i = first; i < first + count; i++)
+		{
+			if (primitives[primitive_indices[i]]->HitInterval(ray, t, spans)) hit = true;
+		}
+		return false; /* Keep the full interval to find all spans */
+		});
+
+	return hit;
+}
+
+
+/* Explicit instantiations for the supported widths */
+template class WideBVH_Node<4>;
+template class WideBVH_Node<8>;
+template std::vector<WideBVH_Node<4>> CollapseBVH<4>(const BVH_BuildTree& tree);
+template std::vector<WideBVH_Node<8>> CollapseBVH<8>(const BVH_BuildTree& tree);
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+} /* namespace rt */
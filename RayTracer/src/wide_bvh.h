@@ -0,0 +1,271 @@
+#pragma once
+
+#include "common.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_builder.h"
+#include "simd.h"
+
+#include <cstdint>
+
+namespace rt
+{
+
+/* A node of an N-wide BVH. The bounds of all N children are stored in SoA float layout so
+that a ray can be tested against all of them at once. Empty slots have inverted bounds. */
+template <int N>
+class alignas(32) WideBVH_Node
+{
+public:
+	float min_x[N], min_y[N], min_z[N];
+	float max_x[N], max_y[N], max_z[N];
+	std::uint32_t child[N]; /* Interior children: node index. Leaves: first entry in the primitive index array */
+	std::uint32_t prim_count[N]; /* 0 for interior children and empty slots */
+
+public:
+	static const std::uint32_t empty_slot = UINT32_MAX;
+
+	bool IsEmpty(int slot) const { return child[slot] == empty_slot; }
+	bool IsLeaf(int slot) const { return prim_count[slot] > 0; }
+
+	/* Store the provided child bounds, rounding outwards to float */
+	void SetBounds(int slot, const AABB& box);
+
+	/* Mark the slot as empty (its bounds can never be hit) */
+	void Clear(int slot);
+
+	/* Returns the bounds of a slot as an AABB */
+	AABB Bounds(int slot) const;
+};
+
+
+/* A ray prepared for the float SIMD box tests */
+class WideBVH_Ray
+{
+public:
+	float origin[3];
+	float inv_direction[3];
+	bool direction_is_negative[3];
+
+public:
+	WideBVH_Ray(const Ray& ray)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			origin[axis] = (float)ray.origin[axis];
+			inv_direction[axis] = (float)(1.0 / ray.direction[axis]);
+			direction_is_negative[axis] = inv_direction[axis] < 0.0f;
+		}
+	}
+};
+
+
+/* Test the ray against all N child boxes of a node. Returns a bitmask of the children that are
+hit within [t_min, t_max] and writes their entry distances into t_near. */
+template <int N>
+inline int IntersectWideNode(const WideBVH_Node<N>& node, const WideBVH_Ray& ray, float t_min, float t_max, float* t_near)
+{
+	/* Select the near and far planes per axis once, based on the ray direction */
+	const float* near_x = ray.direction_is_negative[0] ? node.max_x : node.min_x;
+	const float* far_x = ray.direction_is_negative[0] ? node.min_x : node.max_x;
+	const float* near_y = ray.direction_is_negative[1] ? node.max_y : node.min_y;
+	const float* far_y = ray.direction_is_negative[1] ? node.min_y : node.max_y;
+	const float* near_z = ray.direction_is_negative[2] ? node.max_z : node.min_z;
+	const float* far_z = ray.direction_is_negative[2] ? node.min_z : node.max_z;
+
+	/* Widen the far distance slightly to compensate for float rounding in the slab test */
+	const float far_scale = 1.0f + 4.0f * std::numeric_limits<float>::epsilon();
+
+	int mask = 0;
+
+#if defined(RT_SIMD_AVX)
+	if constexpr (N == 8)
+	{
+		const __m256 ox = _mm256_set1_ps(ray.origin[0]), oy = _mm256_set1_ps(ray.origin[1]), oz = _mm256_set1_ps(ray.origin[2]);
+		const __m256 ix = _mm256_set1_ps(ray.inv_direction[0]), iy = _mm256_set1_ps(ray.inv_direction[1]), iz = _mm256_set1_ps(ray.inv_direction[2]);
+
+		/* Note: _mm256_max_ps/_mm256_min_ps return the second operand if either is NaN, so NaN planes are ignored */
+		__m256 tn = _mm256_set1_ps(t_min);
+		__m256 tf = _mm256_set1_ps(t_max);
+		tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_x), ox), ix), tn);
+		tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_y), oy), iy), tn);
+		tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_z), oz), iz), tn);
+		tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_x), ox), ix), tf);
+		tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_y), oy), iy), tf);
+		tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_z), oz), iz), tf);
+		tf = _mm256_mul_ps(tf, _mm256_set1_ps(far_scale));
+
+		_mm256_storeu_ps(t_near, tn);
+		return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+	}
+#endif
+
+#if defined(RT_SIMD_SSE)
+	if constexpr (N % 4 == 0)
+	{
+		const __m128 ox = _mm_set1_ps(ray.origin[0]), oy = _mm_set1_ps(ray.origin[1]), oz = _mm_set1_ps(ray.origin[2]);
+		const __m128 ix = _mm_set1_ps(ray.inv_direction[0]), iy = _mm_set1_ps(ray.inv_direction[1]), iz = _mm_set1_ps(ray.inv_direction[2]);
+
+		for (int i = 0; i < N; i += 4)
+		{
+			/* Note: _mm_max_ps/_mm_min_ps return the second operand if either is NaN, so NaN planes are ignored */
+			__m128 tn = _mm_set1_ps(t_min);
+			__m128 tf = _mm_set1_ps(t_max);
+			tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x + i), ox), ix), tn);
+			tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y + i), oy), iy), tn);
+			tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z + i), oz), iz), tn);
+			tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x + i), ox), ix), tf);
+			tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y + i), oy), iy), tf);
+			tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z + i), oz), iz), tf);
+			tf = _mm_mul_ps(tf, _mm_set1_ps(far_scale));
+
+			_mm_storeu_ps(t_near + i, tn);
+			mask |= _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << i;
+		}
+		return mask;
+	}
+#endif
+
+	/* Scalar fallback */
+	for (int i = 0; i < N; i++)
+	{
+		float tn = t_min;
+		float tf = t_max;
+		float t;
+		if ((t = (near_x[i] - ray.origin[0]) * ray.inv_direction[0]) > tn) tn = t;
+		if ((t = (near_y[i] - ray.origin[1]) * ray.inv_direction[1]) > tn) tn = t;
+		if ((t = (near_z[i] - ray.origin[2]) * ray.inv_direction[2]) > tn) tn = t;
+		if ((t = (far_x[i] - ray.origin[0]) * ray.inv_direction[0]) < tf) tf = t;
+		if ((t = (far_y[i] - ray.origin[1]) * ray.inv_direction[1]) < tf) tf = t;
+		if ((t = (far_z[i] - ray.origin[2]) * ray.inv_direction[2]) < tf) tf = t;
+		t_near[i] = tn;
+		if (tn <= tf * far_scale) mask |= 1 << i;
+	}
+	return mask;
+}
+
+
+/* Collapse a binary build tree into N-wide nodes. The root is node 0 */
+template <int N>
+std::vector<WideBVH_Node<N>> CollapseBVH(const BVH_BuildTree& tree);
+
+
+/* Iterative, nearest-child-first traversal of an N-wide BVH. `intersect_leaf(first, count, ray_t)`
+should return true on a hit and shrink ray_t.max to the hit distance. Any hit traversals (for
+occlusion queries) return as soon as a leaf reports a hit. */
+template <int N, bool any_hit = false, typename LeafFn>
+bool TraverseWideBVH(const std::vector<WideBVH_Node<N>>& nodes, const Ray& ray, Interval ray_t, LeafFn intersect_leaf)
+{
+	if (nodes.empty()) return false;
+
+	class StackEntry
+	{
+	public:
+		std::uint32_t child;
+		std::uint32_t prim_count;
+		double t_near;
+	};
+
+	const WideBVH_Ray wide_ray(ray);
+	StackEntry stack[BVH_Builder::max_depth * (N - 1) + 1];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, ray_t.min };
+
+	bool hit_anything = false;
+	alignas(32) float t_near[N];
+
+	while (stack_size > 0)
+	{
+		StackEntry entry = stack[--stack_size];
+
+		/* Skip entries that lie beyond the closest hit found since they were pushed */
+		if (entry.t_near > ray_t.max) continue;
+
+		if (entry.prim_count > 0)
+		{
+			if (intersect_leaf(entry.child, entry.prim_count, ray_t))
+			{
+				if constexpr (any_hit) return true;
+				hit_anything = true;
+			}
+			continue;
+		}
+
+		const WideBVH_Node<N>& node = nodes[entry.child];
+		int mask = IntersectWideNode<N>(node, wide_ray, (float)ray_t.min, (float)ray_t.max, t_near);
+
+		/* Push the hit children so that the nearest one is popped first (insertion sort on entry distance) */
+		int first = stack_size;
+		while (mask)
+		{
+			int slot = 0;
+			while (!(mask & (1 << slot))) slot++;
+			mask &= ~(1 << slot);
+
+			/* Rays with NaN components pass every slab test, so empty slots must be skipped explicitly */
+			if (node.IsEmpty(slot)) continue;
+
+			StackEntry child_entry = { node.child[slot], node.prim_count[slot], (double)t_near[slot] };
+			int i = stack_size++;
+			while (i > first && stack[i - 1].t_near < child_entry.t_near)
+			{
+				stack[i] = stack[i - 1];
+				i--;
+			}
+			stack[i] = child_entry;
+		}
+	}
+
+	return hit_anything;
+}
+
+
+/* An N-wide BVH (4 for SSE, 8 for AVX) built by collapsing a binary BVH */
+template <int N>
+class WideBVH : public Hittable
+{
+public:
+	WideBVH(const HittableList& list, const BVH_BuildParams& params = BVH_BuildParams());
+
+	bool Hit(const Ray& ray, Interval ray_t, HitRecord& hrec) const override;
+
+	bool Occluded(const Ray& ray, Real t_max) const override;
+
+	bool HitInterval(const Ray& ray, Interval ray_t, HitSpans& spans) const override;
+
+	/* True if all primitives are closed */
+	bool IsClosed() const override { return closed; }
+
+	void SetTransform(const Transform& t_transform) override { WorldSpaceTransform("WideBVH"); }
+
+	/* Returns the SAH cost of the binary tree this BVH was collapsed from (at its last build) */
+	double SAH_Cost() const { return sah_cost; }
+
+	size_t NodeCount() const { return nodes.size(); }
+
+	/* Refit the BVH (see BVH_BuildParams::refit_rebuild_threshold). The rebuild is decided by the SAH cost of the
+	wide nodes rather than of the binary tree they were collapsed from. */
+	bool Refit(const BVH_BuildParams& params = BVH_BuildParams());
+
+private:
+	std::vector<std::shared_ptr<Hittable>> primitives;
+	bool closed = false;
+	std::vector<std::uint32_t> primitive_indices;
+	std::vector<WideBVH_Node<N>> nodes;
+	double sah_cost = 0.0;
+	double built_wide_cost = 0.0; /* SAH cost of the wide nodes after the last build */
+
+private:
+	void Build(const BVH_BuildParams& params);
+
+	/* Refit the subtree below wide node `index` and return its bounds. The subtrees `thread_depth` binary levels further down are refit on separate threads */
+	AABB RefitNode(std::uint32_t index, int thread_depth);
+
+	/* Returns the SAH cost of the wide nodes from their current bounds */
+	double ComputeWideCost(const BVH_BuildParams& params) const;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+} /* namespace rt */